@@ -13,18 +13,44 @@
 #include "ns3/nr-module.h"
 #include "ns3/point-to-point-module.h"
 
+#ifdef NS3_MPI
+#include "ns3/mpi-interface.h"
+#include <mpi.h>
+#endif
+
+#include <array>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if __has_include(<experimental/simd>) && !defined(NR_NO_SIMD)
+#include <experimental/simd>
+#define NR_HAVE_SIMD 1
+namespace stdx = std::experimental;
+#endif
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <atomic>
+#include <thread>
 
 using namespace ns3;
 
@@ -36,8 +62,146 @@ struct ChannelMetrics {
     double sumRsrpDbm = 0.0;
     double sumRsrqDb = 0.0;
     uint32_t samples = 0;
-    double maxSinr = -1000.0;
-    double minSinr = 1000.0;
+    // Extremos exactos sobre todos los TBs, en lineal: no hace falta log10 por
+    // TB y la conversión a dB (monótona) se hace solo al reportar
+    uint64_t observed = 0;
+    double maxSinrLinear = 0.0;
+    double minSinrLinear = std::numeric_limits<double>::max();
+    // Momentos de Welford: media y varianza en línea sin guardar las muestras
+    double meanSinrDb = 0.0;
+    double m2SinrDb = 0.0;
+
+    void ObserveSinr(double sinrLinear)
+    {
+        observed++;
+        maxSinrLinear = std::max(maxSinrLinear, sinrLinear);
+        minSinrLinear = std::min(minSinrLinear, sinrLinear);
+    }
+
+    double MaxSinrDb() const { return (observed > 0) ? 10.0 * std::log10(maxSinrLinear) : -1000.0; }
+    double MinSinrDb() const { return (observed > 0) ? 10.0 * std::log10(minSinrLinear) : 1000.0; }
+
+    // Muestra (posiblemente submuestreada) para media y desviación
+    void AddSinrSample(double sinrDb)
+    {
+        sumSinrDb += sinrDb;
+        samples++;
+
+        double delta = sinrDb - meanSinrDb;
+        meanSinrDb += delta / samples;
+        m2SinrDb += delta * (sinrDb - meanSinrDb);
+    }
+
+    double SinrStdDev() const
+    {
+        return (samples > 1) ? std::sqrt(m2SinrDb / (samples - 1)) : 0.0;
+    }
+};
+
+// Sketch de cuantiles DDSketch (Masson et al., VLDB 2019): cubos logarítmicos
+// de razón gamma = (1+a)/(1-a), de modo que cualquier cuantil tiene error
+// relativo <= a. Memoria acotada por maxBins (al superarlo se pliegan los cubos
+// más bajos, que solo afectan a los cuantiles inferiores) y fusionable sumando
+// cubos: sirve para agregar flujos en celdas y réplicas en la consolidación.
+class DDSketch {
+public:
+    static constexpr double DEFAULT_ACCURACY = 0.01;
+    static constexpr uint32_t DEFAULT_MAX_BINS = 2048;
+    static constexpr double MIN_VALUE = 1e-9; // límite superior del cubo cero
+    
+    explicit DDSketch(double relativeAccuracy = DEFAULT_ACCURACY, uint32_t maxBins = DEFAULT_MAX_BINS)
+        : m_gamma((1.0 + relativeAccuracy) / (1.0 - relativeAccuracy)),
+          m_invLogGamma(1.0 / std::log(m_gamma)),
+          m_maxBins(maxBins)
+    {
+    }
+    
+    // Valores <= 0 (o por debajo del mínimo representable) van al cubo cero
+    void Add(double value, uint64_t count = 1)
+    {
+        m_count += count;
+        if (!(value > MIN_VALUE)) {
+            m_zeroCount += count;
+            return;
+        }
+        AddToBin(static_cast<int32_t>(std::ceil(std::log(value) * m_invLogGamma)), count);
+    }
+    
+    void Merge(const DDSketch& other)
+    {
+        m_count += other.m_count;
+        m_zeroCount += other.m_zeroCount;
+        for (std::size_t i = 0; i < other.m_bins.size(); ++i) {
+            if (other.m_bins[i] > 0) AddToBin(other.m_offset + static_cast<int32_t>(i), other.m_bins[i]);
+        }
+    }
+    
+    uint64_t GetCount() const { return m_count; }
+    double GetGamma() const { return m_gamma; }
+    
+    // Cuantil q en [0, 1]; 0 si el sketch está vacío
+    double Quantile(double q) const
+    {
+        if (m_count == 0) return 0.0;
+        double rank = q * (m_count - 1);
+        if (rank < m_zeroCount) return 0.0;
+        uint64_t cumulative = m_zeroCount;
+        for (std::size_t i = 0; i < m_bins.size(); ++i) {
+            cumulative += m_bins[i];
+            if (cumulative > rank) return BinValue(m_offset + static_cast<int32_t>(i));
+        }
+        return BinValue(m_offset + static_cast<int32_t>(m_bins.size()) - 1);
+    }
+    
+    // Serialización compacta: "zero;clave:cuenta clave:cuenta ..."
+    std::string Encode() const
+    {
+        std::ostringstream out;
+        out << m_zeroCount << ";";
+        bool first = true;
+        for (std::size_t i = 0; i < m_bins.size(); ++i) {
+            if (m_bins[i] == 0) continue;
+            out << (first ? "" : " ") << (m_offset + static_cast<int32_t>(i)) << ":" << m_bins[i];
+            first = false;
+        }
+        return out.str();
+    }
+    
+private:
+    // Estimador del cubo (gamma^(k-1), gamma^k] con error relativo <= a
+    double BinValue(int32_t key) const { return 2.0 * std::pow(m_gamma, key) / (1.0 + m_gamma); }
+    
+    void AddToBin(int32_t key, uint64_t count)
+    {
+        if (m_bins.empty()) {
+            m_offset = key;
+            m_bins.assign(1, 0);
+        } else if (key < m_offset) {
+            m_bins.insert(m_bins.begin(), m_offset - key, 0);
+            m_offset = key;
+        } else if (key >= m_offset + static_cast<int32_t>(m_bins.size())) {
+            m_bins.resize(key - m_offset + 1, 0);
+        }
+        m_bins[key - m_offset] += count;
+        
+        // Plegar los cubos más bajos en el primero que se conserva
+        if (m_bins.size() > m_maxBins) {
+            std::size_t excess = m_bins.size() - m_maxBins;
+            uint64_t folded = 0;
+            for (std::size_t i = 0; i < excess; ++i) folded += m_bins[i];
+            m_bins.erase(m_bins.begin(), m_bins.begin() + excess);
+            m_bins[0] += folded;
+            m_offset += static_cast<int32_t>(excess);
+        }
+    }
+    
+    double m_gamma;
+    double m_invLogGamma;
+    uint32_t m_maxBins;
+    int32_t m_offset = 0; // clave del cubo m_bins[0]
+    std::vector<uint64_t> m_bins;
+    uint64_t m_zeroCount = 0;
+    uint64_t m_count = 0;
 };
 
 struct QoEMetrics {
@@ -48,13 +212,118 @@ struct QoEMetrics {
     uint32_t flows = 0;
 };
 
+enum TrafficClass : uint8_t {
+    TRAFFIC_EMBB = 0,
+    TRAFFIC_URLLC = 1
+};
+
+// Resultado de resolver la dirección destino de un flujo
+struct UeFlowKey {
+    uint64_t imsi = 0;
+    uint32_t ueIndex = 0;
+    TrafficClass trafficClass = TRAFFIC_EMBB;
+};
+
+// ================== Registro denso de métricas por UE =====================
+// InstallUeDevice asigna IMSIs contiguos: se traducen una sola vez a un índice
+// denso y el estado por UE vive en arreglos contiguos (struct-of-arrays).
+struct UeMetricsRegistry {
+    static constexpr uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+    uint64_t firstImsi = 0;
+    std::vector<uint64_t> imsi;
+    std::vector<ChannelMetrics> channel;
+    std::vector<uint8_t> traced;        // UEs con RxPacketTraceUe (ver UeTraceSelection)
+    uint32_t tracedCount = 0;
+    std::vector<DDSketch> delaySketch; // retardo extremo a extremo por paquete (ms)
+    std::vector<DDSketch> sinrSketch;  // SINR lineal de los TBs muestreados
+    std::vector<uint32_t> servingCell;
+    std::vector<double> distance;
+    std::vector<uint32_t> cellUeCount; // indexado por celda
+    uint32_t neighbourK = 0;
+    std::vector<uint32_t> neighbourCells;     // numUes x neighbourK, la propia celda primero
+    std::vector<double> neighbourDistance;    // misma disposición que neighbourCells
+    std::vector<TrafficClass> trafficClass;
+    std::unordered_map<uint32_t, UeFlowKey> addressIndex; // Ipv4Address::Get() -> UE
+    std::vector<FlowMonitor::FlowStats> appFlow; // solo con --flowAccounting=apps
+
+    void Build(const NetDeviceContainer& ueDevices, uint32_t numCells)
+    {
+        uint32_t numUes = ueDevices.GetN();
+        imsi.resize(numUes);
+        for (uint32_t i = 0; i < numUes; ++i) {
+            imsi[i] = ueDevices.Get(i)->GetObject<NrUeNetDevice>()->GetImsi();
+        }
+        firstImsi = (numUes > 0) ? imsi[0] : 0;
+        for (uint32_t i = 0; i < numUes; ++i) {
+            NS_ABORT_MSG_IF(imsi[i] != firstImsi + i,
+                            "IMSIs no contiguos: el UE " << i << " tiene IMSI " << imsi[i]);
+        }
+
+        channel.assign(numUes, ChannelMetrics());
+        traced.assign(numUes, 0);
+        tracedCount = 0;
+        delaySketch.assign(numUes, DDSketch());
+        sinrSketch.assign(numUes, DDSketch());
+        servingCell.assign(numUes, 0);
+        distance.assign(numUes, 0.0);
+        cellUeCount.assign(numCells, 0);
+        trafficClass.assign(numUes, TRAFFIC_EMBB);
+        addressIndex.clear();
+        appFlow.clear();
+    }
+
+    // Construye el índice dirección -> (IMSI, índice, clase) tras AssignUeIpv4Address
+    void IndexAddresses(const Ipv4InterfaceContainer& ueIpIfaces, uint32_t numEmbbUes)
+    {
+        addressIndex.reserve(imsi.size());
+        for (uint32_t i = 0; i < imsi.size(); ++i) {
+            trafficClass[i] = (i < numEmbbUes) ? TRAFFIC_EMBB : TRAFFIC_URLLC;
+            addressIndex[ueIpIfaces.GetAddress(i).Get()] = UeFlowKey{imsi[i], i, trafficClass[i]};
+        }
+    }
+
+    void SetTraced(const std::vector<uint8_t>& selection)
+    {
+        traced = selection;
+        tracedCount = std::count(traced.begin(), traced.end(), 1);
+    }
+    
+    uint32_t GetTracedCount() const { return tracedCount; }
+    
+    const UeFlowKey* Lookup(Ipv4Address address) const
+    {
+        auto it = addressIndex.find(address.Get());
+        return (it != addressIndex.end()) ? &it->second : nullptr;
+    }
+
+    uint32_t Index(uint64_t ueImsi) const
+    {
+        uint64_t offset = ueImsi - firstImsi;
+        return (offset < imsi.size()) ? static_cast<uint32_t>(offset) : INVALID_INDEX;
+    }
+};
+
+// Invocaciones de las trazas por tipo (coste de instrumentación)
+struct CallbackCounters {
+    uint64_t sinr = 0;
+    uint64_t rsrp = 0;
+    uint64_t rsrq = 0;
+    uint64_t handover = 0;
+    uint64_t mac = 0;
+    // Tiempo acumulado dentro de cada traza (solo con --profileCallbacks)
+    uint64_t sinrNs = 0;
+    uint64_t rsrpNs = 0;
+    uint64_t rsrqNs = 0;
+    uint64_t handoverNs = 0;
+    uint64_t macNs = 0;
+};
+
 // Variables globales para métricas
-static std::unordered_map<uint64_t, ChannelMetrics> g_channelMetrics;
+static UeMetricsRegistry g_ueMetrics;
+static CallbackCounters g_callbackCounts;
+static bool g_profileCallbacks = false;
 static std::unordered_map<uint32_t, QoEMetrics> g_cellQoE;
-static std::unordered_map<uint64_t, uint32_t> g_imsiToCell;
-static std::unordered_map<uint64_t, double> g_imsiDistance;
-static std::unordered_map<uint32_t, uint32_t> g_cellUeCount;
-static std::unordered_map<uint64_t, std::vector<double>> g_sinrHistory;
 
 
 // Contadores de handover
@@ -62,55 +331,761 @@ static uint32_t g_handoverAttempts = 0;
 static uint32_t g_handoverSuccess = 0;
 static uint32_t g_handoverFailures = 0;
 
+// ==================== Registro de handovers ================================
+// Cola SPSC acotada sin bloqueos: el hilo de simulación produce y un hilo de
+// volcado consume. N debe ser potencia de 2; los índices crecen sin límite y
+// se enmascaran al acceder.
+template <typename T, std::size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "La capacidad debe ser potencia de 2");
+    
+public:
+    bool TryPush(const T& item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N) return false;
+        m_items[head & (N - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Extrae hasta max elementos en out; devuelve cuántos
+    std::size_t PopBatch(T* out, std::size_t max)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        std::size_t available = m_head.load(std::memory_order_acquire) - tail;
+        std::size_t n = std::min(available, max);
+        for (std::size_t i = 0; i < n; ++i) out[i] = m_items[(tail + i) & (N - 1)];
+        m_tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+    
+private:
+    std::array<T, N> m_items;
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+// Un evento por handover terminado (éxito o fallo). Tiempos en ns de simulación:
+//   preparación  = HandoverStart en la UE - HandoverStart en la gNB origen
+//   interrupción = HandoverEndOk/EndError en la UE - HandoverStart en la UE
+// (la UE está desconectada entre la orden de handover y el fin del RACH en destino)
+struct HandoverRecord {
+    int64_t timeNs;          // fin del handover
+    uint64_t imsi;
+    int64_t preparationNs;   // -1 si no se vio el inicio en la gNB
+    int64_t interruptionNs;
+    uint16_t sourceCell;     // índice de celda (orden de gnbDevices)
+    uint16_t targetCell;
+    uint8_t outcome;         // 1 = éxito, 0 = fallo
+    uint8_t pingPong;        // vuelta a la celda anterior dentro de la ventana
+    uint8_t pad[6];
+};
+static_assert(sizeof(HandoverRecord) == 48, "Registro NRHO de 48 bytes");
+
+// Registro de handovers: estado pendiente por IMSI, estadísticas por celda
+// origen y flujo binario "NRHO" escrito por un hilo en segundo plano.
+//
+// Formato NRHO v1 (little-endian): cabecera de 16 B (char magic[4] = "NRHO",
+// uint32 version = 1, uint32 tamaño de registro = 48, uint32 reservado) y un
+// HandoverRecord por evento, en orden de fin.
+class HandoverLog {
+public:
+    struct CellStats {
+        uint64_t attempts = 0;
+        uint64_t success = 0;
+        uint64_t failures = 0;
+        uint64_t incoming = 0;
+        uint64_t pingPong = 0;
+        DDSketch preparationMs;
+        DDSketch interruptionMs;
+    };
+    
+    // cellIds[i] = CellId NR de la gNB i; ueCount dimensiona el estado por UE
+    void Open(const std::string& file, const std::vector<uint16_t>& cellIds, uint32_t ueCount,
+              uint64_t firstImsi, double pingPongWindow)
+    {
+        m_cellIndex.clear();
+        for (uint32_t i = 0; i < cellIds.size(); ++i) m_cellIndex[cellIds[i]] = i;
+        m_cells.assign(cellIds.size(), CellStats());
+        m_pending.assign(ueCount, Pending());
+        m_lastSuccess.assign(ueCount, LastHandover());
+        m_detailed.assign(ueCount, 1);
+        m_firstImsi = firstImsi;
+        m_pingPongWindowNs = static_cast<int64_t>(pingPongWindow * 1e9);
+        m_records = 0;
+        m_stalls = 0;
+        m_unknownCells = 0;
+        
+        m_out.open(file, std::ios::binary);
+        const uint32_t header[4] = {0x4F48524E /* "NRHO" */, 1, sizeof(HandoverRecord), 0};
+        m_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        m_running.store(true, std::memory_order_release);
+        m_writer = std::thread(&HandoverLog::WriterLoop, this);
+    }
+    
+    // Solo los UEs con detailed[i] = 1 generan registro NRHO y muestras de
+    // preparación/interrupción; el resto cuenta intentos, éxitos y ping-pong
+    void SetDetailed(const std::vector<uint8_t>& detailed) { m_detailed = detailed; }
+    
+    // Vacía la cola y espera al hilo de volcado
+    void Close()
+    {
+        if (!m_writer.joinable()) return;
+        m_running.store(false, std::memory_order_release);
+        m_writer.join();
+        m_out.close();
+    }
+    
+    // NrGnbRrc::HandoverStart en la gNB origen (decisión de handover)
+    void GnbStart(uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId)
+    {
+        uint32_t ue = UeIndex(imsi);
+        if (ue < m_pending.size()) m_pending[ue].gnbStartNs = Simulator::Now().GetNanoSeconds();
+    }
+    
+    // NrUeRrc::HandoverStart: la UE recibe la orden y deja la celda origen
+    void UeStart(uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId)
+    {
+        uint32_t ue = UeIndex(imsi);
+        if (ue >= m_pending.size()) return;
+        Pending& p = m_pending[ue];
+        uint16_t source = CellIndex(cellId);
+        uint16_t target = CellIndex(targetCellId);
+        if (source == INVALID_CELL || target == INVALID_CELL) {
+            // CellId ajeno a las gNB registradas: no se atribuye a ninguna celda
+            m_unknownCells++;
+            p = Pending();
+            return;
+        }
+        p.ueStartNs = Simulator::Now().GetNanoSeconds();
+        p.source = source;
+        p.target = target;
+        p.active = true;
+        m_cells[p.source].attempts++;
+    }
+    
+    void UeEnd(uint64_t imsi, bool success)
+    {
+        uint32_t ue = UeIndex(imsi);
+        if (ue >= m_pending.size() || !m_pending[ue].active) return;
+        Pending& p = m_pending[ue];
+        int64_t now = Simulator::Now().GetNanoSeconds();
+        
+        HandoverRecord record{};
+        record.timeNs = now;
+        record.imsi = imsi;
+        record.preparationNs = (p.gnbStartNs >= 0 && p.gnbStartNs <= p.ueStartNs) ?
+                               p.ueStartNs - p.gnbStartNs : -1;
+        record.interruptionNs = now - p.ueStartNs;
+        record.sourceCell = p.source;
+        record.targetCell = p.target;
+        record.outcome = success ? 1 : 0;
+        
+        CellStats& cell = m_cells[p.source];
+        if (success) {
+            cell.success++;
+            m_cells[p.target].incoming++;
+            
+            // Ping-pong: vuelta a la celda de la que se salió en el handover
+            // anterior; como el resto de la tabla, cuenta en la celda origen
+            LastHandover& last = m_lastSuccess[ue];
+            if (last.valid && last.source == p.target && last.target == p.source &&
+                now - last.timeNs <= m_pingPongWindowNs) {
+                record.pingPong = 1;
+                cell.pingPong++;
+            }
+            last = {true, now, p.source, p.target};
+        } else {
+            cell.failures++;
+        }
+        if (!m_detailed[ue]) {
+            p = Pending();
+            return;
+        }
+        if (record.preparationNs >= 0) cell.preparationMs.Add(record.preparationNs * 1e-6);
+        cell.interruptionMs.Add(record.interruptionNs * 1e-6);
+        
+        // Si la cola está llena (el volcado no da abasto) se espera: no se pierden eventos
+        while (!m_queue.TryPush(record)) {
+            m_stalls++;
+            std::this_thread::yield();
+        }
+        m_records++;
+        p = Pending();
+    }
+    
+    const std::vector<CellStats>& GetCells() const { return m_cells; }
+    uint64_t GetRecords() const { return m_records; }
+    uint64_t GetStalls() const { return m_stalls; }
+    uint64_t GetUnknownCells() const { return m_unknownCells; }
+    
+private:
+    static constexpr uint16_t INVALID_CELL = std::numeric_limits<uint16_t>::max();
+    static constexpr std::size_t QUEUE_CAPACITY = 4096;
+    static constexpr std::size_t WRITE_BATCH = 256;
+    
+    struct Pending {
+        bool active = false;
+        int64_t gnbStartNs = -1;
+        int64_t ueStartNs = 0;
+        uint16_t source = 0;
+        uint16_t target = 0;
+    };
+    struct LastHandover {
+        bool valid = false;
+        int64_t timeNs = 0;
+        uint16_t source = 0;
+        uint16_t target = 0;
+    };
+    
+    uint32_t UeIndex(uint64_t imsi) const { return static_cast<uint32_t>(imsi - m_firstImsi); }
+    
+    uint16_t CellIndex(uint16_t cellId) const
+    {
+        auto it = m_cellIndex.find(cellId);
+        return (it != m_cellIndex.end()) ? it->second : INVALID_CELL;
+    }
+    
+    // Hilo de volcado: lotes de la cola al archivo; al cerrar, drena lo pendiente
+    void WriterLoop()
+    {
+        std::array<HandoverRecord, WRITE_BATCH> batch;
+        while (true) {
+            bool running = m_running.load(std::memory_order_acquire);
+            std::size_t n = m_queue.PopBatch(batch.data(), batch.size());
+            if (n > 0) {
+                m_out.write(reinterpret_cast<const char*>(batch.data()), n * sizeof(HandoverRecord));
+            } else if (!running) {
+                break;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    
+    std::unordered_map<uint16_t, uint16_t> m_cellIndex;
+    std::vector<CellStats> m_cells;
+    std::vector<Pending> m_pending;
+    std::vector<LastHandover> m_lastSuccess;
+    std::vector<uint8_t> m_detailed;
+    uint64_t m_firstImsi = 0;
+    int64_t m_pingPongWindowNs = 0;
+    uint64_t m_records = 0;
+    uint64_t m_stalls = 0;
+    uint64_t m_unknownCells = 0; // handovers descartados por CellId desconocido
+    
+    SpscRing<HandoverRecord, QUEUE_CAPACITY> m_queue;
+    std::ofstream m_out;
+    std::thread m_writer;
+    std::atomic<bool> m_running{false};
+};
+
+static HandoverLog g_handoverLog;
+
+// ==================== Política de muestreo del SINR =======================
+// Qué TBs de RxPacketTraceUe entran en la media y la desviación del SINR. Los
+// extremos se calculan siempre sobre todos los TBs (ChannelMetrics::ObserveSinr).
+//   full      : todos los TBs
+//   nth       : uno de cada N TBs por UE (muestreo sistemático)
+//   slot      : el primer TB de cada slot por UE (media ponderada en tiempo)
+//   reservoir : muestra uniforme de tamaño fijo por UE (algoritmo L de Li);
+//               media y desviación se calculan al final, así que la serie
+//               temporal de KPIs no tiene SINR con esta política
+class SinrSampler {
+public:
+    enum Policy {
+        FULL,
+        NTH,
+        SLOT,
+        RESERVOIR
+    };
+    
+    static bool ParsePolicy(const std::string& name, Policy& policy)
+    {
+        if (name == "full") policy = FULL;
+        else if (name == "nth") policy = NTH;
+        else if (name == "slot") policy = SLOT;
+        else if (name == "reservoir") policy = RESERVOIR;
+        else return false;
+        return true;
+    }
+    
+    void Setup(Policy policy, uint32_t nth, uint32_t reservoirSize, uint32_t numUes)
+    {
+        m_policy = policy;
+        m_nth = std::max(nth, 1u);
+        m_reservoirSize = std::max(reservoirSize, 1u);
+        m_tbCount.assign(numUes, 0);
+        m_lastSlot.assign(numUes, std::numeric_limits<uint64_t>::max());
+        m_reservoirs.assign((policy == RESERVOIR) ? numUes : 0, Reservoir());
+        m_uniform = (policy == RESERVOIR) ? CreateObject<UniformRandomVariable>() : nullptr;
+    }
+    
+    // true si el TB debe entrar ya en las estadísticas de ChannelMetrics
+    bool Sample(uint32_t ueIdx, const RxPacketTraceParams& params)
+    {
+        switch (m_policy) {
+        case FULL:
+            return true;
+        case NTH:
+            return (m_tbCount[ueIdx]++ % m_nth) == 0;
+        case SLOT: {
+            uint64_t slot = (static_cast<uint64_t>(params.m_frameNum) << 24) |
+                            (static_cast<uint64_t>(params.m_subframeNum) << 16) | params.m_slotNum;
+            if (slot == m_lastSlot[ueIdx]) return false;
+            m_lastSlot[ueIdx] = slot;
+            return true;
+        }
+        case RESERVOIR:
+            Offer(m_reservoirs[ueIdx], params.m_sinr);
+            return false;
+        }
+        return true;
+    }
+    
+    // Vuelca las reservas a ChannelMetrics y al sketch (solo política reservoir)
+    void Finalize()
+    {
+        for (uint32_t i = 0; i < m_reservoirs.size(); ++i) {
+            for (double sinrDb : m_reservoirs[i].values) {
+                g_ueMetrics.channel[i].AddSinrSample(sinrDb);
+                g_ueMetrics.sinrSketch[i].Add(std::pow(10.0, sinrDb / 10.0));
+            }
+        }
+        m_reservoirs.clear();
+    }
+    
+private:
+    struct Reservoir {
+        std::vector<double> values; // SINR en dB de los TBs retenidos
+        uint64_t seen = 0;
+        uint64_t next = 0;          // índice del próximo TB que entra
+        double w = 0.0;
+    };
+    
+    // Algoritmo L: O(k (1 + log(n/k))) números aleatorios y log10 en total
+    void Offer(Reservoir& r, double sinrLinear)
+    {
+        uint64_t i = r.seen++;
+        if (i < m_reservoirSize) {
+            r.values.push_back(10.0 * std::log10(sinrLinear));
+            if (r.seen == m_reservoirSize) {
+                r.w = std::exp(std::log(UniformOpen()) / m_reservoirSize);
+                r.next = i + 1 + Skip(r.w);
+            }
+            return;
+        }
+        if (i != r.next) return;
+        uint32_t slot = std::min<uint32_t>(m_uniform->GetValue(0.0, m_reservoirSize), m_reservoirSize - 1);
+        r.values[slot] = 10.0 * std::log10(sinrLinear);
+        r.w *= std::exp(std::log(UniformOpen()) / m_reservoirSize);
+        r.next = i + 1 + Skip(r.w);
+    }
+    
+    uint64_t Skip(double w)
+    {
+        double skip = std::floor(std::log(UniformOpen()) / std::log(1.0 - w));
+        return (skip < 1e18) ? static_cast<uint64_t>(skip) : std::numeric_limits<uint64_t>::max() / 2;
+    }
+    
+    double UniformOpen()
+    {
+        double u = m_uniform->GetValue(0.0, 1.0);
+        return (u > 0.0) ? u : std::numeric_limits<double>::min();
+    }
+    
+    Policy m_policy = FULL;
+    uint32_t m_nth = 10;
+    uint32_t m_reservoirSize = 256;
+    std::vector<uint64_t> m_tbCount;
+    std::vector<uint64_t> m_lastSlot;
+    std::vector<Reservoir> m_reservoirs;
+    Ptr<UniformRandomVariable> m_uniform;
+};
+
+static SinrSampler g_sinrSampler;
+
+// ==================== Selección de UEs trazados ===========================
+// Qué UEs conectan RxPacketTraceUe (SINR por TB) y guardan registros de
+// handover detallados (--traceUes). El resto solo alimenta contadores: flujo,
+// retardo por paquete y recuento de handovers, con coste independiente de su
+// número de TBs.
+//   all       : todos los UEs
+//   none      : ninguno
+//   list:a,b  : los índices de UE indicados
+//   random:K  : K UEs por celda, estratificados por distancia a la celda (la
+//               celda se ordena por distancia, se parte en K tramos de igual
+//               tamaño y se sortea un UE en cada tramo)
+class UeTraceSelection {
+public:
+    static constexpr int64_t TRACE_SELECTION_STREAM = 1000;
+    
+    enum Policy {
+        ALL,
+        NONE,
+        LIST,
+        RANDOM
+    };
+    
+    bool Parse(const std::string& spec)
+    {
+        m_list.clear();
+        m_perCell = 0;
+        if (spec == "all") {
+            m_policy = ALL;
+        } else if (spec == "none") {
+            m_policy = NONE;
+        } else if (spec.rfind("list:", 0) == 0) {
+            m_policy = LIST;
+            std::istringstream in(spec.substr(5));
+            std::string item;
+            while (std::getline(in, item, ',')) {
+                char* end = nullptr;
+                unsigned long ue = std::strtoul(item.c_str(), &end, 10);
+                if (item.empty() || *end != '\0') return false;
+                m_list.push_back(ue);
+            }
+            return !m_list.empty();
+        } else if (spec.rfind("random:", 0) == 0) {
+            m_policy = RANDOM;
+            char* end = nullptr;
+            m_perCell = std::strtoul(spec.c_str() + 7, &end, 10);
+            return *end == '\0' && m_perCell > 0;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    Policy GetPolicy() const { return m_policy; }
+    
+    // traced[i] = 1 si el UE i se traza; usa la asociación ya resuelta
+    std::vector<uint8_t> Select(const std::vector<uint32_t>& servingCell,
+                                const std::vector<double>& distance, uint32_t numCells) const
+    {
+        uint32_t numUes = servingCell.size();
+        std::vector<uint8_t> traced(numUes, (m_policy == ALL) ? 1 : 0);
+        if (m_policy == LIST) {
+            for (uint32_t ue : m_list) {
+                if (ue < numUes) traced[ue] = 1;
+            }
+        } else if (m_policy == RANDOM) {
+            std::vector<std::vector<uint32_t>> cellUes(numCells);
+            for (uint32_t i = 0; i < numUes; ++i) cellUes[servingCell[i]].push_back(i);
+            // Flujo fijo: el sorteo no consume números de flujo automáticos y
+            // no desplaza los de los modelos que se crean después
+            Ptr<UniformRandomVariable> uniform = CreateObject<UniformRandomVariable>();
+            uniform->SetStream(TRACE_SELECTION_STREAM);
+            for (std::vector<uint32_t>& ues : cellUes) {
+                std::sort(ues.begin(), ues.end(),
+                          [&distance](uint32_t a, uint32_t b) { return distance[a] < distance[b]; });
+                uint32_t n = ues.size();
+                uint32_t strata = std::min(m_perCell, n);
+                for (uint32_t s = 0; s < strata; ++s) {
+                    uint32_t begin = static_cast<uint64_t>(s) * n / strata;
+                    uint32_t end = static_cast<uint64_t>(s + 1) * n / strata;
+                    uint32_t pick = uniform->GetInteger(begin, end - 1);
+                    traced[ues[pick]] = 1;
+                }
+            }
+        }
+        return traced;
+    }
+    
+private:
+    Policy m_policy = ALL;
+    std::vector<uint32_t> m_list;
+    uint32_t m_perCell = 0;
+};
+
 // ==================== Callbacks para métricas ============================
+// Acumula en accumulatorNs el tiempo de pared del ámbito si el perfilado de
+// trazas está activo; si no, solo cuesta una comprobación
+class CallbackTimer {
+public:
+    explicit CallbackTimer(uint64_t& accumulatorNs)
+        : m_accumulator(g_profileCallbacks ? &accumulatorNs : nullptr)
+    {
+        if (m_accumulator != nullptr) m_start = std::chrono::steady_clock::now();
+    }
+    
+    ~CallbackTimer()
+    {
+        if (m_accumulator == nullptr) return;
+        *m_accumulator += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start).count();
+    }
+    
+private:
+    uint64_t* m_accumulator;
+    std::chrono::steady_clock::time_point m_start;
+};
+
 static void
 EnhancedSinrCallback(uint64_t imsi, RxPacketTraceParams params)
 {
-    if (params.m_sinr > 0.0) {
-        double sinrDb = 10.0 * std::log10(params.m_sinr);
-        
-        auto& metrics = g_channelMetrics[imsi];
-        metrics.sumSinrDb += sinrDb;
-        metrics.samples++;
-        metrics.maxSinr = std::max(metrics.maxSinr, sinrDb);
-        metrics.minSinr = std::min(metrics.minSinr, sinrDb);
-        
-        // Historial para análisis de variabilidad
-        g_sinrHistory[imsi].push_back(sinrDb);
-        if (g_sinrHistory[imsi].size() > 1000) {
-            g_sinrHistory[imsi].erase(g_sinrHistory[imsi].begin());
-        }
+    g_callbackCounts.sinr++;
+    CallbackTimer timer(g_callbackCounts.sinrNs);
+    uint32_t idx = g_ueMetrics.Index(imsi);
+    if (params.m_sinr <= 0.0 || idx == UeMetricsRegistry::INVALID_INDEX) return;
+    
+    ChannelMetrics& chan = g_ueMetrics.channel[idx];
+    chan.ObserveSinr(params.m_sinr);
+    if (!g_sinrSampler.Sample(idx, params)) return;
+    
+    double sinrDb = 10.0 * std::log10(params.m_sinr);
+    chan.AddSinrSample(sinrDb);
+    g_ueMetrics.sinrSketch[idx].Add(params.m_sinr);
+}
+
+// Contabilidad por aplicación (--flowAccounting=apps): un flujo de bajada por
+// UE con los mismos campos que FlowMonitor::FlowStats, alimentado por la traza
+// "Tx" del cliente en el remote host y por las trazas de recepción del sink.
+// FlowMonitor cuenta bytes en la capa IP: se suman las cabeceras IPv4 + UDP.
+static constexpr uint32_t IPV4_UDP_OVERHEAD = 28;
+
+static void
+AppFlowTx(uint32_t ueIdx, uint32_t size)
+{
+    FlowMonitor::FlowStats& fs = g_ueMetrics.appFlow[ueIdx];
+    Time now = Simulator::Now();
+    if (fs.txPackets == 0) fs.timeFirstTxPacket = now;
+    fs.timeLastTxPacket = now;
+    fs.txPackets++;
+    fs.txBytes += size + IPV4_UDP_OVERHEAD;
+}
+
+// OnOffApplication y MultiDestinationUdpClient trazan el paquete completo
+static void
+AppFlowTxCallback(uint32_t ueIdx, Ptr<const Packet> packet)
+{
+    AppFlowTx(ueIdx, packet->GetSize());
+}
+
+// UdpClient dispara "Tx" antes de anteponer el SeqTsHeader
+static void
+UdpClientTxCallback(uint32_t ueIdx, Ptr<const Packet> packet)
+{
+    AppFlowTx(ueIdx, packet->GetSize() + SeqTsHeader().GetSerializedSize());
+}
+
+// Mismo cálculo que FlowMonitor::ReportLastRx (jitter = |retardo - anterior|)
+static void
+AppFlowRx(uint32_t ueIdx, uint32_t size, Time delay)
+{
+    if (g_ueMetrics.appFlow.empty()) return;
+    FlowMonitor::FlowStats& fs = g_ueMetrics.appFlow[ueIdx];
+    Time now = Simulator::Now();
+    if (fs.rxPackets > 0) {
+        int64_t jitterNs = delay.GetNanoSeconds() - fs.lastDelay.GetNanoSeconds();
+        fs.jitterSum += NanoSeconds(std::llabs(jitterNs));
+    } else {
+        fs.timeFirstRxPacket = now;
     }
+    fs.lastDelay = delay;
+    fs.delaySum += delay;
+    fs.timeLastRxPacket = now;
+    fs.rxPackets++;
+    fs.rxBytes += size + IPV4_UDP_OVERHEAD;
+}
+
+// Retardo por paquete URLLC: UdpClient antepone un SeqTsHeader con el instante
+// de envío, que se lee sin copiar desde la traza "Rx" del PacketSink
+static void
+UrllcRxCallback(uint32_t ueIdx, Ptr<const Packet> packet, const Address& from)
+{
+    if (packet->GetSize() < SeqTsHeader().GetSerializedSize()) return;
+    SeqTsHeader header;
+    packet->PeekHeader(header);
+    Time delay = Simulator::Now() - header.GetTs();
+    g_ueMetrics.delaySketch[ueIdx].Add(delay.GetSeconds() * 1000.0);
+    AppFlowRx(ueIdx, packet->GetSize(), delay);
+}
+
+// Retardo por paquete eMBB: OnOff y PacketSink con EnableSeqTsSizeHeader; la
+// traza "RxWithSeqTsSize" entrega la cabecera ya deserializada y el paquete sin
+// ella, así que el tamaño es el de la cabecera (el paquete enviado completo)
+static void
+EmbbRxCallback(uint32_t ueIdx, Ptr<const Packet> packet, const Address& from,
+               const Address& to, const SeqTsSizeHeader& header)
+{
+    Time delay = Simulator::Now() - header.GetTs();
+    g_ueMetrics.delaySketch[ueIdx].Add(delay.GetSeconds() * 1000.0);
+    AppFlowRx(ueIdx, header.GetSize(), delay);
 }
 
 static void
 RsrpCallback(uint64_t imsi, uint16_t cellId, double rsrp)
 {
-    g_channelMetrics[imsi].sumRsrpDbm += rsrp;
+    g_callbackCounts.rsrp++;
+    CallbackTimer timer(g_callbackCounts.rsrpNs);
+    uint32_t idx = g_ueMetrics.Index(imsi);
+    if (idx != UeMetricsRegistry::INVALID_INDEX) {
+        g_ueMetrics.channel[idx].sumRsrpDbm += rsrp;
+    }
 }
 
 static void
 RsrqCallback(uint64_t imsi, uint16_t cellId, double rsrq)
 {
-    g_channelMetrics[imsi].sumRsrqDb += rsrq;
+    g_callbackCounts.rsrq++;
+    CallbackTimer timer(g_callbackCounts.rsrqNs);
+    uint32_t idx = g_ueMetrics.Index(imsi);
+    if (idx != UeMetricsRegistry::INVALID_INDEX) {
+        g_ueMetrics.channel[idx].sumRsrqDb += rsrq;
+    }
 }
 
+// Trazas de handover de RRC (NrUeRrc / NrGnbRrc): la UE marca el inicio de la
+// interrupción y su final; la gNB origen, el inicio de la preparación
 static void
-HandoverStartCallback(uint64_t imsi, uint16_t sourceCellId, uint16_t targetCellId)
+HandoverStartCallback(uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId)
 {
+    g_callbackCounts.handover++;
+    CallbackTimer timer(g_callbackCounts.handoverNs);
     g_handoverAttempts++;
+    g_handoverLog.UeStart(imsi, cellId, rnti, targetCellId);
 }
 
 static void
-HandoverSuccessCallback(uint64_t imsi, uint16_t sourceCellId, uint16_t targetCellId)
+HandoverSuccessCallback(uint64_t imsi, uint16_t cellId, uint16_t rnti)
 {
+    g_callbackCounts.handover++;
+    CallbackTimer timer(g_callbackCounts.handoverNs);
     g_handoverSuccess++;
+    g_handoverLog.UeEnd(imsi, true);
 }
 
 static void
-HandoverFailureCallback(uint64_t imsi, uint16_t sourceCellId, uint16_t targetCellId)
+HandoverFailureCallback(uint64_t imsi, uint16_t cellId, uint16_t rnti)
 {
+    g_callbackCounts.handover++;
+    CallbackTimer timer(g_callbackCounts.handoverNs);
     g_handoverFailures++;
+    g_handoverLog.UeEnd(imsi, false);
+}
+
+static void
+GnbHandoverStartCallback(uint64_t imsi, uint16_t cellId, uint16_t rnti, uint16_t targetCellId)
+{
+    g_callbackCounts.handover++;
+    CallbackTimer timer(g_callbackCounts.handoverNs);
+    g_handoverLog.GnbStart(imsi, cellId, rnti, targetCellId);
+}
+
+// ==================== Estadísticas de planificación MAC ====================
+// Contadores de bajada por celda a partir de las trazas de la gNB:
+// SlotDataStats (PHY: REGs y símbolos de datos usados frente a disponibles en
+// cada slot; un REG es 1 RB × 1 símbolo), DlScheduling (MAC: un registro por
+// TB asignado, con su tamaño y MCS) y DlHarqFeedback (ACK/NACK de cada TB).
+// Separan la capacidad perdida por el planificador (recursos libres con cola),
+// por la interferencia (MCS bajo, NACKs) o por falta de demanda (recursos
+// libres sin cola).
+struct MacCellCounters {
+    static constexpr uint32_t NUM_MCS = 32;
+    
+    uint64_t slots = 0;
+    uint64_t busySlots = 0;    // slots con algún UE planificado
+    uint64_t scheduledUes = 0; // suma por slot de UEs planificados
+    uint64_t usedReg = 0;
+    uint64_t availableReg = 0;
+    uint64_t usedSym = 0;
+    uint64_t availableSym = 0;
+    uint64_t tbs = 0;
+    uint64_t tbBytes = 0;
+    uint64_t mcsSum = 0;
+    std::array<uint64_t, NUM_MCS> mcs{};
+    uint64_t harqAck = 0;
+    uint64_t harqNack = 0;
+    
+    double PrbUtilization() const { return (availableReg > 0) ? 100.0 * usedReg / availableReg : 0.0; }
+    double SymbolUtilization() const { return (availableSym > 0) ? 100.0 * usedSym / availableSym : 0.0; }
+    double UesPerSlot() const { return (slots > 0) ? static_cast<double>(scheduledUes) / slots : 0.0; }
+    double AvgMcs() const { return (tbs > 0) ? static_cast<double>(mcsSum) / tbs : 0.0; }
+    
+    double HarqNackRatio() const
+    {
+        uint64_t feedback = harqAck + harqNack;
+        return (feedback > 0) ? 100.0 * harqNack / feedback : 0.0;
+    }
+    
+    // Bits de TB por elemento de recurso asignado: eficiencia espectral sobre
+    // los recursos usados (incluye las retransmisiones)
+    double BitsPerUsedRe() const { return (usedReg > 0) ? tbBytes * 8.0 / (usedReg * 12.0) : 0.0; }
+    
+    // Diferencia con un estado anterior de los mismos contadores
+    MacCellCounters Since(const MacCellCounters& before) const
+    {
+        MacCellCounters d;
+        d.slots = slots - before.slots;
+        d.busySlots = busySlots - before.busySlots;
+        d.scheduledUes = scheduledUes - before.scheduledUes;
+        d.usedReg = usedReg - before.usedReg;
+        d.availableReg = availableReg - before.availableReg;
+        d.usedSym = usedSym - before.usedSym;
+        d.availableSym = availableSym - before.availableSym;
+        d.tbs = tbs - before.tbs;
+        d.tbBytes = tbBytes - before.tbBytes;
+        d.mcsSum = mcsSum - before.mcsSum;
+        for (uint32_t m = 0; m < NUM_MCS; ++m) d.mcs[m] = mcs[m] - before.mcs[m];
+        d.harqAck = harqAck - before.harqAck;
+        d.harqNack = harqNack - before.harqNack;
+        return d;
+    }
+};
+
+// Indexados por la posición de la gNB en gnbDevices; la línea base se toma al
+// arrancar el tráfico para excluir el attach de los agregados
+static std::vector<MacCellCounters> g_macCells;
+static std::vector<MacCellCounters> g_macBaseline;
+
+static void
+MarkMacBaseline()
+{
+    g_macBaseline = g_macCells;
+}
+
+static void
+SlotDataStatsCallback(uint32_t cell, const SfnSf& sfnSf, uint32_t scheduledUe, uint32_t usedReg,
+                      uint32_t usedSym, uint32_t availableRb, uint32_t availableSym,
+                      uint16_t bwpId, uint16_t cellId)
+{
+    g_callbackCounts.mac++;
+    CallbackTimer timer(g_callbackCounts.macNs);
+    MacCellCounters& mac = g_macCells[cell];
+    mac.slots++;
+    if (scheduledUe > 0) mac.busySlots++;
+    mac.scheduledUes += scheduledUe;
+    mac.usedReg += usedReg;
+    mac.availableReg += static_cast<uint64_t>(availableRb) * availableSym;
+    // Con OFDMA varios UEs comparten símbolos: se cuentan una sola vez
+    mac.usedSym += std::min(usedSym, availableSym);
+    mac.availableSym += availableSym;
+}
+
+static void
+DlSchedulingCallback(uint32_t cell, NrSchedulingCallbackInfo info)
+{
+    g_callbackCounts.mac++;
+    CallbackTimer timer(g_callbackCounts.macNs);
+    MacCellCounters& mac = g_macCells[cell];
+    mac.tbs++;
+    mac.tbBytes += info.m_tbSize;
+    mac.mcsSum += info.m_mcs;
+    mac.mcs[std::min<uint32_t>(info.m_mcs, MacCellCounters::NUM_MCS - 1)]++;
+}
+
+static void
+DlHarqFeedbackCallback(uint32_t cell, DlHarqInfo harq)
+{
+    g_callbackCounts.mac++;
+    CallbackTimer timer(g_callbackCounts.macNs);
+    if (harq.m_harqStatus == DlHarqInfo::ACK) {
+        g_macCells[cell].harqAck++;
+    } else {
+        g_macCells[cell].harqNack++;
+    }
 }
 
 // ==================== Funciones de distribución espacial ==================
@@ -119,179 +1094,3266 @@ enum ScenarioType {
     SPARSE_SUBURBAN = 1
 };
 
-static Ptr<ListPositionAllocator>
-CreateOptimizedCellLayout(uint32_t numCells, double ISD, double baseHeight, ScenarioType scenario)
-{
-    auto positions = CreateObject<ListPositionAllocator>();
+// Celda (gNB) de la malla: posición, orientación del sector y sitio al que pertenece
+struct CellSite {
+    Vector position;
+    double azimuthDeg = 0.0; // orientación de la antena; solo con sectores
+    uint32_t siteId = 0;
+};
+
+// Layout plano: una entrada por gNB, en el mismo orden que gnbNodes
+struct CellLayout {
+    std::vector<CellSite> cells;
+    uint32_t numSites = 0;
+    bool sectorized = false;
+    bool wrapAround = false;
+    std::vector<Vector> wrapOffsets; // traslaciones de las 6 imágenes del cluster
+    double coverageAreaM2 = 0.0;
     
-    // Ajustar ISD según el escenario
-    double effectiveISD = (scenario == DENSE_URBAN) ? ISD * 0.7 : ISD * 1.3;
+    uint32_t GetN() const { return cells.size(); }
     
-    switch (numCells) {
-        case 1:
-            positions->Add(Vector(0.0, 0.0, baseHeight));
-            break;
-            
-        case 3: {
-            // Triángulo equilátero optimizado
-            double r = effectiveISD * 0.577; // radio del circuncentro
-            positions->Add(Vector(0.0, r, baseHeight));
-            positions->Add(Vector(-r * 0.866, -r * 0.5, baseHeight));
-            positions->Add(Vector(r * 0.866, -r * 0.5, baseHeight));
-            break;
-        }
-        
-        case 5: {
-            // Centro + cruz optimizada
-            positions->Add(Vector(0.0, 0.0, baseHeight));
-            double offset = effectiveISD * 0.7;
-            positions->Add(Vector(offset, 0.0, baseHeight));
-            positions->Add(Vector(-offset, 0.0, baseHeight));
-            positions->Add(Vector(0.0, offset, baseHeight));
-            positions->Add(Vector(0.0, -offset, baseHeight));
-            break;
-        }
-        
-        case 7: {
-            // Hexágono con centro
-            positions->Add(Vector(0.0, 0.0, baseHeight));
-            double r = effectiveISD * 0.6;
-            for (int i = 0; i < 6; i++) {
-                double angle = i * M_PI / 3.0;
-                positions->Add(Vector(r * cos(angle), r * sin(angle), baseHeight));
+    // Distancia a la celda considerando las imágenes de wrap-around; devuelve
+    // también la posición (imagen) de la celda más cercana al UE
+    double Distance(const Vector& uePos, uint32_t cell, Vector* image = nullptr) const
+    {
+        Vector best = cells[cell].position;
+        double bestDistance = CalculateDistance(uePos, best);
+        if (wrapAround) {
+            for (const Vector& offset : wrapOffsets) {
+                Vector candidate = cells[cell].position + offset;
+                double d = CalculateDistance(uePos, candidate);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = candidate;
+                }
             }
-            break;
         }
+        if (image != nullptr) *image = best;
+        return bestDistance;
+    }
+    
+    // Diferencia angular (grados, 0-180) entre el apuntamiento del sector y el UE
+    double SectorOffsetDeg(const Vector& uePos, uint32_t cell, const Vector& image) const
+    {
+        double bearing = std::atan2(uePos.y - image.y, uePos.x - image.x) * 180.0 / M_PI;
+        double diff = std::fmod(std::fabs(bearing - cells[cell].azimuthDeg), 360.0);
+        return (diff > 180.0) ? 360.0 - diff : diff;
+    }
+    
+    // Ganancia del elemento 3GPP (TR 38.901): 8 dBi y corte horizontal de 65
+    // grados; 0 dB sin sectores (antena isotrópica)
+    double ElementGainDb(const Vector& uePos, uint32_t cell, const Vector& image) const
+    {
+        if (!sectorized) return 0.0;
+        double offset = SectorOffsetDeg(uePos, cell, image);
+        return 8.0 - std::min(12.0 * std::pow(offset / 65.0, 2), 30.0);
+    }
+    
+    uint32_t CellsPerSite() const { return (numSites > 0) ? cells.size() / numSites : 1; }
+    
+    Ptr<ListPositionAllocator> CreatePositionAllocator() const
+    {
+        auto positions = CreateObject<ListPositionAllocator>();
+        for (const CellSite& cell : cells) {
+            positions->Add(cell.position);
+        }
+        return positions;
+    }
+};
+
+// Índice espacial en rejilla uniforme sobre las posiciones de las celdas,
+// incluidas sus imágenes de wrap-around. Se construye una vez tras instalar la
+// movilidad de los gNB y resuelve celda más cercana y K vecinas por anillos de
+// casillas, sin recorrer todas las celdas.
+class CellSpatialIndex {
+public:
+    struct Neighbour {
+        double distance;
+        uint32_t cell;
+        Vector image; // posición (o imagen) de la celda más cercana al UE
+    };
+    
+    void Build(const CellLayout& layout)
+    {
+        m_layout = &layout;
+        std::vector<Point> points;
+        for (uint32_t c = 0; c < layout.GetN(); ++c) {
+            points.push_back({layout.cells[c].position, c});
+            if (layout.wrapAround) {
+                for (const Vector& offset : layout.wrapOffsets) {
+                    points.push_back({layout.cells[c].position + offset, c});
+                }
+            }
+        }
+        
+        double minX = std::numeric_limits<double>::max(), maxX = std::numeric_limits<double>::lowest();
+        double minY = minX, maxY = maxX;
+        for (const Point& p : points) {
+            minX = std::min(minX, p.pos.x);
+            maxX = std::max(maxX, p.pos.x);
+            minY = std::min(minY, p.pos.y);
+            maxY = std::max(maxY, p.pos.y);
+        }
+        
+        // Casillas de tamaño tal que haya del orden de un sitio por casilla
+        uint32_t sites = std::max<uint32_t>(1, points.size() / layout.CellsPerSite());
+        double extent = std::max({maxX - minX, maxY - minY, 1.0});
+        m_binSize = std::max(1.0, extent / std::ceil(std::sqrt(static_cast<double>(sites))));
+        m_minX = minX;
+        m_minY = minY;
+        m_nx = static_cast<int>((maxX - minX) / m_binSize) + 1;
+        m_ny = static_cast<int>((maxY - minY) / m_binSize) + 1;
+        
+        // Almacenamiento CSR: puntos ordenados por casilla
+        m_binStart.assign(m_nx * m_ny + 1, 0);
+        for (const Point& p : points) {
+            m_binStart[BinOf(p.pos) + 1]++;
+        }
+        for (std::size_t b = 1; b < m_binStart.size(); ++b) {
+            m_binStart[b] += m_binStart[b - 1];
+        }
+        m_points.resize(points.size());
+        std::vector<uint32_t> fill(m_binStart.begin(), m_binStart.end() - 1);
+        for (const Point& p : points) {
+            m_points[fill[BinOf(p.pos)]++] = p;
+        }
+    }
+    
+    // Las k celdas distintas más cercanas, ordenadas por distancia
+    std::vector<Neighbour> KNearest(const Vector& pos, uint32_t k) const
+    {
+        k = std::min<uint32_t>(k, m_layout->GetN());
+        std::vector<Neighbour> best; // una entrada por celda (la imagen más cercana)
+        
+        int cx = std::clamp(static_cast<int>((pos.x - m_minX) / m_binSize), 0, m_nx - 1);
+        int cy = std::clamp(static_cast<int>((pos.y - m_minY) / m_binSize), 0, m_ny - 1);
+        int maxRing = std::max({cx, m_nx - 1 - cx, cy, m_ny - 1 - cy});
+        
+        for (int ring = 0; ring <= maxRing; ++ring) {
+            for (int by = cy - ring; by <= cy + ring; ++by) {
+                if (by < 0 || by >= m_ny) continue;
+                bool edgeRow = (by == cy - ring || by == cy + ring);
+                int step = edgeRow ? 1 : 2 * ring;
+                for (int bx = cx - ring; bx <= cx + ring; bx += std::max(step, 1)) {
+                    if (bx < 0 || bx >= m_nx) continue;
+                    uint32_t bin = by * m_nx + bx;
+                    for (uint32_t p = m_binStart[bin]; p < m_binStart[bin + 1]; ++p) {
+                        Offer(best, pos, m_points[p]);
+                    }
+                }
+            }
+            // Todo punto de anillos posteriores está al menos a ring * binSize
+            // (fuera de la casilla del UE): si ya hay k candidatas más cerca, basta
+            if (best.size() >= k) {
+                std::sort(best.begin(), best.end(),
+                          [](const Neighbour& a, const Neighbour& b) { return a.distance < b.distance; });
+                if (best[k - 1].distance <= ring * m_binSize) break;
+            }
+        }
+        
+        std::sort(best.begin(), best.end(),
+                  [](const Neighbour& a, const Neighbour& b) { return a.distance < b.distance; });
+        if (best.size() > k) best.resize(k);
+        return best;
+    }
+    
+    // Celda más cercana; entre sectores del mismo sitio, el mejor orientado
+    uint32_t Nearest(const Vector& pos, double& distance) const
+    {
+        std::vector<Neighbour> candidates = KNearest(pos, m_layout->CellsPerSite());
+        uint32_t bestCell = candidates[0].cell;
+        distance = candidates[0].distance;
+        if (m_layout->sectorized) {
+            double bestOffset = std::numeric_limits<double>::max();
+            for (const Neighbour& n : candidates) {
+                if (n.distance > distance + 1e-9) continue;
+                double offset = m_layout->SectorOffsetDeg(pos, n.cell, n.image);
+                if (offset < bestOffset) {
+                    bestOffset = offset;
+                    bestCell = n.cell;
+                }
+            }
+        }
+        return bestCell;
+    }
+    
+private:
+    struct Point {
+        Vector pos;
+        uint32_t cell;
+    };
+    
+    uint32_t BinOf(const Vector& p) const
+    {
+        int bx = std::clamp(static_cast<int>((p.x - m_minX) / m_binSize), 0, m_nx - 1);
+        int by = std::clamp(static_cast<int>((p.y - m_minY) / m_binSize), 0, m_ny - 1);
+        return by * m_nx + bx;
+    }
+    
+    static void Offer(std::vector<Neighbour>& best, const Vector& pos, const Point& point)
+    {
+        double d = CalculateDistance(pos, point.pos);
+        for (Neighbour& n : best) {
+            if (n.cell == point.cell) {
+                if (d < n.distance) {
+                    n.distance = d;
+                    n.image = point.pos;
+                }
+                return;
+            }
+        }
+        best.push_back({d, point.cell, point.pos});
+    }
+    
+    const CellLayout* m_layout = nullptr;
+    std::vector<Point> m_points;
+    std::vector<uint32_t> m_binStart;
+    double m_minX = 0.0;
+    double m_minY = 0.0;
+    double m_binSize = 1.0;
+    int m_nx = 1;
+    int m_ny = 1;
+};
+
+static CellLayout
+CreateOptimizedCellLayout(uint32_t numCells, double ISD, double baseHeight, ScenarioType scenario)
+{
+    std::vector<Vector> positions;
+    
+    // Ajustar ISD según el escenario
+    double effectiveISD = (scenario == DENSE_URBAN) ? ISD * 0.7 : ISD * 1.3;
+    
+    switch (numCells) {
+        case 1:
+            positions.push_back(Vector(0.0, 0.0, baseHeight));
+            break;
+            
+        case 3: {
+            // Triángulo equilátero optimizado
+            double r = effectiveISD * 0.577; // radio del circuncentro
+            positions.push_back(Vector(0.0, r, baseHeight));
+            positions.push_back(Vector(-r * 0.866, -r * 0.5, baseHeight));
+            positions.push_back(Vector(r * 0.866, -r * 0.5, baseHeight));
+            break;
+        }
+        
+        case 5: {
+            // Centro + cruz optimizada
+            positions.push_back(Vector(0.0, 0.0, baseHeight));
+            double offset = effectiveISD * 0.7;
+            positions.push_back(Vector(offset, 0.0, baseHeight));
+            positions.push_back(Vector(-offset, 0.0, baseHeight));
+            positions.push_back(Vector(0.0, offset, baseHeight));
+            positions.push_back(Vector(0.0, -offset, baseHeight));
+            break;
+        }
+        
+        case 7: {
+            // Hexágono con centro
+            positions.push_back(Vector(0.0, 0.0, baseHeight));
+            double r = effectiveISD * 0.6;
+            for (int i = 0; i < 6; i++) {
+                double angle = i * M_PI / 3.0;
+                positions.push_back(Vector(r * cos(angle), r * sin(angle), baseHeight));
+            }
+            break;
+        }
+        
+        case 9:
+        default: {
+            // Centro + 8 direcciones
+            positions.push_back(Vector(0.0, 0.0, baseHeight));
+            double r = effectiveISD * 0.65;
+            for (int i = 0; i < 8; i++) {
+                double angle = i * M_PI / 4.0;
+                positions.push_back(Vector(r * cos(angle), r * sin(angle), baseHeight));
+            }
+            break;
+        }
+    }
+    
+    // Una celda por gNB; como ListPositionAllocator, se recicla la lista si faltan posiciones
+    CellLayout layout;
+    for (uint32_t i = 0; i < numCells; ++i) {
+        CellSite cell;
+        cell.position = positions[i % positions.size()];
+        cell.siteId = i;
+        layout.cells.push_back(cell);
+    }
+    layout.numSites = layout.cells.size();
+    layout.coverageAreaM2 = M_PI * std::pow(ISD * 1.2, 2) * numCells; // Aproximación
+    return layout;
+}
+
+// Malla hexagonal de N anillos (1, 7, 19, 37, ... sitios) con 1 o 3 sectores por
+// sitio. Los sectores apuntan a 30/150/270 grados (3GPP TR 38.901). Con
+// wrap-around, el cluster se replica en sus 6 vecinos para medir distancias.
+static CellLayout
+CreateHexGridLayout(uint32_t tiers, double ISD, double baseHeight, uint32_t sectors, bool wrapAround)
+{
+    NS_ABORT_MSG_IF(sectors != 1 && sectors != 3, "sectors debe ser 1 o 3");
+    
+    // Coordenadas axiales (q, r) de todos los sitios, ordenadas por anillo y ángulo
+    struct HexSite { int q; int r; int ring; double angle; };
+    std::vector<HexSite> sites;
+    int t = static_cast<int>(tiers);
+    for (int q = -t; q <= t; ++q) {
+        for (int r = std::max(-t, -q - t); r <= std::min(t, -q + t); ++r) {
+            int ring = std::max({std::abs(q), std::abs(r), std::abs(q + r)});
+            double x = q + r * 0.5;
+            double y = r * std::sqrt(3.0) / 2.0;
+            double angle = std::atan2(y, x);
+            if (angle < 0) angle += 2 * M_PI;
+            sites.push_back({q, r, ring, angle});
+        }
+    }
+    std::sort(sites.begin(), sites.end(), [](const HexSite& a, const HexSite& b) {
+        return (a.ring != b.ring) ? a.ring < b.ring : a.angle < b.angle - 1e-9;
+    });
+    
+    CellLayout layout;
+    layout.numSites = sites.size();
+    layout.sectorized = (sectors == 3);
+    layout.wrapAround = wrapAround && tiers > 0;
+    layout.coverageAreaM2 = layout.numSites * std::sqrt(3.0) / 2.0 * ISD * ISD;
+    
+    static const double sectorAzimuths[3] = {30.0, 150.0, 270.0};
+    for (uint32_t s = 0; s < sites.size(); ++s) {
+        Vector pos(ISD * (sites[s].q + sites[s].r * 0.5),
+                   ISD * sites[s].r * std::sqrt(3.0) / 2.0, baseHeight);
+        for (uint32_t k = 0; k < sectors; ++k) {
+            CellSite cell;
+            cell.position = pos;
+            cell.azimuthDeg = (sectors == 3) ? sectorAzimuths[k] : 0.0;
+            cell.siteId = s;
+            layout.cells.push_back(cell);
+        }
+    }
+    
+    // El cluster de N = 3T(T+1)+1 sitios tesela el plano con traslaciones
+    // (2T+1, -T) en coordenadas axiales, rotadas de 60 en 60 grados
+    if (layout.wrapAround) {
+        double bx = ISD * ((2 * t + 1) - t * 0.5);
+        double by = ISD * (-t) * std::sqrt(3.0) / 2.0;
+        for (int k = 0; k < 6; ++k) {
+            double a = k * M_PI / 3.0;
+            layout.wrapOffsets.push_back(Vector(bx * std::cos(a) - by * std::sin(a),
+                                                bx * std::sin(a) + by * std::cos(a), 0.0));
+        }
+    }
+    
+    return layout;
+}
+
+
+static void
+DistributeUsersOptimized(NodeContainer ueNodes, const CellLayout& layout, 
+                        ScenarioType scenario, double ISD, double userHeight)
+{
+    Ptr<UniformRandomVariable> uniformRv = CreateObject<UniformRandomVariable>();
+    Ptr<ExponentialRandomVariable> expRv = CreateObject<ExponentialRandomVariable>();
+    
+    uint32_t numUEs = ueNodes.GetN();
+    uint32_t numCells = layout.GetN();
+    
+    // Distribución por celda con variabilidad realista
+    std::vector<uint32_t> uesPerCell(numCells);
+    uint32_t baseUesPerCell = numUEs / numCells;
+    uint32_t remainder = numUEs % numCells;
+    
+    for (uint32_t i = 0; i < numCells; i++) {
+        uesPerCell[i] = baseUesPerCell + (i < remainder ? 1 : 0);
+        
+        // Variabilidad según escenario
+        if (scenario == DENSE_URBAN) {
+            // Más concentración en algunas celdas
+            if (i == 0 || i == numCells/2) {
+                uesPerCell[i] *= 1.5;
+            }
+        }
+    }
+    
+    uint32_t ueIndex = 0;
+    for (uint32_t cellId = 0; cellId < numCells && ueIndex < numUEs; cellId++) {
+        Vector cellPos = layout.cells[cellId].position;
+        
+        // Radio de cobertura según escenario
+        double maxRadius = (scenario == DENSE_URBAN) ? ISD * 0.4 : ISD * 0.8;
+        double minRadius = (scenario == DENSE_URBAN) ? 10.0 : 50.0;
+        
+        for (uint32_t j = 0; j < uesPerCell[cellId] && ueIndex < numUEs; j++) {
+            double radius, angle;
+            
+            if (scenario == DENSE_URBAN) {
+                // Distribución más concentrada cerca del centro
+                radius = minRadius + expRv->GetValue() * (maxRadius - minRadius) * 0.3;
+                radius = std::min(radius, maxRadius);
+            } else {
+                // Distribución más uniforme
+                radius = uniformRv->GetValue(minRadius, maxRadius);
+            }
+            
+            if (layout.sectorized) {
+                // Dentro del sector: ±60 grados alrededor de su orientación
+                double azimuth = layout.cells[cellId].azimuthDeg * M_PI / 180.0;
+                angle = uniformRv->GetValue(azimuth - M_PI / 3.0, azimuth + M_PI / 3.0);
+            } else {
+                angle = uniformRv->GetValue(0.0, 2 * M_PI);
+            }
+            
+            double x = cellPos.x + radius * cos(angle);
+            double y = cellPos.y + radius * sin(angle);
+            
+            ueNodes.Get(ueIndex)->GetObject<MobilityModel>()->SetPosition(
+                Vector(x, y, userHeight));
+            
+            ueIndex++;
+        }
+    }
+    
+    // Distribuir UEs restantes aleatoriamente
+    double areaSize = ISD * 1.5;
+    for (; ueIndex < numUEs; ueIndex++) {
+        double x = uniformRv->GetValue(-areaSize, areaSize);
+        double y = uniformRv->GetValue(-areaSize, areaSize);
+        ueNodes.Get(ueIndex)->GetObject<MobilityModel>()->SetPosition(
+            Vector(x, y, userHeight));
+    }
+}
+
+// ==================== Movilidad de UEs =====================================
+// Movilidad por tramos rectilíneos sobre ConstantVelocityMobilityModel: ns-3
+// extrapola la posición a partir de la velocidad, de modo que un único evento
+// por tick (para todos los UEs) basta para cambiar de tramo al llegar a cada
+// destino y actualizar la celda más cercana, las vecinas y la distancia a la
+// celda servidora. La celda servidora solo la cambian los handovers reales
+// (ServingCellTracker). El estado va en arreglos contiguos; el modelo de ns-3
+// solo se toca al cambiar de tramo.
+//
+//   rwp    : random waypoint dentro del área del layout, velocidad constante
+//   linear : rumbo aleatorio fijo, con rebote en los bordes del área
+//   trace  : tramos entre muestras "tiempo ueIndex x y" de un archivo
+//
+// Celda más cercana y vecinas se actualizan de forma incremental: cada UE
+// guarda las K + sectores - 1 celdas candidatas de su última consulta al
+// índice y la holgura (d[K+sectores] - d[K]) / 2. Mientras no se aleje del
+// punto de esa consulta más que la holgura, las K vecinas reales están entre
+// las candidatas (desigualdad triangular) y basta recalcular K + sectores - 1
+// distancias.
+class UeMobilityDriver {
+public:
+    enum Kind {
+        STATIC = 0,
+        RANDOM_WAYPOINT,
+        LINEAR,
+        TRACE
+    };
+    
+    static bool ParseKind(const std::string& name, Kind& kind)
+    {
+        if (name == "static") kind = STATIC;
+        else if (name == "rwp") kind = RANDOM_WAYPOINT;
+        else if (name == "linear") kind = LINEAR;
+        else if (name == "trace") kind = TRACE;
+        else return false;
+        return true;
+    }
+    
+    // Fija el primer tramo de cada UE (antes de calcular la asociación inicial);
+    // con trace, los UEs presentes en el archivo toman su primera muestra
+    void Setup(Kind kind, NodeContainer ueNodes, const CellLayout& layout,
+               const CellSpatialIndex& index, double speed, double tick,
+               double margin, const std::string& traceFile)
+    {
+        m_kind = kind;
+        m_layout = &layout;
+        m_index = &index;
+        m_speed = speed;
+        m_tick = tick;
+        m_rng = CreateObject<UniformRandomVariable>();
+        
+        m_minX = m_minY = std::numeric_limits<double>::max();
+        m_maxX = m_maxY = std::numeric_limits<double>::lowest();
+        for (const CellSite& cell : layout.cells) {
+            m_minX = std::min(m_minX, cell.position.x - margin);
+            m_maxX = std::max(m_maxX, cell.position.x + margin);
+            m_minY = std::min(m_minY, cell.position.y - margin);
+            m_maxY = std::max(m_maxY, cell.position.y + margin);
+        }
+        
+        uint32_t numUes = ueNodes.GetN();
+        m_models.resize(numUes);
+        m_x.resize(numUes);
+        m_y.resize(numUes);
+        m_z.resize(numUes);
+        m_vx.assign(numUes, 0.0);
+        m_vy.assign(numUes, 0.0);
+        m_t0.assign(numUes, 0.0);
+        m_tEnd.assign(numUes, std::numeric_limits<double>::infinity());
+        m_cursor.assign(numUes, 0);
+        for (uint32_t i = 0; i < numUes; ++i) {
+            m_models[i] = ueNodes.Get(i)->GetObject<ConstantVelocityMobilityModel>();
+            NS_ABORT_MSG_IF(!m_models[i], "La movilidad de UEs requiere ConstantVelocityMobilityModel");
+            Vector pos = m_models[i]->GetPosition();
+            m_x[i] = pos.x;
+            m_y[i] = pos.y;
+            m_z[i] = pos.z;
+        }
+        
+        if (kind == TRACE) LoadTrace(traceFile, numUes);
+        for (uint32_t i = 0; i < numUes; ++i) {
+            if (kind == TRACE && !m_trace[i].empty()) {
+                m_x[i] = m_trace[i][0].x;
+                m_y[i] = m_trace[i][0].y;
+                m_models[i]->SetPosition(Vector(m_x[i], m_y[i], m_z[i]));
+            }
+            if (kind == LINEAR) {
+                double heading = m_rng->GetValue(0.0, 2 * M_PI);
+                m_vx[i] = m_speed * std::cos(heading);
+                m_vy[i] = m_speed * std::sin(heading);
+            }
+            NextSegment(i, 0.0);
+            m_models[i]->SetVelocity(Vector(m_vx[i], m_vy[i], 0.0));
+        }
+    }
+    
+    // Candidatas iniciales (la asociación ya está en g_ueMetrics) y primer tick
+    void Start()
+    {
+        uint32_t numUes = m_x.size();
+        m_candidateStride = std::max<uint32_t>(1, g_ueMetrics.neighbourK) + m_layout->CellsPerSite() - 1;
+        m_candidates.assign(numUes * m_candidateStride, 0);
+        m_ranked.resize(m_candidateStride);
+        m_nearest = g_ueMetrics.servingCell; // con movilidad la asociación inicial es la geométrica
+        m_numCandidates.assign(numUes, 0);
+        m_slack.assign(numUes, 0.0);
+        m_refX.assign(numUes, 0.0);
+        m_refY.assign(numUes, 0.0);
+        for (uint32_t i = 0; i < numUes; ++i) {
+            Refresh(i, Vector(m_x[i], m_y[i], m_z[i]));
+        }
+        Simulator::Schedule(Seconds(m_tick), &UeMobilityDriver::Tick, this);
+    }
+    
+    uint64_t GetTicks() const { return m_ticks; }
+    uint64_t GetIndexQueries() const { return m_indexQueries; }
+    uint64_t GetCellChanges() const { return m_cellChanges; }
+    
+private:
+    struct TracePoint {
+        double t, x, y;
+    };
+    
+    void LoadTrace(const std::string& file, uint32_t numUes)
+    {
+        std::ifstream in(file);
+        NS_ABORT_MSG_IF(!in, "No se pudo abrir la traza de movilidad " << file);
+        m_trace.assign(numUes, std::vector<TracePoint>());
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            TracePoint point;
+            uint32_t ue = 0;
+            if (!(fields >> point.t >> ue >> point.x >> point.y)) continue;
+            if (ue < numUes) m_trace[ue].push_back(point);
+        }
+        for (std::vector<TracePoint>& points : m_trace) {
+            std::sort(points.begin(), points.end(),
+                      [](const TracePoint& a, const TracePoint& b) { return a.t < b.t; });
+        }
+    }
+    
+    // Empieza un tramo en (m_x, m_y) en el instante now
+    void NextSegment(uint32_t i, double now)
+    {
+        m_t0[i] = now;
+        switch (m_kind) {
+        case STATIC:
+            break;
+        case RANDOM_WAYPOINT: {
+            double tx = m_rng->GetValue(m_minX, m_maxX);
+            double ty = m_rng->GetValue(m_minY, m_maxY);
+            double length = std::hypot(tx - m_x[i], ty - m_y[i]);
+            double duration = std::max(length / m_speed, 1e-6);
+            m_vx[i] = (tx - m_x[i]) / duration;
+            m_vy[i] = (ty - m_y[i]) / duration;
+            m_tEnd[i] = now + duration;
+            break;
+        }
+        case LINEAR: {
+            // Rebote especular en el borde que se alcanza antes
+            if ((m_x[i] <= m_minX && m_vx[i] < 0) || (m_x[i] >= m_maxX && m_vx[i] > 0)) m_vx[i] = -m_vx[i];
+            if ((m_y[i] <= m_minY && m_vy[i] < 0) || (m_y[i] >= m_maxY && m_vy[i] > 0)) m_vy[i] = -m_vy[i];
+            double tx = (m_vx[i] > 0) ? (m_maxX - m_x[i]) / m_vx[i] :
+                        (m_vx[i] < 0) ? (m_minX - m_x[i]) / m_vx[i] : std::numeric_limits<double>::infinity();
+            double ty = (m_vy[i] > 0) ? (m_maxY - m_y[i]) / m_vy[i] :
+                        (m_vy[i] < 0) ? (m_minY - m_y[i]) / m_vy[i] : std::numeric_limits<double>::infinity();
+            m_tEnd[i] = now + std::max(std::min(tx, ty), 1e-6);
+            break;
+        }
+        case TRACE: {
+            const std::vector<TracePoint>& points = m_trace[i];
+            uint32_t& k = m_cursor[i];
+            while (k + 1 < points.size() && points[k + 1].t <= now) ++k;
+            if (!points.empty() && now < points[k].t) {
+                // En reposo hasta la primera muestra
+                m_vx[i] = m_vy[i] = 0.0;
+                m_tEnd[i] = points[k].t;
+            } else if (k + 1 < points.size()) {
+                double duration = points[k + 1].t - now;
+                m_vx[i] = (points[k + 1].x - m_x[i]) / duration;
+                m_vy[i] = (points[k + 1].y - m_y[i]) / duration;
+                m_tEnd[i] = points[k + 1].t;
+            } else {
+                m_vx[i] = m_vy[i] = 0.0;
+                m_tEnd[i] = std::numeric_limits<double>::infinity();
+            }
+            break;
+        }
+        }
+    }
+    
+    // Fin del tramo: origen del siguiente en el destino alcanzado
+    void EndSegment(uint32_t i)
+    {
+        double t = m_tEnd[i];
+        m_x[i] += m_vx[i] * (t - m_t0[i]);
+        m_y[i] += m_vy[i] * (t - m_t0[i]);
+        NextSegment(i, t);
+    }
+    
+    void Tick()
+    {
+        double now = Simulator::Now().GetSeconds();
+        m_ticks++;
+        
+        for (uint32_t i = 0; i < m_x.size(); ++i) {
+            bool turned = false;
+            while (m_tEnd[i] <= now) {
+                EndSegment(i);
+                turned = true;
+            }
+            double elapsed = now - m_t0[i];
+            Vector pos(m_x[i] + m_vx[i] * elapsed, m_y[i] + m_vy[i] * elapsed, m_z[i]);
+            
+            // ns-3 sigue el tramo anterior hasta el tick; al corregirlo la
+            // posición salta como mucho lo recorrido en un tick
+            if (turned) {
+                m_models[i]->SetPosition(pos);
+                m_models[i]->SetVelocity(Vector(m_vx[i], m_vy[i], 0.0));
+            }
+            if (turned || m_vx[i] != 0.0 || m_vy[i] != 0.0) UpdateCells(i, pos);
+        }
+        Simulator::Schedule(Seconds(m_tick), &UeMobilityDriver::Tick, this);
+    }
+    
+    // Consulta completa al índice: candidatas y holgura
+    void Refresh(uint32_t i, const Vector& pos)
+    {
+        uint32_t k = std::max<uint32_t>(1, g_ueMetrics.neighbourK);
+        std::vector<CellSpatialIndex::Neighbour> found = m_index->KNearest(pos, m_candidateStride + 1);
+        uint32_t kept = std::min<uint32_t>(found.size(), m_candidateStride);
+        for (uint32_t c = 0; c < kept; ++c) {
+            m_candidates[i * m_candidateStride + c] = found[c].cell;
+        }
+        m_numCandidates[i] = kept;
+        m_slack[i] = (found.size() > m_candidateStride && k <= kept) ?
+                     0.5 * (found[m_candidateStride].distance - found[k - 1].distance) :
+                     std::numeric_limits<double>::infinity();
+        m_refX[i] = pos.x;
+        m_refY[i] = pos.y;
+        m_indexQueries++;
+    }
+    
+    void UpdateCells(uint32_t i, const Vector& pos)
+    {
+        if (std::hypot(pos.x - m_refX[i], pos.y - m_refY[i]) >= m_slack[i]) Refresh(i, pos);
+        
+        // Distancias a las candidatas (con wrap-around) y orden por cercanía
+        uint32_t n = m_numCandidates[i];
+        std::vector<std::pair<double, uint32_t>>& ranked = m_ranked;
+        double best = std::numeric_limits<double>::max();
+        for (uint32_t c = 0; c < n; ++c) {
+            uint32_t cell = m_candidates[i * m_candidateStride + c];
+            ranked[c] = {m_layout->Distance(pos, cell), cell};
+            best = std::min(best, ranked[c].first);
+        }
+        std::sort(ranked.begin(), ranked.begin() + n);
+        
+        // Celda más cercana; entre sectores del sitio, la mejor orientada
+        uint32_t nearest = ranked[0].second;
+        if (m_layout->sectorized) {
+            double bestOffset = std::numeric_limits<double>::max();
+            for (uint32_t c = 0; c < n && ranked[c].first <= best + 1e-9; ++c) {
+                Vector image;
+                m_layout->Distance(pos, ranked[c].second, &image);
+                double offset = m_layout->SectorOffsetDeg(pos, ranked[c].second, image);
+                if (offset < bestOffset) {
+                    bestOffset = offset;
+                    nearest = ranked[c].second;
+                }
+            }
+        }
+        if (nearest != m_nearest[i]) {
+            m_nearest[i] = nearest;
+            m_cellChanges++;
+        }
+        
+        // La celda servidora solo cambia por handover (ServingCellTracker); aquí
+        // se actualiza su distancia
+        uint32_t serving = g_ueMetrics.servingCell[i];
+        double servingDistance = -1.0;
+        for (uint32_t c = 0; c < n && servingDistance < 0; ++c) {
+            if (ranked[c].second == serving) servingDistance = ranked[c].first;
+        }
+        g_ueMetrics.distance[i] = (servingDistance < 0) ? m_layout->Distance(pos, serving) : servingDistance;
+        uint32_t k = g_ueMetrics.neighbourK;
+        for (uint32_t c = 0; c < k && c < n; ++c) {
+            g_ueMetrics.neighbourCells[i * k + c] = ranked[c].second;
+            g_ueMetrics.neighbourDistance[i * k + c] = ranked[c].first;
+        }
+    }
+    
+    Kind m_kind = STATIC;
+    const CellLayout* m_layout = nullptr;
+    const CellSpatialIndex* m_index = nullptr;
+    double m_speed = 0.0;
+    double m_tick = 0.1;
+    double m_minX = 0.0, m_maxX = 0.0, m_minY = 0.0, m_maxY = 0.0;
+    Ptr<UniformRandomVariable> m_rng;
+    std::vector<Ptr<ConstantVelocityMobilityModel>> m_models;
+    
+    // Tramo actual de cada UE: origen, velocidad, inicio y fin
+    std::vector<double> m_x, m_y, m_z;
+    std::vector<double> m_vx, m_vy;
+    std::vector<double> m_t0, m_tEnd;
+    std::vector<uint32_t> m_cursor; // muestra actual en la traza
+    std::vector<std::vector<TracePoint>> m_trace;
+    
+    // Asociación incremental
+    uint32_t m_candidateStride = 1;
+    std::vector<uint32_t> m_candidates;
+    std::vector<uint32_t> m_numCandidates;
+    std::vector<uint32_t> m_nearest; // celda geométrica más cercana de cada UE
+    std::vector<std::pair<double, uint32_t>> m_ranked; // (distancia, celda), reutilizado por tick
+    std::vector<double> m_slack;
+    std::vector<double> m_refX, m_refY; // posición de la última consulta al índice
+    
+    uint64_t m_ticks = 0;
+    uint64_t m_indexQueries = 0;
+    uint64_t m_cellChanges = 0;
+};
+
+// ==================== Asociación por carga (RSRP + CIO) =====================
+// Con --association=rsrp-cio cada UE se asocia a la candidata (sus celdas más
+// cercanas) con mayor RSRP + CIO. El CIO (offset individual de celda) se ajusta
+// por iteraciones: las celdas cuya carga supera la media × (1 + tolerancia)
+// bajan cioStep dB, las que quedan por debajo de la media × (1 - tolerancia)
+// lo suben, siempre dentro de ±cioMax. La carga de una celda es la demanda
+// ofrecida (b/s) de sus UEs. El RSRP es la potencia recibida de banda ancha
+// del modelo de pérdidas del propio canal (mismo shadowing y condición LOS que
+// verá la simulación) más el patrón de elemento del sector; el paso a potencia
+// por RE es común a todas las celdas y no cambia la elección.
+class LoadAwareAssociation {
+public:
+    static constexpr uint32_t MAX_ITERATIONS = 64;
+    static constexpr uint32_t NO_CELL = std::numeric_limits<uint32_t>::max();
+    
+    void Setup(uint32_t numCells, uint32_t numUes, uint32_t candidatesPerUe,
+               double cioMax, double cioStep, double loadTolerance)
+    {
+        m_numCells = numCells;
+        m_k = candidatesPerUe;
+        m_cioMax = cioMax;
+        m_cioStep = cioStep;
+        m_tolerance = loadTolerance;
+        m_cells.assign(numUes * m_k, NO_CELL);
+        m_rsrp.assign(numUes * m_k, -std::numeric_limits<double>::infinity());
+        m_demand.assign(numUes, 0.0);
+        m_serving.assign(numUes, 0);
+        m_cio.assign(numCells, 0.0);
+        m_load.assign(numCells, 0.0);
+    }
+    
+    void SetCandidate(uint32_t ue, uint32_t k, uint32_t cell, double rsrpDbm)
+    {
+        m_cells[ue * m_k + k] = cell;
+        m_rsrp[ue * m_k + k] = rsrpDbm;
+    }
+    
+    void SetDemand(uint32_t ue, double demandBps) { m_demand[ue] = demandBps; }
+    
+    // Ajusta los CIO y deja la asociación final; devuelve las iteraciones usadas.
+    // Con pocos UEs por celda el reparto puede oscilar alrededor de la banda de
+    // tolerancia: se conservan los CIO que dieron la menor carga máxima.
+    uint32_t Solve()
+    {
+        std::fill(m_cio.begin(), m_cio.end(), 0.0);
+        std::vector<double> bestCio = m_cio;
+        double bestPeak = std::numeric_limits<double>::infinity();
+        uint32_t iterations = 0;
+        while (iterations < MAX_ITERATIONS) {
+            ++iterations;
+            Assign();
+            double mean = 0.0;
+            double peak = 0.0;
+            for (double load : m_load) {
+                mean += load;
+                peak = std::max(peak, load);
+            }
+            mean /= m_numCells;
+            if (peak < bestPeak) {
+                bestPeak = peak;
+                bestCio = m_cio;
+            }
+            
+            bool changed = false;
+            for (uint32_t c = 0; c < m_numCells; ++c) {
+                if (m_load[c] > mean * (1.0 + m_tolerance) && m_cio[c] > -m_cioMax) {
+                    m_cio[c] = std::max(-m_cioMax, m_cio[c] - m_cioStep);
+                    changed = true;
+                } else if (m_load[c] < mean * (1.0 - m_tolerance) && m_cio[c] < m_cioMax) {
+                    m_cio[c] = std::min(m_cioMax, m_cio[c] + m_cioStep);
+                    changed = true;
+                }
+            }
+            if (!changed) break;
+        }
+        m_cio = bestCio;
+        Assign();
+        return iterations;
+    }
+    
+    uint32_t GetServing(uint32_t ue) const { return m_serving[ue]; }
+    double GetCio(uint32_t cell) const { return m_cio[cell]; }
+    uint32_t GetCandidatesPerUe() const { return m_k; }
+    uint32_t GetCandidate(uint32_t ue, uint32_t k) const { return m_cells[ue * m_k + k]; }
+    double GetCandidateRsrp(uint32_t ue, uint32_t k) const { return m_rsrp[ue * m_k + k]; }
+    
+    // RSRP del UE hacia una celda; -inf si no es candidata
+    double GetRsrp(uint32_t ue, uint32_t cell) const
+    {
+        for (uint32_t k = 0; k < m_k; ++k) {
+            if (m_cells[ue * m_k + k] == cell) return m_rsrp[ue * m_k + k];
+        }
+        return -std::numeric_limits<double>::infinity();
+    }
+    
+private:
+    void Assign()
+    {
+        std::fill(m_load.begin(), m_load.end(), 0.0);
+        for (uint32_t ue = 0; ue < m_serving.size(); ++ue) {
+            double best = -std::numeric_limits<double>::infinity();
+            for (uint32_t k = 0; k < m_k; ++k) {
+                uint32_t cell = m_cells[ue * m_k + k];
+                if (cell == NO_CELL) continue;
+                double score = m_rsrp[ue * m_k + k] + m_cio[cell];
+                if (score > best) {
+                    best = score;
+                    m_serving[ue] = cell;
+                }
+            }
+            m_load[m_serving[ue]] += m_demand[ue];
+        }
+    }
+    
+    uint32_t m_numCells = 0;
+    uint32_t m_k = 0;
+    double m_cioMax = 6.0;
+    double m_cioStep = 1.0;
+    double m_tolerance = 0.2;
+    std::vector<uint32_t> m_cells; // candidatas, m_k por UE
+    std::vector<double> m_rsrp;    // dBm, mismo orden que m_cells
+    std::vector<double> m_demand;
+    std::vector<uint32_t> m_serving;
+    std::vector<double> m_cio;
+    std::vector<double> m_load;
+};
+
+// ==================== Celda servidora real ==================================
+// Tras cada handover completado (NrUeRrc::HandoverEndOk) la asociación
+// registrada en g_ueMetrics (cell_stats, series, distancia) pasa a la celda
+// destino. Solo hay handovers cuando hay X2: con rebalanceo y con movilidad.
+class ServingCellTracker {
+public:
+    void Setup(const CellLayout* layout, NodeContainer ueNodes, NetDeviceContainer gnbDevices)
+    {
+        m_layout = layout;
+        m_ueNodes = ueNodes;
+        m_cellIndex.clear();
+        for (uint32_t i = 0; i < gnbDevices.GetN(); ++i) {
+            m_cellIndex[gnbDevices.Get(i)->GetObject<NrGnbNetDevice>()->GetCellId()] = i;
+        }
+    }
+    
+    void HandoverEnd(uint64_t imsi, uint16_t cellId, uint16_t rnti)
+    {
+        uint32_t ue = g_ueMetrics.Index(imsi);
+        auto it = m_cellIndex.find(cellId);
+        if (ue == UeMetricsRegistry::INVALID_INDEX || it == m_cellIndex.end()) return;
+        uint32_t& current = g_ueMetrics.servingCell[ue];
+        if (current == it->second) return;
+        g_ueMetrics.cellUeCount[current]--;
+        g_ueMetrics.cellUeCount[it->second]++;
+        current = it->second;
+        Vector pos = m_ueNodes.Get(ue)->GetObject<MobilityModel>()->GetPosition();
+        g_ueMetrics.distance[ue] = m_layout->Distance(pos, current);
+    }
+    
+private:
+    const CellLayout* m_layout = nullptr;
+    NodeContainer m_ueNodes;
+    std::unordered_map<uint16_t, uint32_t> m_cellIndex; // CellId NR -> índice de gnbDevices
+};
+
+// Rebalanceo periódico por handover (--rebalanceInterval): cada periodo se
+// mide la utilización de PRB de cada celda desde el paso anterior
+// (MacCellCounters). Una celda por encima de rebalanceThreshold cede hasta
+// rebalanceMaxMoves UEs de borde hacia candidatas por debajo del umbral: los de
+// menor diferencia de RSRP, y nunca más de cioMax dB. El handover se pide a la
+// gNB origen (NrGnbRrc::SendHandoverRequest, por X2). Un UE movido no vuelve a
+// moverse hasta pasados dos periodos, para no provocar ping-pong.
+class LoadRebalancer {
+public:
+    void Setup(const LoadAwareAssociation* association, NetDeviceContainer ueDevices,
+               NetDeviceContainer gnbDevices, double interval, double threshold,
+               uint32_t maxMoves, double maxGapDb)
+    {
+        m_association = association;
+        m_ueDevices = ueDevices;
+        m_gnbDevices = gnbDevices;
+        m_interval = interval;
+        m_threshold = threshold;
+        m_maxMoves = maxMoves;
+        m_maxGapDb = maxGapDb;
+        m_cellIndex.clear();
+        for (uint32_t i = 0; i < gnbDevices.GetN(); ++i) {
+            m_cellIndex[gnbDevices.Get(i)->GetObject<NrGnbNetDevice>()->GetCellId()] = i;
+        }
+        m_lastMove.assign(ueDevices.GetN(), -std::numeric_limits<double>::infinity());
+    }
+    
+    // Primer paso un periodo después de startOffset (arranque del tráfico)
+    void StartAfter(double startOffset)
+    {
+        if (m_interval <= 0) return;
+        Simulator::Schedule(Seconds(startOffset), &LoadRebalancer::Reset, this);
+        Simulator::Schedule(Seconds(startOffset + m_interval), &LoadRebalancer::Step, this);
+    }
+    
+    uint64_t GetMoves() const { return m_moves; }
+    uint64_t GetSteps() const { return m_steps; }
+    
+private:
+    struct Move {
+        double gapDb;
+        uint32_t ue;
+        uint32_t source;
+        uint32_t target;
+        
+        bool operator<(const Move& other) const { return gapDb < other.gapDb; }
+    };
+    
+    void Reset() { m_prev = g_macCells; }
+    
+    void Step()
+    {
+        ++m_steps;
+        double now = Simulator::Now().GetSeconds();
+        uint32_t numCells = g_macCells.size();
+        std::vector<double> utilization(numCells);
+        for (uint32_t c = 0; c < numCells; ++c) {
+            utilization[c] = g_macCells[c].Since(m_prev[c]).PrbUtilization();
+        }
+        m_prev = g_macCells;
+        
+        std::vector<Move> moves;
+        for (uint32_t ue = 0; ue < m_ueDevices.GetN(); ++ue) {
+            if (now - m_lastMove[ue] < 2.0 * m_interval) continue;
+            Ptr<NrUeRrc> rrc = m_ueDevices.Get(ue)->GetObject<NrUeNetDevice>()->GetRrc();
+            if (rrc->GetState() != NrUeRrc::CONNECTED_NORMALLY) continue;
+            auto it = m_cellIndex.find(rrc->GetCellId());
+            if (it == m_cellIndex.end() || utilization[it->second] < m_threshold) continue;
+            uint32_t source = it->second;
+            double sourceRsrp = m_association->GetRsrp(ue, source);
+            
+            Move best{std::numeric_limits<double>::infinity(), ue, source, source};
+            for (uint32_t k = 0; k < m_association->GetCandidatesPerUe(); ++k) {
+                uint32_t cell = m_association->GetCandidate(ue, k);
+                if (cell == LoadAwareAssociation::NO_CELL || cell == source ||
+                    utilization[cell] >= m_threshold) continue;
+                double gap = sourceRsrp - m_association->GetCandidateRsrp(ue, k);
+                if (gap < best.gapDb) {
+                    best.gapDb = gap;
+                    best.target = cell;
+                }
+            }
+            if (best.target != source && best.gapDb <= m_maxGapDb) moves.push_back(best);
+        }
+        
+        std::sort(moves.begin(), moves.end());
+        std::vector<uint32_t> perCell(numCells, 0);
+        for (const Move& move : moves) {
+            if (perCell[move.source] >= m_maxMoves) continue;
+            perCell[move.source]++;
+            Ptr<NrUeRrc> ueRrc = m_ueDevices.Get(move.ue)->GetObject<NrUeNetDevice>()->GetRrc();
+            Ptr<NrGnbNetDevice> source = m_gnbDevices.Get(move.source)->GetObject<NrGnbNetDevice>();
+            Ptr<NrGnbNetDevice> target = m_gnbDevices.Get(move.target)->GetObject<NrGnbNetDevice>();
+            source->GetRrc()->SendHandoverRequest(ueRrc->GetRnti(), target->GetCellId());
+            m_lastMove[move.ue] = now;
+            ++m_moves;
+        }
+        
+        Simulator::Schedule(Seconds(m_interval), &LoadRebalancer::Step, this);
+    }
+    
+    const LoadAwareAssociation* m_association = nullptr;
+    NetDeviceContainer m_ueDevices;
+    NetDeviceContainer m_gnbDevices;
+    double m_interval = 0.0;
+    double m_threshold = 80.0;
+    uint32_t m_maxMoves = 2;
+    double m_maxGapDb = 6.0;
+    std::unordered_map<uint16_t, uint32_t> m_cellIndex; // CellId NR -> índice de gnbDevices
+    std::vector<MacCellCounters> m_prev;
+    std::vector<double> m_lastMove;
+    uint64_t m_moves = 0;
+    uint64_t m_steps = 0;
+};
+
+// ==================== Tráfico URLLC agregado ===============================
+// Cliente periódico con varios destinos en el remote host, en lugar de un
+// UdpClient por UE. Cada destino envía en su instante de arranque y después
+// cada Interval, igual que un UdpClient; los próximos envíos se guardan en un
+// montículo ordenado por instante y un único evento pendiente despacha los
+// que vencen y se reprograma al siguiente. Los paquetes son los de UdpClient:
+// SeqTsHeader con la secuencia propia de cada destino y la marca de tiempo,
+// seguido de relleno hasta PacketSize.
+class MultiDestinationUdpClient : public Application {
+public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::MultiDestinationUdpClient")
+                                .SetParent<Application>()
+                                .SetGroupName("Applications")
+                                .AddConstructor<MultiDestinationUdpClient>()
+                                .AddAttribute("Interval", "Periodo entre paquetes de cada destino",
+                                              TimeValue(MilliSeconds(1)),
+                                              MakeTimeAccessor(&MultiDestinationUdpClient::m_interval),
+                                              MakeTimeChecker())
+                                .AddAttribute("PacketSize", "Tamaño del paquete, SeqTsHeader incluido",
+                                              UintegerValue(100),
+                                              MakeUintegerAccessor(&MultiDestinationUdpClient::m_size),
+                                              MakeUintegerChecker<uint32_t>(12))
+                                .AddTraceSource("TxTo", "Paquete enviado (etiqueta del destino, paquete)",
+                                                MakeTraceSourceAccessor(&MultiDestinationUdpClient::m_txTrace),
+                                                "ns3::MultiDestinationUdpClient::TxToCallback");
+        return tid;
+    }
+    
+    // start es relativo al arranque de la aplicación; tag identifica el
+    // destino en la traza TxTo
+    void AddDestination(Ipv4Address address, uint16_t port, uint32_t tag, Time start)
+    {
+        Destination dest;
+        dest.address = InetSocketAddress(address, port);
+        dest.tag = tag;
+        dest.startNs = std::max<int64_t>(start.GetNanoSeconds(), 0);
+        m_destinations.push_back(dest);
+    }
+    
+    uint64_t GetSent() const { return m_sent; }
+    
+protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        m_destinations.clear();
+        m_pending.clear();
+        Application::DoDispose();
+    }
+    
+private:
+    struct Destination {
+        Address address;
+        uint32_t tag = 0;
+        int64_t startNs = 0;
+        uint32_t seq = 0;
+    };
+    
+    // (próximo envío en ns desde el arranque, destino); std::greater deja el
+    // más próximo en la cima del montículo
+    using PendingSend = std::pair<int64_t, uint32_t>;
+    
+    void StartApplication() override
+    {
+        m_socket = Socket::CreateSocket(GetNode(), UdpSocketFactory::GetTypeId());
+        m_socket->Bind();
+        m_baseNs = Simulator::Now().GetNanoSeconds();
+        
+        m_pending.clear();
+        m_pending.reserve(m_destinations.size());
+        for (uint32_t d = 0; d < m_destinations.size(); ++d) {
+            m_pending.emplace_back(m_destinations[d].startNs, d);
+        }
+        std::make_heap(m_pending.begin(), m_pending.end(), std::greater<PendingSend>());
+        ScheduleNext();
+    }
+    
+    void StopApplication() override
+    {
+        m_event.Cancel();
+        if (m_socket) m_socket->Close();
+    }
+    
+    void ScheduleNext()
+    {
+        if (m_pending.empty()) return;
+        int64_t delayNs = m_baseNs + m_pending.front().first - Simulator::Now().GetNanoSeconds();
+        m_event = Simulator::Schedule(NanoSeconds(std::max<int64_t>(delayNs, 0)),
+                                      &MultiDestinationUdpClient::Send, this);
+    }
+    
+    void Send()
+    {
+        int64_t nowNs = Simulator::Now().GetNanoSeconds() - m_baseNs;
+        int64_t interval = m_interval.GetNanoSeconds();
+        while (!m_pending.empty() && m_pending.front().first <= nowNs) {
+            std::pop_heap(m_pending.begin(), m_pending.end(), std::greater<PendingSend>());
+            PendingSend& next = m_pending.back();
+            Destination& dest = m_destinations[next.second];
+            SeqTsHeader seqTs;
+            seqTs.SetSeq(dest.seq);
+            Ptr<Packet> packet = Create<Packet>(m_size - seqTs.GetSerializedSize());
+            packet->AddHeader(seqTs);
+            if (m_socket->SendTo(packet, 0, dest.address) >= 0) {
+                dest.seq++;
+                m_sent++;
+                m_txTrace(dest.tag, packet);
+            }
+            next.first += interval;
+            std::push_heap(m_pending.begin(), m_pending.end(), std::greater<PendingSend>());
+        }
+        ScheduleNext();
+    }
+    
+    Time m_interval;
+    uint32_t m_size = 100;
+    Ptr<Socket> m_socket;
+    int64_t m_baseNs = 0;
+    std::vector<Destination> m_destinations;
+    std::vector<PendingSend> m_pending;
+    EventId m_event;
+    uint64_t m_sent = 0;
+    TracedCallback<uint32_t, Ptr<const Packet>> m_txTrace;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(MultiDestinationUdpClient);
+
+// ==================== Vídeo eMBB adaptativo ================================
+// Fuente de vídeo por segmentos con ABR por buffer (BBA-0, Huang et al. 2014).
+// La aplicación vive en el remote host y modela también el reproductor del UE:
+// la traza RxWithSeqTsSize del sink entrega cada paquete, que suma al buffer
+// los segundos de vídeo que transporta según la tasa de su segmento. El
+// reproductor informa del buffer cada FeedbackInterval y el informe llega a la
+// fuente tras FeedbackDelay. Antes de cada segmento la fuente elige la tasa de
+// la escalera con el último buffer informado y lo envía a PacingFactor veces
+// esa tasa; con el buffer en MaxBuffer espera al siguiente informe. Los
+// paquetes llevan SeqTsSizeHeader, como los de OnOffApplication.
+class AbrVideoSource : public Application {
+public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::AbrVideoSource")
+                                .SetParent<Application>()
+                                .SetGroupName("Applications")
+                                .AddConstructor<AbrVideoSource>()
+                                .AddAttribute("PacketSize", "Tamaño del paquete, SeqTsSizeHeader incluido",
+                                              UintegerValue(1400),
+                                              MakeUintegerAccessor(&AbrVideoSource::m_size),
+                                              MakeUintegerChecker<uint32_t>(20))
+                                .AddAttribute("SegmentDuration", "Duración de vídeo de cada segmento",
+                                              TimeValue(Seconds(1)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_segment),
+                                              MakeTimeChecker())
+                                .AddAttribute("Reservoir", "Buffer por debajo del cual se usa la tasa mínima",
+                                              TimeValue(Seconds(2)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_reservoir),
+                                              MakeTimeChecker())
+                                .AddAttribute("Cushion", "Tramo de buffer entre la tasa mínima y la máxima",
+                                              TimeValue(Seconds(6)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_cushion),
+                                              MakeTimeChecker())
+                                .AddAttribute("MaxBuffer", "Buffer a partir del cual la fuente deja de enviar",
+                                              TimeValue(Seconds(12)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_maxBuffer),
+                                              MakeTimeChecker())
+                                .AddAttribute("PacingFactor", "Tasa de envío respecto a la del segmento",
+                                              DoubleValue(1.5),
+                                              MakeDoubleAccessor(&AbrVideoSource::m_pacing),
+                                              MakeDoubleChecker<double>(1.0))
+                                .AddAttribute("FeedbackInterval", "Periodo de los informes de buffer",
+                                              TimeValue(MilliSeconds(100)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_feedbackInterval),
+                                              MakeTimeChecker())
+                                .AddAttribute("FeedbackDelay", "Retardo de los informes hasta la fuente",
+                                              TimeValue(MilliSeconds(10)),
+                                              MakeTimeAccessor(&AbrVideoSource::m_feedbackDelay),
+                                              MakeTimeChecker())
+                                .AddTraceSource("Tx", "Paquete enviado",
+                                                MakeTraceSourceAccessor(&AbrVideoSource::m_txTrace),
+                                                "ns3::Packet::TracedCallback");
+        return tid;
+    }
+    
+    // Tasas en Mb/s separadas por comas, estrictamente crecientes
+    static bool ParseLadder(const std::string& text, std::vector<double>& ladderBps)
+    {
+        ladderBps.clear();
+        std::istringstream in(text);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            char* end = nullptr;
+            double mbps = std::strtod(item.c_str(), &end);
+            if (end == item.c_str() || *end != '\0' || mbps <= 0) return false;
+            if (!ladderBps.empty() && mbps * 1e6 <= ladderBps.back()) return false;
+            ladderBps.push_back(mbps * 1e6);
+        }
+        return !ladderBps.empty();
+    }
+    
+    void SetRemote(Ipv4Address address, uint16_t port) { m_remote = InetSocketAddress(address, port); }
+    void SetLadder(const std::vector<double>& ladderBps) { m_ladder = ladderBps; }
+    
+    // Traza RxWithSeqTsSize del PacketSink del UE (lado del reproductor); el
+    // paquete llega sin la cabecera, cuyo tamaño es el del paquete enviado
+    void Receive(Ptr<const Packet> packet, const Address& from, const Address& to,
+                 const SeqTsSizeHeader& header)
+    {
+        auto it = std::upper_bound(m_segments.begin(), m_segments.end(), header.GetSeq(),
+                                   [](uint32_t seq, const Segment& s) { return seq < s.firstSeq; });
+        if (it == m_segments.begin()) return;
+        double rateBps = m_ladder[(it - 1)->rateIndex];
+        
+        double now = Simulator::Now().GetSeconds();
+        UpdatePlayback(now);
+        m_buffer += header.GetSize() * 8.0 / rateBps;
+        if (m_state != PLAYING && m_buffer >= m_segment.GetSeconds()) {
+            if (m_state == STARTUP) m_startupDelay = now - m_startTime;
+            if (m_state == STALLED) m_rebufferTime += now - m_stallStart;
+            m_state = PLAYING;
+        }
+    }
+    
+    struct PlayerStats {
+        uint32_t rebuffers = 0;
+        double rebufferTime = 0.0;  // s, sin contar el arranque
+        double startupDelay = 0.0;  // s hasta la primera reproducción
+        uint32_t switches = 0;
+        double meanBitrateMbps = 0.0;
+        uint32_t segments = 0;
+    };
+    
+    PlayerStats GetStats()
+    {
+        double now = Simulator::Now().GetSeconds();
+        UpdatePlayback(now);
+        PlayerStats stats;
+        stats.rebuffers = m_rebuffers;
+        stats.rebufferTime = m_rebufferTime + ((m_state == STALLED) ? now - m_stallStart : 0.0);
+        stats.startupDelay = (m_state == STARTUP) ? now - m_startTime : m_startupDelay;
+        stats.switches = m_switches;
+        stats.segments = m_segments.size();
+        if (!m_segments.empty()) {
+            double sum = 0.0;
+            for (const Segment& s : m_segments) sum += m_ladder[s.rateIndex];
+            stats.meanBitrateMbps = sum / m_segments.size() / 1e6;
+        }
+        return stats;
+    }
+    
+protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        Application::DoDispose();
+    }
+    
+private:
+    enum PlayerState { STARTUP, PLAYING, STALLED };
+    
+    struct Segment {
+        uint32_t firstSeq;
+        uint32_t rateIndex;
+    };
+    
+    void StartApplication() override
+    {
+        NS_ABORT_MSG_IF(m_ladder.empty(), "AbrVideoSource sin escalera de tasas");
+        m_socket = Socket::CreateSocket(GetNode(), UdpSocketFactory::GetTypeId());
+        m_socket->Bind();
+        m_socket->Connect(m_remote);
+        m_running = true;
+        m_startTime = Simulator::Now().GetSeconds();
+        m_lastUpdate = m_startTime;
+        m_reportEvent = Simulator::Schedule(m_feedbackInterval, &AbrVideoSource::Report, this);
+        StartSegment();
+    }
+    
+    void StopApplication() override
+    {
+        m_running = false;
+        m_sendEvent.Cancel();
+        m_reportEvent.Cancel();
+        if (m_socket) m_socket->Close();
+    }
+    
+    // BBA-0: la tasa solo cambia cuando f(buffer) cruza la tasa vecina
+    uint32_t ChooseRate() const
+    {
+        uint32_t top = m_ladder.size() - 1;
+        double reservoir = m_reservoir.GetSeconds();
+        double cushion = m_cushion.GetSeconds();
+        if (m_reportedBuffer <= reservoir) return 0;
+        if (m_reportedBuffer >= reservoir + cushion) return top;
+        double f = m_ladder[0] + (m_ladder[top] - m_ladder[0]) * (m_reportedBuffer - reservoir) / cushion;
+        uint32_t index = m_rateIndex;
+        if (index < top && f >= m_ladder[index + 1]) {
+            while (index < top && m_ladder[index + 1] < f) index++;
+        } else if (index > 0 && f <= m_ladder[index - 1]) {
+            while (index > 0 && m_ladder[index - 1] > f) index--;
+        }
+        return index;
+    }
+    
+    void StartSegment()
+    {
+        if (m_reportedBuffer >= m_maxBuffer.GetSeconds()) {
+            m_waiting = true;
+            return;
+        }
+        uint32_t index = ChooseRate();
+        if (!m_segments.empty() && index != m_rateIndex) m_switches++;
+        m_rateIndex = index;
+        m_segments.push_back({m_seq, index});
+        double bytes = m_ladder[index] * m_segment.GetSeconds() / 8.0;
+        m_remaining = static_cast<uint32_t>(std::ceil(bytes / m_size));
+        SendPacket();
+    }
+    
+    void SendPacket()
+    {
+        SeqTsSizeHeader header;
+        header.SetSeq(m_seq++);
+        header.SetSize(m_size);
+        Ptr<Packet> packet = Create<Packet>(m_size - header.GetSerializedSize());
+        packet->AddHeader(header);
+        if (m_socket->Send(packet) >= 0) m_txTrace(packet);
+        
+        Time gap = Seconds(m_size * 8.0 / (m_ladder[m_rateIndex] * m_pacing));
+        if (--m_remaining > 0) {
+            m_sendEvent = Simulator::Schedule(gap, &AbrVideoSource::SendPacket, this);
+        } else {
+            m_sendEvent = Simulator::Schedule(gap, &AbrVideoSource::StartSegment, this);
+        }
+    }
+    
+    void Report()
+    {
+        UpdatePlayback(Simulator::Now().GetSeconds());
+        Simulator::Schedule(m_feedbackDelay, &AbrVideoSource::Feedback, this, m_buffer);
+        m_reportEvent = Simulator::Schedule(m_feedbackInterval, &AbrVideoSource::Report, this);
+    }
+    
+    void Feedback(double buffer)
+    {
+        m_reportedBuffer = buffer;
+        if (m_running && m_waiting && m_reportedBuffer < m_maxBuffer.GetSeconds()) {
+            m_waiting = false;
+            StartSegment();
+        }
+    }
+    
+    // Consume el buffer en tiempo real; al vaciarse empieza un rebuffering
+    void UpdatePlayback(double now)
+    {
+        if (m_state == PLAYING) {
+            double elapsed = now - m_lastUpdate;
+            if (elapsed >= m_buffer) {
+                m_state = STALLED;
+                m_stallStart = m_lastUpdate + m_buffer;
+                m_rebuffers++;
+                m_buffer = 0.0;
+            } else {
+                m_buffer -= elapsed;
+            }
+        }
+        m_lastUpdate = now;
+    }
+    
+    uint32_t m_size = 1400;
+    Time m_segment;
+    Time m_reservoir;
+    Time m_cushion;
+    Time m_maxBuffer;
+    double m_pacing = 1.5;
+    Time m_feedbackInterval;
+    Time m_feedbackDelay;
+    Address m_remote;
+    std::vector<double> m_ladder; // b/s, creciente
+    
+    // Fuente
+    Ptr<Socket> m_socket;
+    EventId m_sendEvent;
+    EventId m_reportEvent;
+    uint32_t m_seq = 0;
+    uint32_t m_remaining = 0;
+    uint32_t m_rateIndex = 0;
+    uint32_t m_switches = 0;
+    bool m_running = false;
+    bool m_waiting = false;
+    double m_reportedBuffer = 0.0;
+    std::vector<Segment> m_segments; // ordenados por firstSeq
+    
+    // Reproductor
+    PlayerState m_state = STARTUP;
+    double m_buffer = 0.0; // s de vídeo
+    double m_lastUpdate = 0.0;
+    double m_startTime = 0.0;
+    double m_startupDelay = 0.0;
+    double m_stallStart = 0.0;
+    double m_rebufferTime = 0.0;
+    uint32_t m_rebuffers = 0;
+    TracedCallback<Ptr<const Packet>> m_txTrace;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(AbrVideoSource);
+
+// ==================== Snapshot de asociación inicial =======================
+// Estado de la réplica tras el attach (posiciones de los UEs, celda servidora,
+// vecinas y clase de bearer de cada UE). Con la misma topología y semilla es
+// idéntico en todos los puntos de un barrido, así que se guarda una vez y las
+// réplicas siguientes parten de él con RRC ideal y un warm-up corto.
+//
+// Formato de texto, una línea por UE con precisión completa (las posiciones se
+// restauran bit a bit):
+//   NRSNAP 1
+//   key <clave de topología>
+//   ues <N> neighbours <K>
+//   <x> <y> <z> <celda> <distancia> <clase> <vecina>:<distancia> ...
+struct AttachSnapshot {
+    static constexpr uint32_t VERSION = 1;
+    
+    std::string topologyKey;
+    std::vector<Vector> positions;
+    std::vector<uint32_t> servingCell;
+    std::vector<double> distance;
+    std::vector<uint8_t> trafficClass;
+    uint32_t neighbourK = 0;
+    std::vector<uint32_t> neighbourCells;
+    std::vector<double> neighbourDistance;
+    
+    bool Save(const std::string& file) const
+    {
+        std::ofstream out(file);
+        if (!out) return false;
+        out << std::setprecision(17);
+        out << "NRSNAP " << VERSION << "\n";
+        out << "key " << topologyKey << "\n";
+        out << "ues " << positions.size() << " neighbours " << neighbourK << "\n";
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            out << positions[i].x << " " << positions[i].y << " " << positions[i].z << " "
+                << servingCell[i] << " " << distance[i] << " " << unsigned(trafficClass[i]);
+            for (uint32_t k = 0; k < neighbourK; ++k) {
+                out << " " << neighbourCells[i * neighbourK + k] << ":"
+                    << neighbourDistance[i * neighbourK + k];
+            }
+            out << "\n";
+        }
+        return static_cast<bool>(out);
+    }
+    
+    bool Load(const std::string& file)
+    {
+        std::ifstream in(file);
+        std::string magic, tag;
+        uint32_t version = 0;
+        std::size_t numUes = 0;
+        if (!(in >> magic >> version) || magic != "NRSNAP" || version != VERSION) return false;
+        if (!(in >> tag) || tag != "key") return false;
+        in >> std::ws;
+        std::getline(in, topologyKey);
+        if (!(in >> tag >> numUes) || tag != "ues") return false;
+        if (!(in >> tag >> neighbourK) || tag != "neighbours") return false;
+        
+        positions.resize(numUes);
+        servingCell.resize(numUes);
+        distance.resize(numUes);
+        trafficClass.resize(numUes);
+        neighbourCells.resize(numUes * neighbourK);
+        neighbourDistance.resize(numUes * neighbourK);
+        for (std::size_t i = 0; i < numUes; ++i) {
+            unsigned cls = 0;
+            in >> positions[i].x >> positions[i].y >> positions[i].z
+               >> servingCell[i] >> distance[i] >> cls;
+            trafficClass[i] = static_cast<uint8_t>(cls);
+            for (uint32_t k = 0; k < neighbourK; ++k) {
+                char sep = 0;
+                in >> neighbourCells[i * neighbourK + k] >> sep
+                   >> neighbourDistance[i * neighbourK + k];
+                if (sep != ':') return false;
+            }
+        }
+        return static_cast<bool>(in);
+    }
+};
+
+// ==================== Caché de condición de canal ==========================
+// Condición LOS/NLOS y O2I de cada par de nodos, persistida en disco entre
+// réplicas con la misma topología, semilla y banda. Con nodos estáticos y
+// UpdatePeriod = 0 (valor por defecto) la condición 3GPP de un par no cambia
+// durante la réplica, así que se calcula una vez por layout y se reutiliza en
+// los barridos de scheduler, tráfico o handover. Solo se cachea la condición:
+// la pérdida por trayecto es una expresión cerrada de distancia y condición, y
+// el shadowing y los coeficientes de pequeña escala son estado interno de los
+// modelos 3GPP que ns-3 no permite inyectar.
+//
+// Formato NRCC v1 (little-endian): cabecera de 24 B (char magic[4] = "NRCC",
+// uint32 version = 1, uint64 clave, uint64 entradas) seguida de entradas de
+// 16 B ordenadas por par (uint64 par = idMenor << 32 | idMayor, uint8 los,
+// uint8 o2i, 6 B de relleno). El archivo se mapea en solo lectura y las
+// consultas son búsquedas binarias sobre el mapa.
+static uint64_t
+Fnv1a64(const std::string& text)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+class CachedChannelConditionModel : public ChannelConditionModel {
+public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::CachedChannelConditionModel")
+                                .SetParent<ChannelConditionModel>()
+                                .SetGroupName("Propagation")
+                                .AddConstructor<CachedChannelConditionModel>();
+        return tid;
+    }
+    
+    // Mapea el archivo si existe y su clave coincide; inner resuelve los fallos
+    void Open(const std::string& file, uint64_t key, Ptr<ChannelConditionModel> inner)
+    {
+        m_file = file;
+        m_key = key;
+        m_inner = inner;
+        
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= HEADER_SIZE) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                m_map = map;
+                m_mapSize = st.st_size;
+            }
+        }
+        close(fd);
+        if (m_map == nullptr) return;
+        
+        const char* base = static_cast<const char*>(m_map);
+        uint32_t version = 0;
+        uint64_t fileKey = 0, entries = 0;
+        std::memcpy(&version, base + 4, sizeof(version));
+        std::memcpy(&fileKey, base + 8, sizeof(fileKey));
+        std::memcpy(&entries, base + 16, sizeof(entries));
+        if (std::memcmp(base, "NRCC", 4) != 0 || version != VERSION || fileKey != key ||
+            m_mapSize < HEADER_SIZE + entries * sizeof(Entry)) {
+            NS_LOG_WARN("Caché de canal " << file << " no válida para esta topología; se regenera");
+            Unmap();
+            return;
+        }
+        m_entries = reinterpret_cast<const Entry*>(base + HEADER_SIZE);
+        m_numEntries = entries;
+    }
+    
+    Ptr<ChannelCondition> GetChannelCondition(Ptr<const MobilityModel> a,
+                                              Ptr<const MobilityModel> b) const override
+    {
+        uint64_t pair = PairKey(a, b);
+        auto it = m_conditions.find(pair);
+        if (it != m_conditions.end()) return it->second;
+        
+        Ptr<ChannelCondition> condition;
+        const Entry* last = m_entries + m_numEntries;
+        const Entry* entry = std::lower_bound(m_entries, last, pair,
+            [](const Entry& e, uint64_t p) { return e.pair < p; });
+        if (entry != last && entry->pair == pair) {
+            condition = Create<ChannelCondition>(
+                static_cast<ChannelCondition::LosConditionValue>(entry->los),
+                static_cast<ChannelCondition::O2iConditionValue>(entry->o2i));
+            m_hits++;
+        } else {
+            condition = m_inner->GetChannelCondition(a, b);
+            Entry added{};
+            added.pair = pair;
+            added.los = static_cast<uint8_t>(condition->GetLosCondition());
+            added.o2i = static_cast<uint8_t>(condition->GetO2iCondition());
+            m_newEntries.push_back(added);
+            m_misses++;
+        }
+        m_conditions[pair] = condition;
+        return condition;
+    }
+    
+    int64_t AssignStreams(int64_t stream) override
+    {
+        return m_inner->AssignStreams(stream);
+    }
+    
+    // Reescribe el archivo con las entradas nuevas: escritura a un temporal y
+    // rename, de modo que procesos concurrentes nunca leen un archivo a medias
+    bool Persist() const
+    {
+        if (m_newEntries.empty()) return true;
+        std::vector<Entry> merged(m_entries, m_entries + m_numEntries);
+        merged.insert(merged.end(), m_newEntries.begin(), m_newEntries.end());
+        std::sort(merged.begin(), merged.end(),
+                  [](const Entry& x, const Entry& y) { return x.pair < y.pair; });
+        
+        std::string tmpFile = m_file + ".tmp" + std::to_string(getpid());
+        std::ofstream out(tmpFile, std::ios::binary);
+        uint64_t entries = merged.size();
+        out.write("NRCC", 4);
+        out.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+        out.write(reinterpret_cast<const char*>(&m_key), sizeof(m_key));
+        out.write(reinterpret_cast<const char*>(&entries), sizeof(entries));
+        out.write(reinterpret_cast<const char*>(merged.data()), merged.size() * sizeof(Entry));
+        out.close();
+        if (!out) return false;
+        return std::rename(tmpFile.c_str(), m_file.c_str()) == 0;
+    }
+    
+    uint64_t GetHits() const { return m_hits; }
+    uint64_t GetMisses() const { return m_misses; }
+    
+protected:
+    void DoDispose() override
+    {
+        Unmap();
+        m_inner = nullptr;
+        m_conditions.clear();
+        ChannelConditionModel::DoDispose();
+    }
+    
+private:
+    struct Entry {
+        uint64_t pair;
+        uint8_t los;
+        uint8_t o2i;
+        uint8_t pad[6];
+    };
+    static_assert(sizeof(Entry) == 16, "Entrada NRCC de 16 bytes");
+    static constexpr uint32_t VERSION = 1;
+    static constexpr std::size_t HEADER_SIZE = 24;
+    
+    // La condición 3GPP es simétrica: el par se ordena por id de nodo
+    static uint64_t PairKey(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b)
+    {
+        uint64_t idA = a->GetObject<Node>()->GetId();
+        uint64_t idB = b->GetObject<Node>()->GetId();
+        return (std::min(idA, idB) << 32) | std::max(idA, idB);
+    }
+    
+    void Unmap()
+    {
+        if (m_map != nullptr) munmap(m_map, m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+        m_entries = nullptr;
+        m_numEntries = 0;
+    }
+    
+    std::string m_file;
+    uint64_t m_key = 0;
+    Ptr<ChannelConditionModel> m_inner;
+    void* m_map = nullptr;
+    std::size_t m_mapSize = 0;
+    const Entry* m_entries = nullptr;
+    uint64_t m_numEntries = 0;
+    mutable std::unordered_map<uint64_t, Ptr<ChannelCondition>> m_conditions; // resueltas en esta réplica
+    mutable std::vector<Entry> m_newEntries;                                  // fallos, a persistir
+    mutable uint64_t m_hits = 0;
+    mutable uint64_t m_misses = 0;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(CachedChannelConditionModel);
+
+// Sustituye el modelo de condición de la pérdida por trayecto y del canal 3GPP
+// de cada BWP por la caché (compartida: ambos deben ver la misma condición).
+// Devuelve nullptr si el canal no usa modelos 3GPP.
+static Ptr<CachedChannelConditionModel>
+InstallChannelConditionCache(const BandwidthPartInfoPtrVector& bwps, const std::string& file,
+                             uint64_t key)
+{
+    Ptr<CachedChannelConditionModel> cache;
+    for (const auto& bwp : bwps) {
+        Ptr<SpectrumChannel> channel = bwp.get()->m_channel;
+        Ptr<ThreeGppPropagationLossModel> pathloss =
+            DynamicCast<ThreeGppPropagationLossModel>(channel->GetPropagationLossModel());
+        Ptr<ThreeGppSpectrumPropagationLossModel> spectrumLoss =
+            DynamicCast<ThreeGppSpectrumPropagationLossModel>(
+                channel->GetPhasedArraySpectrumPropagationLossModel());
+        if (!pathloss || !spectrumLoss) continue;
+        
+        if (!cache) {
+            cache = CreateObject<CachedChannelConditionModel>();
+            cache->Open(file, key, pathloss->GetChannelConditionModel());
+        }
+        pathloss->SetChannelConditionModel(cache);
+        Ptr<ThreeGppChannelModel> channelModel =
+            DynamicCast<ThreeGppChannelModel>(spectrumLoss->GetChannelModel());
+        if (channelModel) channelModel->SetChannelConditionModel(cache);
+    }
+    return cache;
+}
+
+// ==================== Tablas de resultados (CSV / binario) =================
+// Las tablas flow/cell/system se acumulan en memoria y se escriben como CSV
+// (formato histórico) o en formato binario columnar "NRCB" mapeable en memoria,
+// con el mismo esquema que las cabeceras CSV.
+//
+// Formato NRCB v1 (little-endian, todos los bloques alineados a 8 bytes):
+//   cabecera (24 B) : char magic[4] = "NRCB", uint32 version = 1,
+//                     uint64 numRows, uint32 numColumns, uint32 reservado = 0
+//   columnas (64 B) : char name[48] (relleno con NUL), uint32 type,
+//                     uint32 width (bytes por valor), uint64 dataOffset
+//   datos           : numRows valores contiguos por columna a partir de dataOffset
+//                     type 0 = int64, 1 = float64, 2 = texto de ancho fijo (NUL)
+// Una columna numérica con celdas de texto (p. ej. ScenarioType en
+// system_stats) guarda NaN en esas filas y el texto en la columna "<name>Text".
+class StatsTable {
+public:
+    enum ColumnType : uint32_t {
+        COL_INT64 = 0,
+        COL_FLOAT64 = 1,
+        COL_TEXT = 2
+    };
+    
+    void AddColumn(const std::string& name, ColumnType type, int precision = 0, uint32_t width = 16)
+    {
+        m_columns.push_back({name, type, precision, (type == COL_TEXT) ? width : 8});
+    }
+    
+    StatsTable& Int(int64_t value)
+    {
+        Cell cell;
+        cell.kind = CELL_INT;
+        cell.i = value;
+        return Push(cell);
+    }
+    
+    // precision < 0: la de la columna
+    StatsTable& Real(double value, int precision = -1)
+    {
+        Cell cell;
+        cell.kind = CELL_REAL;
+        cell.d = value;
+        cell.precision = precision;
+        return Push(cell);
+    }
+    
+    StatsTable& Text(const std::string& value)
+    {
+        Cell cell;
+        cell.kind = CELL_TEXT;
+        cell.s = value;
+        return Push(cell);
+    }
+    
+    std::size_t GetNumRows() const
+    {
+        return m_columns.empty() ? 0 : m_cells.size() / m_columns.size();
+    }
+    
+    void WriteCsv(const std::string& file) const
+    {
+        std::ofstream out(file);
+        for (std::size_t c = 0; c < m_columns.size(); ++c) {
+            out << (c > 0 ? "," : "") << m_columns[c].name;
+        }
+        out << "\n";
+        for (std::size_t row = 0; row < GetNumRows(); ++row) {
+            for (std::size_t c = 0; c < m_columns.size(); ++c) {
+                const Cell& cell = m_cells[row * m_columns.size() + c];
+                if (c > 0) out << ",";
+                if (cell.kind == CELL_INT) {
+                    out << cell.i;
+                } else if (cell.kind == CELL_REAL) {
+                    int precision = (cell.precision >= 0) ? cell.precision : m_columns[c].precision;
+                    out << std::fixed << std::setprecision(precision) << cell.d;
+                } else {
+                    out << cell.s;
+                }
+            }
+            out << "\n";
+        }
+    }
+    
+    void WriteBinary(const std::string& file) const
+    {
+        // Columnas físicas: las declaradas más las compañeras de texto necesarias
+        struct Physical { std::string name; uint32_t type; uint32_t width; std::size_t source; bool text; };
+        std::vector<Physical> physical;
+        for (std::size_t c = 0; c < m_columns.size(); ++c) {
+            physical.push_back({m_columns[c].name, m_columns[c].type, m_columns[c].width, c, false});
+            if (m_columns[c].type != COL_TEXT && HasTextCells(c)) {
+                physical.push_back({m_columns[c].name + "Text", COL_TEXT, 16, c, true});
+            }
+        }
+        
+        uint64_t numRows = GetNumRows();
+        uint64_t offset = Align8(24 + 64 * physical.size());
+        std::vector<uint64_t> offsets;
+        for (const Physical& p : physical) {
+            offsets.push_back(offset);
+            offset = Align8(offset + numRows * p.width);
+        }
+        
+        std::vector<char> buffer(offset, 0);
+        std::memcpy(buffer.data(), "NRCB", 4);
+        PutU32(buffer, 4, 1);
+        PutU64(buffer, 8, numRows);
+        PutU32(buffer, 16, physical.size());
+        for (std::size_t p = 0; p < physical.size(); ++p) {
+            std::size_t desc = 24 + 64 * p;
+            std::memcpy(buffer.data() + desc, physical[p].name.c_str(),
+                        std::min<std::size_t>(physical[p].name.size(), 47));
+            PutU32(buffer, desc + 48, physical[p].type);
+            PutU32(buffer, desc + 52, physical[p].width);
+            PutU64(buffer, desc + 56, offsets[p]);
+            
+            for (uint64_t row = 0; row < numRows; ++row) {
+                const Cell& cell = m_cells[row * m_columns.size() + physical[p].source];
+                std::size_t pos = offsets[p] + row * physical[p].width;
+                if (physical[p].type == COL_TEXT) {
+                    const std::string text = physical[p].text ? (cell.kind == CELL_TEXT ? cell.s : "")
+                                                              : CellText(cell, physical[p].source);
+                    std::memcpy(buffer.data() + pos, text.c_str(),
+                                std::min<std::size_t>(text.size(), physical[p].width - 1));
+                } else if (physical[p].type == COL_INT64) {
+                    int64_t value = (cell.kind == CELL_INT) ? cell.i :
+                                    (cell.kind == CELL_REAL) ? static_cast<int64_t>(cell.d) : 0;
+                    std::memcpy(buffer.data() + pos, &value, 8);
+                } else {
+                    double value = (cell.kind == CELL_INT) ? static_cast<double>(cell.i) :
+                                   (cell.kind == CELL_REAL) ? cell.d :
+                                   std::numeric_limits<double>::quiet_NaN();
+                    std::memcpy(buffer.data() + pos, &value, 8);
+                }
+            }
+        }
+        
+        std::ofstream out(file, std::ios::binary);
+        out.write(buffer.data(), buffer.size());
+    }
+    
+    // basePath sin extensión; format = csv | binary | both
+    void Write(const std::string& basePath, const std::string& format) const
+    {
+        if (format == "csv" || format == "both") WriteCsv(basePath + ".csv");
+        if (format == "binary" || format == "both") WriteBinary(basePath + ".nrcb");
+    }
+    
+private:
+    enum CellKind : uint8_t {
+        CELL_INT,
+        CELL_REAL,
+        CELL_TEXT
+    };
+    
+    struct Column {
+        std::string name;
+        ColumnType type;
+        int precision;
+        uint32_t width;
+    };
+    
+    struct Cell {
+        CellKind kind = CELL_INT;
+        int precision = -1;
+        int64_t i = 0;
+        double d = 0.0;
+        std::string s;
+    };
+    
+    StatsTable& Push(const Cell& cell)
+    {
+        m_cells.push_back(cell);
+        return *this;
+    }
+    
+    bool HasTextCells(std::size_t column) const
+    {
+        for (std::size_t row = 0; row < GetNumRows(); ++row) {
+            if (m_cells[row * m_columns.size() + column].kind == CELL_TEXT) return true;
+        }
+        return false;
+    }
+    
+    std::string CellText(const Cell& cell, std::size_t column) const
+    {
+        if (cell.kind == CELL_TEXT) return cell.s;
+        std::ostringstream text;
+        if (cell.kind == CELL_INT) {
+            text << cell.i;
+        } else {
+            int precision = (cell.precision >= 0) ? cell.precision : m_columns[column].precision;
+            text << std::fixed << std::setprecision(precision) << cell.d;
+        }
+        return text.str();
+    }
+    
+    static uint64_t Align8(uint64_t value) { return (value + 7) & ~static_cast<uint64_t>(7); }
+    
+    static void PutU32(std::vector<char>& buffer, std::size_t pos, uint32_t value)
+    {
+        std::memcpy(buffer.data() + pos, &value, 4);
+    }
+    
+    static void PutU64(std::vector<char>& buffer, std::size_t pos, uint64_t value)
+    {
+        std::memcpy(buffer.data() + pos, &value, 8);
+    }
+    
+    std::vector<Column> m_columns;
+    std::vector<Cell> m_cells; // por filas
+};
+
+// ==================== Serie temporal de KPIs ===============================
+// Traducción perezosa FlowId -> UE para los flujos de bajada eMBB/URLLC
+class FlowResolver {
+public:
+    void Setup(Ptr<Ipv4FlowClassifier> classifier, uint16_t embbPort, uint16_t urllcPort)
+    {
+        m_classifier = classifier;
+        m_embbPort = embbPort;
+        m_urllcPort = urllcPort;
+    }
+    
+    // nullptr si el flujo no es de bajada hacia un UE registrado
+    const UeFlowKey* Resolve(uint32_t flowId)
+    {
+        if (flowId >= m_entries.size()) m_entries.resize(flowId + 1);
+        Entry& entry = m_entries[flowId];
+        if (!entry.resolved) {
+            entry.resolved = true;
+            Ipv4FlowClassifier::FiveTuple tuple = m_classifier->FindFlow(flowId);
+            if (tuple.destinationPort == m_embbPort || tuple.destinationPort == m_urllcPort) {
+                entry.key = g_ueMetrics.Lookup(tuple.destinationAddress);
+            }
+        }
+        return entry.key;
+    }
+    
+private:
+    struct Entry {
+        bool resolved = false;
+        const UeFlowKey* key = nullptr;
+    };
+    
+    Ptr<Ipv4FlowClassifier> m_classifier;
+    uint16_t m_embbPort = 0;
+    uint16_t m_urllcPort = 0;
+    std::vector<Entry> m_entries; // indexado por FlowId
+};
+
+// Contadores por flujo de bajada: de FlowMonitor si se instaló o, con monitor
+// nulo, de la contabilidad por aplicación (FlowId = índice del UE + 1).
+// visit(flowId, const UeFlowKey&, const FlowMonitor::FlowStats&)
+class FlowSource {
+public:
+    void Setup(Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier,
+               uint16_t embbPort, uint16_t urllcPort)
+    {
+        m_monitor = monitor;
+        if (m_monitor) m_resolver.Setup(classifier, embbPort, urllcPort);
+    }
+    
+    template <typename Visitor>
+    void ForEach(Visitor visit)
+    {
+        if (m_monitor) {
+            for (const auto& flowStat : m_monitor->GetFlowStats()) {
+                const UeFlowKey* key = m_resolver.Resolve(flowStat.first);
+                if (key != nullptr) visit(flowStat.first, *key, flowStat.second);
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < g_ueMetrics.appFlow.size(); ++i) {
+            const FlowMonitor::FlowStats& fs = g_ueMetrics.appFlow[i];
+            if (fs.txPackets == 0) continue; // FlowMonitor solo lista flujos con tráfico
+            UeFlowKey key{g_ueMetrics.imsi[i], i, g_ueMetrics.trafficClass[i]};
+            visit(i + 1, key, fs);
+        }
+    }
+    
+private:
+    Ptr<FlowMonitor> m_monitor;
+    FlowResolver m_resolver;
+};
+
+// Escritor con buffer de bloque fijo: la memoria no crece con simTime, las
+// filas se acumulan en el bloque y se vuelcan al archivo cuando se llena.
+class BlockWriter {
+public:
+    static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+    
+    ~BlockWriter() { Close(); }
+    
+    void Open(const std::string& file)
+    {
+        m_out.open(file, std::ios::binary);
+        m_block.resize(BLOCK_SIZE);
+        m_used = 0;
+    }
+    
+    bool IsOpen() const { return m_out.is_open(); }
+    
+    void Write(const char* data, std::size_t size)
+    {
+        if (m_used + size > m_block.size()) Flush();
+        if (size > m_block.size()) {
+            m_out.write(data, size);
+            return;
+        }
+        std::memcpy(m_block.data() + m_used, data, size);
+        m_used += size;
+    }
+    
+    void Flush()
+    {
+        if (m_used > 0) m_out.write(m_block.data(), m_used);
+        m_used = 0;
+    }
+    
+    void Close()
+    {
+        if (!m_out.is_open()) return;
+        Flush();
+        m_out.close();
+    }
+    
+private:
+    std::ofstream m_out;
+    std::vector<char> m_block;
+    std::size_t m_used = 0;
+};
+
+// Muestreo periódico de KPIs por UE y por celda a partir de los contadores
+// acumulados de FlowSource y ChannelMetrics: cada muestra usa la diferencia
+// con la anterior, así que el estado es O(UEs + flujos) independientemente
+// de la duración. Backlog = bytes enviados aún no recibidos (en cola, en vuelo
+// o perdidos) hacia el UE.
+class KpiSampler {
+public:
+    void Start(Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier,
+               uint16_t embbPort, uint16_t urllcPort, uint32_t numCells,
+               double interval, const std::string& file)
+    {
+        m_source.Setup(monitor, classifier, embbPort, urllcPort);
+        m_numCells = numCells;
+        m_interval = interval;
+        
+        uint32_t numUes = g_ueMetrics.imsi.size();
+        m_prevSinrSum.assign(numUes, 0.0);
+        m_prevSinrSamples.assign(numUes, 0);
+        m_ue.assign(numUes, Window());
+        m_cell.assign(numCells, Window());
+        
+        m_writer.Open(file);
+        const char header[] = "Time(s),Level,Id,ServingCell,Throughput(Mbps),AvgSinr(dB),"
+                              "MeanDelay(ms),Backlog(bytes)\n";
+        m_writer.Write(header, sizeof(header) - 1);
+        
+        Simulator::Schedule(Seconds(m_interval), &KpiSampler::Sample, this);
+    }
+    
+    // Última muestra parcial (si la hay) y volcado del bloque pendiente
+    void Finish()
+    {
+        if (!m_writer.IsOpen()) return;
+        if (Simulator::Now().GetSeconds() > m_lastSample) Sample(false);
+        m_writer.Close();
+    }
+    
+private:
+    struct FlowCursor {
+        uint64_t txBytes = 0;
+        uint64_t rxBytes = 0;
+        uint32_t rxPackets = 0;
+        double delaySumMs = 0.0;
+    };
+    
+    struct Window {
+        uint64_t rxBytes = 0;
+        uint32_t rxPackets = 0;
+        double delaySumMs = 0.0;
+        int64_t backlog = 0;
+        double sinrSum = 0.0;
+        uint32_t sinrSamples = 0;
+    };
+    
+    void Sample(bool reschedule = true)
+    {
+        double now = Simulator::Now().GetSeconds();
+        double elapsed = now - m_lastSample;
+        std::fill(m_ue.begin(), m_ue.end(), Window());
+        std::fill(m_cell.begin(), m_cell.end(), Window());
+        
+        m_source.ForEach([this](uint32_t flowId, const UeFlowKey& key,
+                                const FlowMonitor::FlowStats& fs) {
+            if (flowId >= m_flows.size()) m_flows.resize(flowId + 1);
+            FlowCursor& cursor = m_flows[flowId];
+            
+            double delaySumMs = fs.delaySum.GetSeconds() * 1000.0;
+            Window& w = m_ue[key.ueIndex];
+            w.rxBytes += fs.rxBytes - cursor.rxBytes;
+            w.rxPackets += fs.rxPackets - cursor.rxPackets;
+            w.delaySumMs += delaySumMs - cursor.delaySumMs;
+            w.backlog += static_cast<int64_t>(fs.txBytes) - static_cast<int64_t>(fs.rxBytes);
+            cursor.txBytes = fs.txBytes;
+            cursor.rxBytes = fs.rxBytes;
+            cursor.rxPackets = fs.rxPackets;
+            cursor.delaySumMs = delaySumMs;
+        });
+        
+        for (uint32_t i = 0; i < m_ue.size(); ++i) {
+            const ChannelMetrics& chan = g_ueMetrics.channel[i];
+            Window& w = m_ue[i];
+            w.sinrSum = chan.sumSinrDb - m_prevSinrSum[i];
+            w.sinrSamples = chan.samples - m_prevSinrSamples[i];
+            m_prevSinrSum[i] = chan.sumSinrDb;
+            m_prevSinrSamples[i] = chan.samples;
+            
+            uint32_t cell = g_ueMetrics.servingCell[i];
+            WriteRow(now, elapsed, "ue", i, cell, w);
+            
+            Window& c = m_cell[cell];
+            c.rxBytes += w.rxBytes;
+            c.rxPackets += w.rxPackets;
+            c.delaySumMs += w.delaySumMs;
+            c.backlog += w.backlog;
+            c.sinrSum += w.sinrSum;
+            c.sinrSamples += w.sinrSamples;
+        }
+        for (uint32_t c = 0; c < m_numCells; ++c) {
+            WriteRow(now, elapsed, "cell", c, c, m_cell[c]);
+        }
+        
+        m_lastSample = now;
+        if (reschedule) Simulator::Schedule(Seconds(m_interval), &KpiSampler::Sample, this);
+    }
+    
+    void WriteRow(double now, double elapsed, const char* level, uint32_t id, uint32_t cell,
+                  const Window& w)
+    {
+        double throughput = (elapsed > 0) ? (w.rxBytes * 8.0) / (elapsed * 1e6) : 0.0;
+        char sinr[32] = "";
+        char delay[32] = "";
+        if (w.sinrSamples > 0) std::snprintf(sinr, sizeof(sinr), "%.2f", w.sinrSum / w.sinrSamples);
+        if (w.rxPackets > 0) std::snprintf(delay, sizeof(delay), "%.3f", w.delaySumMs / w.rxPackets);
+        
+        char row[192];
+        int size = std::snprintf(row, sizeof(row), "%.3f,%s,%u,%u,%.3f,%s,%s,%lld\n",
+                                 now, level, id, cell, throughput, sinr, delay,
+                                 static_cast<long long>(w.backlog));
+        m_writer.Write(row, std::min<std::size_t>(size, sizeof(row) - 1));
+    }
+    
+    FlowSource m_source;
+    uint32_t m_numCells = 0;
+    double m_interval = 0.1;
+    double m_lastSample = 0.0;
+    
+    std::vector<FlowCursor> m_flows; // indexado por FlowId
+    std::vector<double> m_prevSinrSum;
+    std::vector<uint32_t> m_prevSinrSamples;
+    std::vector<Window> m_ue;
+    std::vector<Window> m_cell;
+    BlockWriter m_writer;
+};
+
+// Serie temporal de planificación por celda: diferencias de MacCellCounters
+// entre muestras y backlog de bajada por canal lógico (bearer eMBB o URLLC).
+// La pila NR no expone el buffer RLC, así que el backlog es el de KpiSampler
+// separado por clase: bytes enviados por la aplicación aún no recibidos (cola
+// RLC/HARQ más lo que está en vuelo o se ha perdido).
+class MacStatsSampler {
+public:
+    void Start(Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier,
+               uint16_t embbPort, uint16_t urllcPort, uint32_t numCells,
+               double interval, const std::string& file)
+    {
+        m_source.Setup(monitor, classifier, embbPort, urllcPort);
+        m_numCells = numCells;
+        m_interval = interval;
+        m_prev = g_macCells;
+        m_embbBacklog.assign(numCells, 0);
+        m_urllcBacklog.assign(numCells, 0);
+        
+        m_writer.Open(file);
+        const char header[] = "Time(s),CellId,PrbUtilization(%),SymbolUtilization(%),UesPerSlot,"
+                              "TBs,AvgMcs,HarqNack(%),EmbbBacklog(bytes),UrllcBacklog(bytes)\n";
+        m_writer.Write(header, sizeof(header) - 1);
+        
+        Simulator::Schedule(Seconds(m_interval), &MacStatsSampler::Sample, this);
+    }
+    
+    void Finish()
+    {
+        if (!m_writer.IsOpen()) return;
+        if (Simulator::Now().GetSeconds() > m_lastSample) Sample(false);
+        m_writer.Close();
+    }
+    
+private:
+    void Sample(bool reschedule = true)
+    {
+        double now = Simulator::Now().GetSeconds();
+        std::fill(m_embbBacklog.begin(), m_embbBacklog.end(), 0);
+        std::fill(m_urllcBacklog.begin(), m_urllcBacklog.end(), 0);
+        m_source.ForEach([this](uint32_t flowId, const UeFlowKey& key,
+                                const FlowMonitor::FlowStats& fs) {
+            int64_t backlog = static_cast<int64_t>(fs.txBytes) - static_cast<int64_t>(fs.rxBytes);
+            uint32_t cell = g_ueMetrics.servingCell[key.ueIndex];
+            if (key.trafficClass == TRAFFIC_EMBB) {
+                m_embbBacklog[cell] += backlog;
+            } else {
+                m_urllcBacklog[cell] += backlog;
+            }
+        });
+        
+        for (uint32_t c = 0; c < m_numCells; ++c) {
+            MacCellCounters d = g_macCells[c].Since(m_prev[c]);
+            m_prev[c] = g_macCells[c];
+            char row[192];
+            int size = std::snprintf(row, sizeof(row), "%.3f,%u,%.2f,%.2f,%.2f,%llu,%.2f,%.2f,%lld,%lld\n",
+                                     now, c, d.PrbUtilization(), d.SymbolUtilization(), d.UesPerSlot(),
+                                     static_cast<unsigned long long>(d.tbs), d.AvgMcs(),
+                                     d.HarqNackRatio(), static_cast<long long>(m_embbBacklog[c]),
+                                     static_cast<long long>(m_urllcBacklog[c]));
+            m_writer.Write(row, std::min<std::size_t>(size, sizeof(row) - 1));
+        }
+        
+        m_lastSample = now;
+        if (reschedule) Simulator::Schedule(Seconds(m_interval), &MacStatsSampler::Sample, this);
+    }
+    
+    FlowSource m_source;
+    uint32_t m_numCells = 0;
+    double m_interval = 0.1;
+    double m_lastSample = 0.0;
+    std::vector<MacCellCounters> m_prev;
+    std::vector<int64_t> m_embbBacklog;
+    std::vector<int64_t> m_urllcBacklog;
+    BlockWriter m_writer;
+};
+
+// ==================== Warm-up y parada automáticas ==========================
+// Cuantil 0.975 de la t de Student (IC bilateral del 95%)
+static double
+StudentT975(uint32_t dof)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                   2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                   2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                   2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof == 0) return 0.0;
+    return (dof <= 30) ? table[dof - 1] : 1.960;
+}
+
+// Fin del warm-up cuando todos los UEs han completado la conexión RRC (traza
+// ConnectionEstablished de NrUeRrc). Si no ocurre antes de fallbackTime, el
+// tráfico arranca igualmente en ese instante.
+class WarmupDetector {
+public:
+    void Start(uint32_t numUes, double fallbackTime, std::function<void()> onReady)
+    {
+        m_connected.assign(numUes, false);
+        m_onReady = onReady;
+        Simulator::Schedule(Seconds(fallbackTime), &WarmupDetector::Fallback, this);
+    }
+    
+    void ConnectionEstablished(uint64_t imsi, uint16_t cellId, uint16_t rnti)
+    {
+        uint32_t ueIdx = g_ueMetrics.Index(imsi);
+        if (ueIdx == UeMetricsRegistry::INVALID_INDEX || m_connected[ueIdx]) return;
+        m_connected[ueIdx] = true;
+        if (++m_numConnected == m_connected.size()) Fire();
+    }
+    
+    bool IsReady() const { return m_fired; }
+    double GetReadyTime() const { return m_readyTime; }
+    
+private:
+    void Fallback()
+    {
+        if (m_fired) return;
+        NS_LOG_WARN("Warm-up: " << m_numConnected << "/" << m_connected.size()
+                    << " UEs conectados al expirar el tiempo límite");
+        Fire();
+    }
+    
+    void Fire()
+    {
+        if (m_fired) return;
+        m_fired = true;
+        m_readyTime = Simulator::Now().GetSeconds();
+        m_onReady();
+    }
+    
+    std::vector<bool> m_connected;
+    uint32_t m_numConnected = 0;
+    bool m_fired = false;
+    double m_readyTime = 0.0;
+    std::function<void()> m_onReady;
+};
+
+// Medias por lotes (batch means) del throughput y el retardo de cada clase de
+// tráfico. Tras minBatches lotes, si el semiancho del IC95 de cada media es
+// menor que ciTarget veces la media, se llama a Simulator::Stop().
+class ConvergenceController {
+public:
+    void Setup(Ptr<FlowMonitor> monitor, Ptr<Ipv4FlowClassifier> classifier,
+               uint16_t embbPort, uint16_t urllcPort,
+               double batchLength, double ciTarget, uint32_t minBatches)
+    {
+        m_source.Setup(monitor, classifier, embbPort, urllcPort);
+        m_batchLength = batchLength;
+        m_ciTarget = ciTarget;
+        m_minBatches = std::max(minBatches, 2u);
+    }
+    
+    // Primer lote tras 'delay' segundos (el lote inicial se descarta)
+    void StartAfter(double delay)
+    {
+        Simulator::Schedule(Seconds(delay), &ConvergenceController::EndBatch, this);
+    }
+    
+    bool HasConverged() const { return m_converged; }
+    uint32_t GetBatches() const { return m_batches[EMBB_THROUGHPUT].size() > 0 ?
+                                         m_batches[EMBB_THROUGHPUT].size() :
+                                         m_batches[URLLC_THROUGHPUT].size(); }
+    double GetHalfWidthRatio() const { return m_halfWidthRatio; }
+    
+private:
+    enum Metric {
+        EMBB_THROUGHPUT,
+        URLLC_THROUGHPUT,
+        EMBB_DELAY,
+        URLLC_DELAY,
+        NUM_METRICS
+    };
+    
+    struct Totals {
+        std::array<uint64_t, 2> rxBytes{};
+        std::array<uint64_t, 2> rxPackets{};
+        std::array<double, 2> delaySumMs{};
+        std::array<bool, 2> present{};
+    };
+    
+    Totals Collect()
+    {
+        Totals totals;
+        m_source.ForEach([&totals](uint32_t flowId, const UeFlowKey& key,
+                                   const FlowMonitor::FlowStats& fs) {
+            uint8_t c = key.trafficClass;
+            totals.rxBytes[c] += fs.rxBytes;
+            totals.rxPackets[c] += fs.rxPackets;
+            totals.delaySumMs[c] += fs.delaySum.GetSeconds() * 1000.0;
+            totals.present[c] = true;
+        });
+        return totals;
+    }
+    
+    void EndBatch()
+    {
+        Totals totals = Collect();
+        if (m_started) {
+            for (uint8_t c = TRAFFIC_EMBB; c <= TRAFFIC_URLLC; ++c) {
+                if (!totals.present[c]) continue;
+                uint64_t bytes = totals.rxBytes[c] - m_previous.rxBytes[c];
+                uint64_t packets = totals.rxPackets[c] - m_previous.rxPackets[c];
+                m_batches[EMBB_THROUGHPUT + c].push_back(bytes * 8.0 / (m_batchLength * 1e6));
+                if (packets > 0) {
+                    double delay = (totals.delaySumMs[c] - m_previous.delaySumMs[c]) / packets;
+                    m_batches[EMBB_DELAY + c].push_back(delay);
+                }
+            }
+        }
+        m_started = true;
+        m_previous = totals;
+        
+        if (IsConverged()) {
+            m_converged = true;
+            NS_LOG_INFO("Convergencia en t=" << Simulator::Now().GetSeconds() << " s tras "
+                        << GetBatches() << " lotes");
+            Simulator::Stop();
+            return;
+        }
+        Simulator::Schedule(Seconds(m_batchLength), &ConvergenceController::EndBatch, this);
+    }
+    
+    bool IsConverged()
+    {
+        bool any = false;
+        m_halfWidthRatio = 0.0;
+        for (const std::vector<double>& batches : m_batches) {
+            if (batches.empty()) continue;
+            if (batches.size() < m_minBatches) return false;
+            uint32_t n = batches.size();
+            double mean = 0.0, m2 = 0.0;
+            for (uint32_t i = 0; i < n; ++i) {
+                double delta = batches[i] - mean;
+                mean += delta / (i + 1);
+                m2 += delta * (batches[i] - mean);
+            }
+            if (mean <= 0.0) return false;
+            double halfWidth = StudentT975(n - 1) * std::sqrt(m2 / (n - 1)) / std::sqrt(n);
+            m_halfWidthRatio = std::max(m_halfWidthRatio, halfWidth / mean);
+            any = true;
+        }
+        return any && m_halfWidthRatio < m_ciTarget;
+    }
+    
+    FlowSource m_source;
+    double m_batchLength = 0.5;
+    double m_ciTarget = 0.05;
+    uint32_t m_minBatches = 10;
+    
+    bool m_started = false;
+    bool m_converged = false;
+    double m_halfWidthRatio = 0.0;
+    Totals m_previous;
+    std::array<std::vector<double>, NUM_METRICS> m_batches;
+};
+
+// ==================== Kernels de post-proceso ==============================
+// Puntuaciones QoE/Reliability de todos los flujos a la vez sobre arreglos
+// contiguos (struct-of-arrays). Los umbrales se expresan sin ramas como
+// factores min(1, umbral/x); con x = 0 la división da +inf y el factor vale 1.
+// Mismo orden de operaciones que la versión escalar con ramas, así que el
+// resultado es idéntico bit a bit. Con <experimental/simd> se procesan
+// native_simd<double>::size() flujos por iteración (AVX2/NEON según el
+// compilador); el resto, y sin esa cabecera, en escalar.
+struct FlowScoreBatch {
+    std::vector<double> embb;       // 1 = eMBB, 0 = URLLC
+    std::vector<double> throughput; // Mbps
+    std::vector<double> delay;      // ms
+    std::vector<double> jitter;     // ms
+    std::vector<double> lossRatio;  // %
+    std::vector<double> hasSinr;    // 1 si el UE tiene muestras de SINR
+    std::vector<double> avgSinr;    // dB
+    std::vector<double> sinrRange;  // dB
+    std::vector<double> qoe;
+    std::vector<double> reliability;
+    
+    std::size_t Size() const { return embb.size(); }
+};
+
+inline double VMin(double a, double b) { return std::min(a, b); }
+inline double VMax(double a, double b) { return std::max(a, b); }
+#ifdef NR_HAVE_SIMD
+template <class T, class Abi>
+inline stdx::simd<T, Abi> VMin(const stdx::simd<T, Abi>& a, const stdx::simd<T, Abi>& b) { return stdx::min(a, b); }
+template <class T, class Abi>
+inline stdx::simd<T, Abi> VMax(const stdx::simd<T, Abi>& a, const stdx::simd<T, Abi>& b) { return stdx::max(a, b); }
+#endif
+
+template <class V>
+static V
+QoeKernel(V embb, V throughput, V delay, V jitter, V lossRatio)
+{
+    const V one(1.0);
+    // eMBB: throughput y delay son críticos
+    V qe = V(100.0) * VMin(one, throughput / V(25.0));
+    qe = qe * VMin(one, V(20.0) / delay);
+    qe = qe * VMin(one, one / lossRatio);
+    // URLLC: latencia ultra-baja es crítica
+    V qu = V(100.0) * VMin(one, V(5.0) / delay);
+    qu = qu * VMin(one, V(0.1) / lossRatio);
+    qu = qu * VMin(one, V(2.0) / jitter);
+    V q = embb * qe + (one - embb) * qu;
+    return VMax(V(0.0), VMin(V(100.0), q));
+}
+
+template <class V>
+static V
+ReliabilityKernel(V hasSinr, V avgSinr, V sinrRange)
+{
+    const V one(1.0);
+    V r = V(100.0) * VMin(one, V(20.0) / sinrRange); // penalizar alta variabilidad
+    r = r * VMin(one, avgSinr / V(10.0));            // penalizar SINR bajo
+    r = hasSinr * r + (one - hasSinr) * V(100.0);
+    return VMax(V(0.0), VMin(V(100.0), r));
+}
+
+static void
+ComputeFlowScores(FlowScoreBatch& b)
+{
+    std::size_t n = b.Size();
+    b.qoe.resize(n);
+    b.reliability.resize(n);
+    std::size_t i = 0;
+#ifdef NR_HAVE_SIMD
+    using V = stdx::native_simd<double>;
+    auto load = [](const std::vector<double>& v, std::size_t at) {
+        return V(v.data() + at, stdx::element_aligned);
+    };
+    for (; i + V::size() <= n; i += V::size()) {
+        QoeKernel(load(b.embb, i), load(b.throughput, i), load(b.delay, i), load(b.jitter, i),
+                  load(b.lossRatio, i)).copy_to(b.qoe.data() + i, stdx::element_aligned);
+        ReliabilityKernel(load(b.hasSinr, i), load(b.avgSinr, i), load(b.sinrRange, i))
+            .copy_to(b.reliability.data() + i, stdx::element_aligned);
+    }
+#endif
+    for (; i < n; ++i) {
+        b.qoe[i] = QoeKernel(b.embb[i], b.throughput[i], b.delay[i], b.jitter[i], b.lossRatio[i]);
+        b.reliability[i] = ReliabilityKernel(b.hasSinr[i], b.avgSinr[i], b.sinrRange[i]);
+    }
+}
+
+// Percentil p (0-100) con interpolación lineal entre estadísticos de orden;
+// nth_element en O(n) en lugar de ordenar todo el vector
+static double
+Percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) return 0.0;
+    double rank = p / 100.0 * (values.size() - 1);
+    std::size_t lower = static_cast<std::size_t>(rank);
+    std::nth_element(values.begin(), values.begin() + lower, values.end());
+    double lowerValue = values[lower];
+    if (lower + 1 >= values.size()) return lowerValue;
+    double upperValue = *std::min_element(values.begin() + lower + 1, values.end());
+    return lowerValue + (rank - lower) * (upperValue - lowerValue);
+}
+
+// Cuantil de un sketch de SINR lineal expresado en dB (0 si no hay muestras).
+// El cubo cero devuelve 0 lineal: se acota al mínimo representable del sketch
+// (-90 dB) para no escribir -inf en las tablas.
+static double
+SinrQuantileDb(const DDSketch& sketch, double q)
+{
+    if (sketch.GetCount() == 0) return 0.0;
+    return 10.0 * std::log10(std::max(sketch.Quantile(q), DDSketch::MIN_VALUE));
+}
+
+// ==================== Perfilado de la réplica ==============================
+// Tiempos de pared por fase (reloj monótono): cada Begin() cierra la fase
+// anterior, así las fases son consecutivas y suman el total.
+class PhaseProfiler {
+public:
+    struct Phase {
+        std::string name;
+        double seconds;
+    };
+    
+    PhaseProfiler() : m_origin(Clock::now()), m_start(m_origin) {}
+    
+    void Begin(const std::string& phase)
+    {
+        End();
+        m_current = phase;
+        m_start = Clock::now();
+    }
+    
+    void End()
+    {
+        if (m_current.empty()) return;
+        m_phases.push_back({m_current, Seconds(m_start)});
+        m_current.clear();
+    }
+    
+    // Duración de una fase ya cerrada (0 si no existe)
+    double Get(const std::string& phase) const
+    {
+        for (const Phase& p : m_phases) {
+            if (p.name == phase) return p.seconds;
+        }
+        return 0.0;
+    }
+    
+    const std::vector<Phase>& GetPhases() const { return m_phases; }
+    double GetTotal() const { return Seconds(m_origin); }
+    
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    static double Seconds(Clock::time_point since)
+    {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    }
+    
+    Clock::time_point m_origin;
+    Clock::time_point m_start;
+    std::string m_current;
+    std::vector<Phase> m_phases;
+};
+
+// Pico de memoria residente del proceso (MB); en Linux ru_maxrss va en KB
+static double
+PeakRssMb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Memoria residente actual (MB) según /proc/self/statm; 0 si no está disponible
+static double
+CurrentRssMb()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t sizePages = 0;
+    uint64_t residentPages = 0;
+    if (!(statm >> sizePages >> residentPages)) return 0.0;
+    return residentPages * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
+
+// ==================== Telemetría de progreso ======================
+// Latido para el script de lotes: un evento periódico (cada statusInterval s
+// de simulación) reescribe un archivo de estado con una línea clave=valor por
+// campo: avance, velocidad sim/pared, eventos procesados, memoria y ETA. Se
+// escribe en un temporal que luego se renombra, así que el lector nunca ve un
+// archivo a medias, y como mucho una vez por segundo de pared. Al ser un
+// evento del simulador, un archivo que deja de actualizarse delata una réplica
+// atascada; durante la construcción de la topología el estado es "setup".
+class ProgressHeartbeat {
+public:
+    void Open(const std::string& file, uint32_t replications, double simEnd)
+    {
+        m_file = file;
+        m_replications = replications;
+        m_simEnd = simEnd;
+        m_origin = Clock::now();
+    }
+    
+    bool IsOpen() const { return !m_file.empty(); }
+    
+    void BeginReplication(uint32_t index, uint64_t run)
+    {
+        if (!IsOpen()) return;
+        m_index = index;
+        m_run = run;
+        m_replicationStart = Clock::now();
+        m_running = false;
+        m_runWall = 0.0;
+        m_lastSim = 0.0;
+        m_lastEvents = 0;
+        m_recentSpeed = 0.0;
+        m_eventRate = 0.0;
+        Write("setup", true);
+    }
+    
+    // Justo antes de Simulator::Run() (o del modelo analítico en modo fast):
+    // arranca el latido periódico
+    void Start(double interval)
+    {
+        if (!IsOpen()) return;
+        m_interval = interval;
+        m_runStart = Clock::now();
+        m_eventsBase = Simulator::GetEventCount();
+        m_lastWall = 0.0;
+        m_running = true;
+        Write("running", true);
+        Simulator::Schedule(Seconds(m_interval), &ProgressHeartbeat::Beat, this);
+    }
+    
+    // Tras Simulator::Run(): el evento pendiente lo elimina Simulator::Destroy()
+    void EndReplication()
+    {
+        if (!IsOpen()) return;
+        Write("postprocessing", true);
+        m_running = false;
+        m_completedWall += Since(m_replicationStart);
+        ++m_completed;
+    }
+    
+    void Close()
+    {
+        if (!IsOpen()) return;
+        Write("done", true);
+        m_file.clear();
+    }
+    
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    static constexpr double MIN_WRITE_PERIOD = 1.0; // s de pared entre escrituras
+    
+    static double Since(Clock::time_point since)
+    {
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    }
+    
+    void Beat()
+    {
+        Write("running", false);
+        Simulator::Schedule(Seconds(m_interval), &ProgressHeartbeat::Beat, this);
+    }
+    
+    void Write(const char* state, bool force)
+    {
+        double simNow = m_running ? Simulator::Now().GetSeconds() : m_lastSim;
+        double runWall = m_running ? Since(m_runStart) : m_runWall;
+        if (!force && runWall - m_lastWall < MIN_WRITE_PERIOD) return;
+        
+        uint64_t events = m_running ? Simulator::GetEventCount() - m_eventsBase : m_lastEvents;
+        if (m_running && runWall > m_lastWall) {
+            m_recentSpeed = (simNow - m_lastSim) / (runWall - m_lastWall);
+            m_eventRate = (events - m_lastEvents) / (runWall - m_lastWall);
+        }
+        m_lastWall = runWall;
+        m_lastSim = simNow;
+        m_lastEvents = events;
+        m_runWall = runWall;
+        
+        // ETA: lo que falta de esta réplica a la velocidad reciente, más las
+        // réplicas pendientes al coste medio de las ya terminadas (o, si no hay
+        // ninguna, al de esta extrapolado a simEnd)
+        double speed = (runWall > 0.0) ? simNow / runWall : 0.0;
+        double pace = (m_recentSpeed > 0.0) ? m_recentSpeed : speed;
+        double eta = -1.0;
+        if (pace > 0.0) {
+            double replicationWall = Since(m_replicationStart);
+            double left = std::max(0.0, m_simEnd - simNow) / pace;
+            double perReplication = (m_completed > 0) ? m_completedWall / m_completed :
+                                    replicationWall + left;
+            uint32_t pending = m_replications - std::min(m_replications, m_index);
+            eta = left + pending * perReplication;
+        }
+        
+        std::string tmp = m_file + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out) return;
+            out << std::fixed << std::setprecision(3);
+            out << "state=" << state << "\n"
+                << "pid=" << getpid() << "\n"
+                << "replication=" << m_index << "/" << m_replications << "\n"
+                << "run=" << m_run << "\n"
+                << "simTime=" << simNow << "\n"
+                << "simEnd=" << m_simEnd << "\n"
+                << "wallTime=" << Since(m_origin) << "\n"
+                << "runWallTime=" << runWall << "\n"
+                << "speed=" << speed << "\n"
+                << "recentSpeed=" << m_recentSpeed << "\n"
+                << "events=" << events << "\n"
+                << "eventRate=" << std::setprecision(0) << m_eventRate << "\n"
+                << std::setprecision(1)
+                << "rssMb=" << CurrentRssMb() << "\n"
+                << "peakRssMb=" << PeakRssMb() << "\n"
+                << "etaSeconds=" << std::setprecision(0) << eta << "\n"
+                << "updated=" << std::chrono::duration_cast<std::chrono::seconds>(
+                                     std::chrono::system_clock::now().time_since_epoch()).count()
+                << "\n";
+        }
+        std::rename(tmp.c_str(), m_file.c_str());
+    }
+    
+    std::string m_file;
+    uint32_t m_replications = 1;
+    uint32_t m_index = 0;
+    uint32_t m_completed = 0;
+    uint64_t m_run = 0;
+    double m_simEnd = 0.0;
+    double m_interval = 0.1;
+    bool m_running = false;
+    Clock::time_point m_origin;
+    Clock::time_point m_replicationStart;
+    Clock::time_point m_runStart;
+    double m_completedWall = 0.0;
+    double m_runWall = 0.0;
+    uint64_t m_eventsBase = 0;
+    double m_lastWall = 0.0;
+    double m_lastSim = 0.0;
+    uint64_t m_lastEvents = 0;
+    double m_recentSpeed = 0.0;
+    double m_eventRate = 0.0;
+};
+
+static ProgressHeartbeat g_progress;
+
+// ==================== Configuración de la simulación ======================
+struct SimulationConfig {
+    // Parámetros configurables - EXACTOS como tu código
+    uint32_t numCells = 1;
+    uint32_t numUEs = 30;
+    double embbRatio = 0.6;
+    double ISD = 200.0;
+    double simTime = 15.0;
+    double appStartTime = 5.0;
+    uint32_t rngSeed = 1;
+    std::string outputDir = "./results";
+    std::string scheduler = "TdmaQos";
+    std::string hoAlgorithm = "A2A4";
+    bool denseScenario = false;
+    
+    // Parámetros del canal 
+    double gnbTxPower = 46.0; 
+    double ueTxPower = 26.0;  
+    double gnbHeight = 25.0;   
+    double ueHeight = 1.5;     
+    
+    // Layout: "legacy" (1,3,5,7,9 celdas) o "hex" (malla de hexTiers anillos)
+    std::string layout = "legacy";
+    uint32_t hexTiers = 1;
+    uint32_t sectors = 1;
+    bool wrapAround = false;
+    uint32_t neighbourK = 4; // vecinas registradas por UE
+    
+    // Réplicas independientes: subflujos RngRun runStart .. runStart+runs-1
+    uint32_t runs = 1;
+    uint32_t runStart = 1;
+    
+    // Reparto de réplicas entre procesos MPI (requiere ns-3 con --enable-mpi)
+    bool mpi = false;
+    
+    // Formato de las tablas flow/cell/system: csv, binary (.nrcb) o both
+    std::string outputFormat = "csv";
+    
+    // Serie temporal de KPIs cada kpiInterval segundos (0 = desactivada)
+    double kpiInterval = 0.0;
+    // Serie temporal de planificación MAC por celda (0 = desactivada)
+    double macStatsInterval = 0.0;
+    
+    // Archivo de estado para el script de lotes (vacío = sin latido) y periodo
+    // del latido en tiempo de simulación (ver ProgressHeartbeat)
+    std::string statusFile;
+    double statusInterval = 0.1;
+    
+    // Tiempo de pared dentro de las trazas propias (añade dos lecturas de reloj por traza)
+    bool profileCallbacks = false;
+    
+    // Intervalo entre paquetes URLLC (s); 0 = 0.5 ms en denso, 1 ms en disperso
+    double urllcInterval = 0.0;
+    
+    // Muestreo del SINR por TB: full, nth, slot o reservoir (ver SinrSampler)
+    std::string sinrTracePolicy = "full";
+    std::string traceUes = "all"; // all|none|list:a,b,...|random:K (ver UeTraceSelection)
+    uint32_t sinrTraceN = 10;          // política nth
+    uint32_t sinrReservoirSize = 256;  // política reservoir, muestras por UE
+    
+    // Warm-up automático: el tráfico arranca cuando todos los UEs completan la
+    // conexión RRC (appStartTime pasa a ser el límite)
+    bool autoWarmup = false;
+    // Parada automática por convergencia de las medias por lotes
+    bool autoStop = false;
+    double batchLength = 0.5; // s
+    uint32_t minBatches = 10;
+    double ciTarget = 0.05;   // semiancho relativo del IC95
+    
+    // Snapshot de asociación inicial (ver AttachSnapshot); con varias réplicas
+    // se usa un archivo por réplica con sufijo .run<R>
+    std::string saveSnapshot;
+    std::string loadSnapshot;
+    double snapshotStartTime = 0.3; // arranque de las aplicaciones al cargar un snapshot (s)
+    
+    // Ventana de ping-pong: vuelta a la celda anterior en menos de este tiempo (s)
+    double pingPongWindow = 1.0;
+    
+    // Directorio de la caché de condición de canal (vacío = desactivada)
+    std::string channelCacheDir;
+    
+    // Movilidad de UEs: static, rwp, linear o trace (ver UeMobilityDriver)
+    std::string mobility = "static";
+    double ueSpeed = 3.0;       // m/s, rwp y linear
+    double mobilityTick = 0.1;  // s entre actualizaciones de asociación
+    std::string mobilityTrace;  // archivo "tiempo ueIndex x y" para trace
+    
+    // Asociación inicial: closest (celda más cercana) o rsrp-cio (RSRP + CIO
+    // ajustado por carga, ver LoadAwareAssociation)
+    std::string association = "closest";
+    double cioMax = 6.0;         // dB, también diferencia máxima de RSRP del rebalanceo
+    double cioStep = 1.0;        // dB por iteración
+    double loadTolerance = 0.2;  // desviación admitida sobre la carga media
+    // Rebalanceo periódico por handover (0 = desactivado, ver LoadRebalancer)
+    double rebalanceInterval = 0.0;  // s
+    double rebalanceThreshold = 80.0; // utilización de PRB (%)
+    uint32_t rebalanceMaxMoves = 2;  // UEs por celda y periodo
+    
+    // Contabilidad de flujos: flowmonitor (sondas en todos los nodos) o apps
+    // (contadores en los sinks de los UEs y los clientes del remote host)
+    std::string flowAccounting = "flowmonitor";
+    
+    // Tráfico URLLC desde un único cliente multi-destino (ver
+    // MultiDestinationUdpClient) en lugar de un UdpClient por UE. Mismos
+    // paquetes e instantes de envío; desactivado por defecto
+    bool urllcAggregate = false;
+    
+    // Fuente eMBB: onoff (tasa fija perUeRateBps) o abr (vídeo adaptativo,
+    // ver AbrVideoSource); la escalera va en Mb/s
+    std::string embbSource = "onoff";
+    std::string abrLadder = "2,5,8,12,20";
+    double abrSegment = 1.0;   // s de vídeo por segmento
+    double abrReservoir = 2.0; // s
+    double abrCushion = 6.0;   // s
+    double abrMaxBuffer = 12.0; // s
+    
+    // Fidelidad: full (pila NR completa) o fast (abstracción analítica SINR ->
+    // tasa, ver RunFastReplication). La ganancia de conformación y la figura de
+    // ruido son los parámetros de calibración del modo rápido frente al completo.
+    std::string fidelity = "full";
+    double fastBeamGain = 15.0;   // dB, solo enlace servidor
+    double fastNoiseFigure = 5.0; // dB
+    std::string fastShare = "pf"; // pf|tdma
+    
+    // Mapa de cobertura (ver RunRadioMap): base de los archivos de salida;
+    // vacío = simulación normal. 0 hilos = todos los núcleos.
+    std::string radioMap;
+    double radioMapResolution = 10.0; // m
+    uint32_t radioMapThreads = 0;
+};
+
+// Parámetros que determinan posiciones y asociaciones: un snapshot solo es
+// válido para réplicas con la misma clave
+static std::string
+TopologyKey(const SimulationConfig& config, uint64_t run)
+{
+    std::ostringstream key;
+    key << std::setprecision(17)
+        << "layout=" << config.layout << " cells=" << config.numCells
+        << " ues=" << config.numUEs << " embbRatio=" << config.embbRatio
+        << " isd=" << config.ISD << " hexTiers=" << config.hexTiers
+        << " sectors=" << config.sectors << " wrap=" << config.wrapAround
+        << " neighbourK=" << config.neighbourK << " dense=" << config.denseScenario
+        << " gnbHeight=" << config.gnbHeight << " ueHeight=" << config.ueHeight
+        << " seed=" << config.rngSeed << " run=" << run;
+    if (config.association != "closest") {
+        key << " association=" << config.association << " cioMax=" << config.cioMax
+            << " cioStep=" << config.cioStep << " loadTolerance=" << config.loadTolerance;
+    }
+    return key.str();
+}
+
+static std::string
+SnapshotPath(const std::string& base, const SimulationConfig& config, uint64_t run)
+{
+    return (config.runs > 1) ? base + ".run" + std::to_string(run) : base;
+}
+
+// Métrica numérica del sistema, usada para agregar réplicas
+struct SystemMetric {
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+static void
+ResetGlobalMetrics()
+{
+    g_ueMetrics = UeMetricsRegistry();
+    g_cellQoE.clear();
+    g_handoverAttempts = 0;
+    g_handoverSuccess = 0;
+    g_handoverFailures = 0;
+    g_callbackCounts = CallbackCounters();
+    g_sinrSampler = SinrSampler();
+    g_macCells.clear();
+    g_macBaseline.clear();
+}
+
+// Tasa OnOff de cada UE eMBB: reparto del presupuesto del escenario
+static uint64_t
+EmbbPerUeRateBps(bool denseScenario, uint32_t nEmbb)
+{
+    double embbBudgetBps = denseScenario ? 3e8 /*300 Mb/s*/ : 2e8 /*200 Mb/s*/;
+    if (nEmbb == 0) return static_cast<uint64_t>(10e6);
+    double fairShare = embbBudgetBps / static_cast<double>(nEmbb);
+    // Piso 5 Mb/s, techo 20 Mb/s por UE para evitar colas y pérdida
+    fairShare = std::max(5e6, std::min(fairShare, 20e6));
+    return static_cast<uint64_t>(fairShare);
+}
+
+// ==================== Tablas de celda y de sistema =========================
+// Agregados comunes a la réplica completa y al modo rápido (--fidelity=fast):
+// ambos escriben cell_stats y system_stats con las mismas columnas y filas.
+struct CellSummary {
+    double totalThroughput = 0.0;
+    uint64_t totalTx = 0, totalRx = 0, totalLost = 0;
+    double totalSinr = 0.0;
+    uint32_t sinrSamples = 0;
+    QoEMetrics qoe;
+    DDSketch delay;
+    DDSketch sinr;
+    // Planificación de bajada (ver MacCellCounters); en modo rápido salen del
+    // reparto de tiempo y del MCS del modelo analítico
+    double prbUtilization = 0.0; // %
+    double avgMcs = 0.0;
+    double harqNack = 0.0;       // %
+    double bitsPerUsedRe = 0.0;
+    
+    void SetScheduling(const MacCellCounters& mac)
+    {
+        prbUtilization = mac.PrbUtilization();
+        avgMcs = mac.AvgMcs();
+        harqNack = mac.HarqNackRatio();
+        bitsPerUsedRe = mac.BitsPerUsedRe();
+    }
+};
+
+struct SystemSummary {
+    double totalThroughput = 0.0;
+    std::vector<double> ueThroughput;
+    double avgUrllcDelay = 0.0;
+    double avgEmbbDelay = 0.0;
+    DDSketch urllcDelay;
+    DDSketch embbDelay;
+    uint64_t handoverAttempts = 0;
+    uint64_t handoverSuccess = 0;
+    uint64_t handoverFailures = 0;
+    uint64_t handoverPingPong = 0;
+    double handoverInterruptionP50 = 0.0;
+    double handoverInterruptionP95 = 0.0;
+    
+    double SpectralEfficiency(uint32_t numCells) const
+    {
+        return (totalThroughput * 1e6) / (100e6 * numCells);
+    }
+    
+    double HandoverSuccessRate() const
+    {
+        return (handoverAttempts > 0) ? (100.0 * handoverSuccess / handoverAttempts) : 0.0;
+    }
+};
+
+static void
+WriteCellStats(const std::string& cellFile, const std::string& outputFormat,
+               const std::vector<CellSummary>& cellSummaries, const std::vector<uint32_t>& cellUeCount)
+{
+    uint32_t numCells = cellSummaries.size();
+    StatsTable cellOut;
+    cellOut.AddColumn("CellId", StatsTable::COL_INT64);
+    cellOut.AddColumn("NumUEs", StatsTable::COL_INT64);
+    cellOut.AddColumn("TotalThroughput(Mbps)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("SpectralEfficiency(bps/Hz)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("TxPackets", StatsTable::COL_INT64);
+    cellOut.AddColumn("RxPackets", StatsTable::COL_INT64);
+    cellOut.AddColumn("LostPackets", StatsTable::COL_INT64);
+    cellOut.AddColumn("PacketLossRatio(%)", StatsTable::COL_FLOAT64, 4);
+    cellOut.AddColumn("AvgSINR(dB)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("AvgDelay(ms)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("AvgJitter(ms)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("CellQoEScore", StatsTable::COL_FLOAT64, 1);
+    cellOut.AddColumn("CellReliability(%)", StatsTable::COL_FLOAT64, 1);
+    cellOut.AddColumn("LoadBalance(%)", StatsTable::COL_FLOAT64, 1);
+    cellOut.AddColumn("DelayP50(ms)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("DelayP99(ms)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("DelayP999(ms)", StatsTable::COL_FLOAT64, 3);
+    cellOut.AddColumn("SinrP5(dB)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("SinrP50(dB)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("PrbUtilization(%)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("AvgMcs", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("HarqNack(%)", StatsTable::COL_FLOAT64, 2);
+    cellOut.AddColumn("BitsPerUsedRe", StatsTable::COL_FLOAT64, 3);
+    
+    double maxCellThroughput = 0.0;
+    for (const CellSummary& summary : cellSummaries) {
+        maxCellThroughput = std::max(maxCellThroughput, summary.totalThroughput);
+    }
+    
+    for (uint32_t cellId = 0; cellId < numCells; cellId++) {
+        const CellSummary& summary = cellSummaries[cellId];
+        
+        double packetLossRatio = (summary.totalTx > 0) ? 
+                                (100.0 * summary.totalLost / summary.totalTx) : 0.0;
+        double avgSinr = (summary.sinrSamples > 0) ? 
+                        summary.totalSinr / summary.sinrSamples : 0.0;
+        double avgDelay = (summary.qoe.flows > 0) ? 
+                         summary.qoe.totalDelay / summary.qoe.flows : 0.0;
+        double avgJitter = (summary.qoe.flows > 0) ? 
+                          summary.qoe.totalJitter / summary.qoe.flows : 0.0;
+        
+        // Eficiencia espectral (asumiendo 100 MHz de ancho de banda)
+        double spectralEfficiency = (summary.totalThroughput * 1e6) / 100e6; // bps/Hz
+        
+        // QoE Score por celda
+        double cellQoE = 100.0;
+        if (avgDelay > 10.0) cellQoE *= (10.0 / avgDelay);
+        if (packetLossRatio > 1.0) cellQoE *= (1.0 / packetLossRatio);
+        if (avgSinr < 15.0) cellQoE *= (avgSinr / 15.0);
+        cellQoE = std::max(0.0, std::min(100.0, cellQoE));
         
-        case 9:
-        default: {
-            // Centro + 8 direcciones
-            positions->Add(Vector(0.0, 0.0, baseHeight));
-            double r = effectiveISD * 0.65;
-            for (int i = 0; i < 8; i++) {
-                double angle = i * M_PI / 4.0;
-                positions->Add(Vector(r * cos(angle), r * sin(angle), baseHeight));
-            }
-            break;
-        }
+        // Reliability basada en pérdidas y SINR
+        double reliability = 100.0 - packetLossRatio * 10.0;
+        if (avgSinr < 10.0) reliability *= (avgSinr / 10.0);
+        reliability = std::max(0.0, std::min(100.0, reliability));
+        
+        // Load Balance (distribución equitativa del throughput)
+        double loadBalance = (maxCellThroughput > 0) ? 
+                            (summary.totalThroughput / maxCellThroughput * 100.0) : 0.0;
+        
+        cellOut.Int(cellId).Int(cellUeCount[cellId])
+               .Real(summary.totalThroughput)
+               .Real(spectralEfficiency)
+               .Int(summary.totalTx).Int(summary.totalRx).Int(summary.totalLost)
+               .Real(packetLossRatio)
+               .Real(avgSinr)
+               .Real(avgDelay)
+               .Real(avgJitter)
+               .Real(cellQoE)
+               .Real(reliability).Real(loadBalance)
+               .Real(summary.delay.Quantile(0.50))
+               .Real(summary.delay.Quantile(0.99))
+               .Real(summary.delay.Quantile(0.999))
+               .Real(SinrQuantileDb(summary.sinr, 0.05))
+               .Real(SinrQuantileDb(summary.sinr, 0.50))
+               .Real(summary.prbUtilization)
+               .Real(summary.avgMcs)
+               .Real(summary.harqNack)
+               .Real(summary.bitsPerUsedRe);
     }
     
-    return positions;
+    cellOut.Write(cellFile, outputFormat);
 }
 
-static void
-DistributeUsersOptimized(NodeContainer ueNodes, NodeContainer gnbNodes, 
-                        ScenarioType scenario, double ISD, double userHeight)
+// Filas de system_stats que no dependen del modo; devuelve las métricas
+// numéricas para el resumen entre réplicas
+static std::vector<SystemMetric>
+AddSystemStats(StatsTable& systemOut, const SystemSummary& system, const SimulationConfig& config,
+               double simTime, double coverageAreaM2, const std::string& propagationModel)
 {
-    Ptr<UniformRandomVariable> uniformRv = CreateObject<UniformRandomVariable>();
-    Ptr<ExponentialRandomVariable> expRv = CreateObject<ExponentialRandomVariable>();
+    const uint32_t numCells = config.numCells;
+    const uint32_t numUEs = config.numUEs;
+    double totalSystemThroughput = system.totalThroughput;
+    systemOut.AddColumn("Metric", StatsTable::COL_TEXT, 0, 32);
+    systemOut.AddColumn("Value", StatsTable::COL_FLOAT64, 3);
+    systemOut.AddColumn("Unit", StatsTable::COL_TEXT, 0, 16);
+    systemOut.Text("TotalSystemThroughput").Real(totalSystemThroughput).Text("Mbps");
+    systemOut.Text("AvgThroughputPerCell").Real(totalSystemThroughput / numCells).Text("Mbps");
+    systemOut.Text("AvgThroughputPerUE").Real(totalSystemThroughput / numUEs).Text("Mbps");
     
-    uint32_t numUEs = ueNodes.GetN();
-    uint32_t numCells = gnbNodes.GetN();
+    // Percentiles del throughput por UE (borde de celda = P5)
+    double cellEdgeThroughput = Percentile(system.ueThroughput, 5.0);
+    double medianUeThroughput = Percentile(system.ueThroughput, 50.0);
+    systemOut.Text("CellEdgeThroughputP5").Real(cellEdgeThroughput).Text("Mbps");
+    systemOut.Text("MedianUeThroughput").Real(medianUeThroughput).Text("Mbps");
     
-    // Distribución por celda con variabilidad realista
-    std::vector<uint32_t> uesPerCell(numCells);
-    uint32_t baseUesPerCell = numUEs / numCells;
-    uint32_t remainder = numUEs % numCells;
+    // Latencias promedio por tipo
+    double avgUrllcDelay = system.avgUrllcDelay;
+    double avgEmbbDelay = system.avgEmbbDelay;
+    systemOut.Text("AvgURLLCDelay").Real(avgUrllcDelay).Text("ms");
+    systemOut.Text("AvgEmbbDelay").Real(avgEmbbDelay).Text("ms");
     
-    for (uint32_t i = 0; i < numCells; i++) {
-        uesPerCell[i] = baseUesPerCell + (i < remainder ? 1 : 0);
-        
-        // Variabilidad según escenario
-        if (scenario == DENSE_URBAN) {
-            // Más concentración en algunas celdas
-            if (i == 0 || i == numCells/2) {
-                uesPerCell[i] *= 1.5;
-            }
-        }
-    }
+    // Colas de latencia por paquete (sketches fusionados de todos los flujos)
+    double urllcDelayP99 = system.urllcDelay.Quantile(0.99);
+    double urllcDelayP999 = system.urllcDelay.Quantile(0.999);
+    double embbDelayP99 = system.embbDelay.Quantile(0.99);
+    systemOut.Text("URLLCDelayP99").Real(urllcDelayP99).Text("ms");
+    systemOut.Text("URLLCDelayP999").Real(urllcDelayP999).Text("ms");
+    systemOut.Text("EmbbDelayP99").Real(embbDelayP99).Text("ms");
     
-    uint32_t ueIndex = 0;
-    for (uint32_t cellId = 0; cellId < numCells && ueIndex < numUEs; cellId++) {
-        Vector cellPos = gnbNodes.Get(cellId)->GetObject<MobilityModel>()->GetPosition();
-        
-        // Radio de cobertura según escenario
-        double maxRadius = (scenario == DENSE_URBAN) ? ISD * 0.4 : ISD * 0.8;
-        double minRadius = (scenario == DENSE_URBAN) ? 10.0 : 50.0;
-        
-        for (uint32_t j = 0; j < uesPerCell[cellId] && ueIndex < numUEs; j++) {
-            double radius, angle;
-            
-            if (scenario == DENSE_URBAN) {
-                // Distribución más concentrada cerca del centro
-                radius = minRadius + expRv->GetValue() * (maxRadius - minRadius) * 0.3;
-                radius = std::min(radius, maxRadius);
-            } else {
-                // Distribución más uniforme
-                radius = uniformRv->GetValue(minRadius, maxRadius);
-            }
-            
-            angle = uniformRv->GetValue(0.0, 2 * M_PI);
-            
-            double x = cellPos.x + radius * cos(angle);
-            double y = cellPos.y + radius * sin(angle);
-            
-            ueNodes.Get(ueIndex)->GetObject<MobilityModel>()->SetPosition(
-                Vector(x, y, userHeight));
-            
-            ueIndex++;
-        }
-    }
+    systemOut.Text("HandoverAttempts").Int(system.handoverAttempts).Text("count");
+    systemOut.Text("HandoverSuccess").Int(system.handoverSuccess).Text("count");
+    systemOut.Text("HandoverFailures").Int(system.handoverFailures).Text("count");
     
-    // Distribuir UEs restantes aleatoriamente
-    double areaSize = ISD * 1.5;
-    for (; ueIndex < numUEs; ueIndex++) {
-        double x = uniformRv->GetValue(-areaSize, areaSize);
-        double y = uniformRv->GetValue(-areaSize, areaSize);
-        ueNodes.Get(ueIndex)->GetObject<MobilityModel>()->SetPosition(
-            Vector(x, y, userHeight));
-    }
+    double handoverSuccessRate = system.HandoverSuccessRate();
+    systemOut.Text("HandoverSuccessRate").Real(handoverSuccessRate, 2).Text("%");
+    systemOut.Text("HandoverPingPong").Int(system.handoverPingPong).Text("count");
+    double handoverInterruptionP50 = system.handoverInterruptionP50;
+    double handoverInterruptionP95 = system.handoverInterruptionP95;
+    systemOut.Text("HandoverInterruptionP50").Real(handoverInterruptionP50).Text("ms");
+    systemOut.Text("HandoverInterruptionP95").Real(handoverInterruptionP95).Text("ms");
+    
+    // Calcular eficiencia espectral del sistema
+    double systemSpectralEff = system.SpectralEfficiency(numCells);
+    systemOut.Text("SystemSpectralEfficiency").Real(systemSpectralEff).Text("bps/Hz/cell");
+    
+    // Densidad de usuarios
+    double userDensity = numUEs / (coverageAreaM2 * 1e-6); // usuarios/km²
+    systemOut.Text("UserDensity").Real(userDensity, 1).Text("UE/km2");
+    
+    systemOut.Text("ScenarioType").Text(config.denseScenario ? "dense" : "sparse").Text("type");
+    systemOut.Text("NumCells").Int(numCells).Text("count");
+    systemOut.Text("NumUEs").Int(numUEs).Text("count");
+    systemOut.Text("InterSiteDistance").Real(config.ISD, 1).Text("m");
+    systemOut.Text("SimulationTime").Real(simTime, 1).Text("s");
+    systemOut.Text("Numerology").Int(2).Text("30kHz_SCS");
+    systemOut.Text("UeTxPower").Real(config.ueTxPower, 1).Text("dBm");
+    systemOut.Text("PropagationModel").Text(propagationModel).Text("type");
+    
+    // Métricas numéricas para el resumen entre réplicas
+    return {
+        {"TotalSystemThroughput", totalSystemThroughput, "Mbps"},
+        {"AvgThroughputPerCell", totalSystemThroughput / numCells, "Mbps"},
+        {"AvgThroughputPerUE", totalSystemThroughput / numUEs, "Mbps"},
+        {"CellEdgeThroughputP5", cellEdgeThroughput, "Mbps"},
+        {"MedianUeThroughput", medianUeThroughput, "Mbps"},
+        {"AvgURLLCDelay", avgUrllcDelay, "ms"},
+        {"AvgEmbbDelay", avgEmbbDelay, "ms"},
+        {"URLLCDelayP99", urllcDelayP99, "ms"},
+        {"URLLCDelayP999", urllcDelayP999, "ms"},
+        {"EmbbDelayP99", embbDelayP99, "ms"},
+        {"HandoverAttempts", static_cast<double>(system.handoverAttempts), "count"},
+        {"HandoverSuccess", static_cast<double>(system.handoverSuccess), "count"},
+        {"HandoverFailures", static_cast<double>(system.handoverFailures), "count"},
+        {"HandoverSuccessRate", handoverSuccessRate, "%"},
+        {"HandoverPingPong", static_cast<double>(system.handoverPingPong), "count"},
+        {"HandoverInterruptionP50", handoverInterruptionP50, "ms"},
+        {"HandoverInterruptionP95", handoverInterruptionP95, "ms"},
+        {"SystemSpectralEfficiency", systemSpectralEff, "bps/Hz/cell"},
+    };
 }
 
-// ==================== Función principal ====================================
-int main(int argc, char** argv)
+// ==================== Réplica de simulación ================================
+// Construye la topología, ejecuta una réplica y escribe sus CSV en outputDir.
+// Termina con Simulator::Destroy() para que la siguiente réplica parta de cero.
+static std::vector<SystemMetric>
+RunReplication(const SimulationConfig& config, uint64_t run, const std::string& outputDir)
 {
-    // Parámetros configurables - EXACTOS como tu código
-    uint32_t numCells = 1;
-    uint32_t numUEs = 30;
-    double embbRatio = 0.6;
-    double ISD = 200.0;
-    double simTime = 15.0;
-    double appStartTime = 5.0;
-    uint32_t rngSeed = 1;
-    std::string outputDir = "./results";
-    std::string scheduler = "TdmaQos";
-    std::string hoAlgorithm = "A2A4";
-    bool denseScenario = false;
-    
-    // Parámetros del canal 
-    double gnbTxPower = 46.0; 
-    double ueTxPower = 26.0;  
-    double gnbHeight = 25.0;   
-    double ueHeight = 1.5;     
+    const uint32_t numCells = config.numCells;
+    const uint32_t numUEs = config.numUEs;
+    const double embbRatio = config.embbRatio;
+    const double ISD = config.ISD;
+    // Con snapshot el attach es casi inmediato: el tráfico arranca en
+    // snapshotStartTime y simTime se acorta lo mismo, conservando la ventana de medida
+    const bool fromSnapshot = !config.loadSnapshot.empty();
+    const double appStartTime = fromSnapshot ?
+        std::min(config.snapshotStartTime, config.appStartTime) : config.appStartTime;
+    const double simTime = config.simTime - (config.appStartTime - appStartTime);
+    const uint32_t rngSeed = config.rngSeed;
+    const std::string& scheduler = config.scheduler;
+    const std::string& hoAlgorithm = config.hoAlgorithm;
+    const bool denseScenario = config.denseScenario;
+    const double gnbTxPower = config.gnbTxPower;
+    const double ueTxPower = config.ueTxPower;
+    const double gnbHeight = config.gnbHeight;
+    const double ueHeight = config.ueHeight;
+    const std::string& outputFormat = config.outputFormat;
     
-    CommandLine cmd(__FILE__);
-    cmd.AddValue("numCells", "Número de celdas (1,3,5,7,9)", numCells);
-    cmd.AddValue("numUEs", "Número total de UEs", numUEs);
-    cmd.AddValue("embbRatio", "Proporción de UEs eMBB", embbRatio);
-    cmd.AddValue("ISD", "Distancia inter-sitio (m)", ISD);
-    cmd.AddValue("simTime", "Tiempo de simulación (s)", simTime);
-    cmd.AddValue("rngSeed", "Semilla aleatoria", rngSeed);
-    cmd.AddValue("outputDir", "Directorio de salida", outputDir);
-    cmd.AddValue("scheduler", "Scheduler (TdmaQos|OfdmaQos)", scheduler);
-    cmd.AddValue("hoAlgorithm", "Algoritmo de handover", hoAlgorithm);
-    cmd.AddValue("denseScenario", "Escenario denso (true) o disperso (false)", denseScenario);
-    cmd.Parse(argc, argv);
-    
-    // Configurar directorios de salida -  
     std::string scenarioName = denseScenario ? "dense" : "sparse";
-    std::ostringstream dirStream;
-    dirStream << outputDir; 
-    outputDir = dirStream.str();
     std::filesystem::create_directories(outputDir);
+    ResetGlobalMetrics();
     
-    // Inicialización -  
-    SeedManager::SetSeed(rngSeed);
+    AttachSnapshot snapshot;
+    if (fromSnapshot) {
+        std::string snapshotFile = SnapshotPath(config.loadSnapshot, config, run);
+        NS_ABORT_MSG_IF(!snapshot.Load(snapshotFile), "No se pudo leer el snapshot " << snapshotFile);
+        NS_ABORT_MSG_IF(snapshot.topologyKey != TopologyKey(config, run),
+                        "El snapshot " << snapshotFile << " es de otra topología: "
+                        << snapshot.topologyKey);
+    }
+    
+    g_profileCallbacks = config.profileCallbacks;
+    PhaseProfiler profiler;
+    profiler.Begin("Topology");
     
     // Crear nodos -  
     NodeContainer gnbNodes, ueNodes;
@@ -303,16 +4365,38 @@ int main(int argc, char** argv)
     gnbMobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
     
     ScenarioType scenario = denseScenario ? DENSE_URBAN : SPARSE_SUBURBAN;
-    Ptr<ListPositionAllocator> gnbPositions = CreateOptimizedCellLayout(
-        numCells, ISD, gnbHeight, scenario);
-    gnbMobility.SetPositionAllocator(gnbPositions);
+    CellLayout layout = (config.layout == "hex") ?
+        CreateHexGridLayout(config.hexTiers, ISD, gnbHeight, config.sectors, config.wrapAround) :
+        CreateOptimizedCellLayout(numCells, ISD, gnbHeight, scenario);
+    gnbMobility.SetPositionAllocator(layout.CreatePositionAllocator());
     gnbMobility.Install(gnbNodes);
     
+    CellSpatialIndex cellIndex;
+    cellIndex.Build(layout);
+    
     // Configurar movilidad de UEs -  
+    UeMobilityDriver::Kind mobilityKind = UeMobilityDriver::STATIC;
+    UeMobilityDriver::ParseKind(config.mobility, mobilityKind);
     MobilityHelper ueMobility;
-    ueMobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    ueMobility.SetMobilityModel((mobilityKind == UeMobilityDriver::STATIC) ?
+                                "ns3::ConstantPositionMobilityModel" :
+                                "ns3::ConstantVelocityMobilityModel");
     ueMobility.Install(ueNodes);
-    DistributeUsersOptimized(ueNodes, gnbNodes, scenario, ISD, ueHeight);
+    if (fromSnapshot) {
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            ueNodes.Get(i)->GetObject<MobilityModel>()->SetPosition(snapshot.positions[i]);
+        }
+    } else {
+        DistributeUsersOptimized(ueNodes, layout, scenario, ISD, ueHeight);
+    }
+    
+    // Primer tramo de cada UE móvil; el área es la cobertura de DistributeUsersOptimized
+    UeMobilityDriver mobilityDriver;
+    if (mobilityKind != UeMobilityDriver::STATIC) {
+        double margin = (scenario == DENSE_URBAN) ? ISD * 0.4 : ISD * 0.8;
+        mobilityDriver.Setup(mobilityKind, ueNodes, layout, cellIndex, config.ueSpeed,
+                             config.mobilityTick, margin, config.mobilityTrace);
+    }
     
     // Configurar NR Helper con beamforming mejorado -  
     Ptr<NrPointToPointEpcHelper> epcHelper = CreateObject<NrPointToPointEpcHelper>();
@@ -328,6 +4412,10 @@ int main(int argc, char** argv)
     // Configuraciones avanzadas -  
     nrHelper->SetAttribute("EnableMimoFeedback", BooleanValue(true));
     nrHelper->SetAttribute("CsiFeedbackFlags", UintegerValue(7)); // Todas las banderas CSI
+    if (fromSnapshot) {
+        // Señalización RRC instantánea: el estado de partida ya está resuelto
+        nrHelper->SetAttribute("UseIdealRrc", BooleanValue(true));
+    }
     
     // Scheduler optimizado -  
     std::string schedulerTypeId = "ns3::NrMacScheduler" + scheduler;
@@ -335,8 +4423,12 @@ int main(int argc, char** argv)
     nrHelper->SetSchedulerAttribute("SchedLcAlgorithmType", 
         TypeIdValue(NrMacSchedulerLcQos::GetTypeId()));
     
-    // Configurar handover 
-    if (hoAlgorithm == "A2A4") {
+    // Configurar handover. Con rebalanceo las decisiones son solo de
+    // LoadRebalancer: A2A4 no conoce los CIO y devolvería a la celda más
+    // fuerte los UEs de borde movidos a propósito (ping-pong)
+    if (config.rebalanceInterval > 0) {
+        nrHelper->SetHandoverAlgorithmType("ns3::NoOpHandoverAlgorithm");
+    } else if (hoAlgorithm == "A2A4") {
         nrHelper->SetHandoverAlgorithmType("ns3::A2A4RsrqHandoverAlgorithm");
         nrHelper->SetHandoverAlgorithmAttribute("ServingCellThreshold", UintegerValue(15)); 
         nrHelper->SetHandoverAlgorithmAttribute("NeighbourCellOffset", UintegerValue(3)); 
@@ -357,16 +4449,55 @@ int main(int argc, char** argv)
     
     BandwidthPartInfoPtrVector allBwps = CcBwpCreator::GetAllBwps({band});
     
+    // Caché de condición de canal compartida por las réplicas de la misma
+    // topología, semilla y banda
+    Ptr<CachedChannelConditionModel> channelCache;
+    std::string channelCacheFile;
+    if (!config.channelCacheDir.empty()) {
+        uint64_t cacheKey = Fnv1a64(TopologyKey(config, run) + " band=3.5e9/100e6 model=" +
+                                    propagationModel);
+        std::ostringstream name;
+        name << config.channelCacheDir << "/chancond_" << std::hex << std::setw(16)
+             << std::setfill('0') << cacheKey << ".nrcc";
+        channelCacheFile = name.str();
+        std::filesystem::create_directories(config.channelCacheDir);
+        channelCache = InstallChannelConditionCache(allBwps, channelCacheFile, cacheKey);
+        if (!channelCache) {
+            NS_LOG_WARN("El canal no usa modelos 3GPP: caché de condición desactivada");
+        }
+    }
+    
+    // Sectores: elemento directivo 3GPP; la orientación se fija por gNB tras instalar
+    if (layout.sectorized) {
+        nrHelper->SetGnbAntennaAttribute("AntennaElement",
+            PointerValue(CreateObject<ThreeGppAntennaModel>()));
+    }
+    
     // Instalar dispositivos -  
+    profiler.Begin("DeviceInstall");
     NetDeviceContainer gnbDevices = nrHelper->InstallGnbDevice(gnbNodes, allBwps);
     NetDeviceContainer ueDevices = nrHelper->InstallUeDevice(ueNodes, allBwps);
     
+    // Registro denso IMSI -> índice (una sola vez, tras instalar los UEs)
+    g_ueMetrics.Build(ueDevices, numCells);
+    SinrSampler::Policy sinrPolicy = SinrSampler::FULL;
+    SinrSampler::ParsePolicy(config.sinrTracePolicy, sinrPolicy);
+    g_sinrSampler.Setup(sinrPolicy, config.sinrTraceN, config.sinrReservoirSize, numUEs);
+    profiler.Begin("StackAndTraffic");
+    
    
     // Configurar parámetros de gNB 
     for (uint32_t i = 0; i < gnbDevices.GetN(); ++i) {
         Ptr<NrGnbPhy> gnbPhy = nrHelper->GetGnbPhy(gnbDevices.Get(i), 0);
         gnbPhy->SetAttribute("TxPower", DoubleValue(gnbTxPower));
         gnbPhy->SetAttribute("Numerology", UintegerValue(2)); 
+        
+        if (layout.sectorized) {
+            Ptr<UniformPlanarArray> antenna =
+                DynamicCast<UniformPlanarArray>(gnbPhy->GetSpectrumPhy()->GetAntenna());
+            antenna->SetAttribute("BearingAngle",
+                DoubleValue(layout.cells[i].azimuthDeg * M_PI / 180.0));
+        }
     }
     
     // Añadir configuración de potencia UE 
@@ -381,9 +4512,10 @@ int main(int argc, char** argv)
     internet.Install(ueNodes);
     internet.Install(remoteHost);
     Ipv4InterfaceContainer ueIpIfaces = epcHelper->AssignUeIpv4Address(ueDevices);
+    uint32_t numEmbbUEs = static_cast<uint32_t>(embbRatio * numUEs);
+    g_ueMetrics.IndexAddresses(ueIpIfaces, numEmbbUEs);
     
     // Clasificar UEs 
-    uint32_t numEmbbUEs = static_cast<uint32_t>(embbRatio * numUEs);
     NodeContainer embbUEs, urllcUEs;
     NetDeviceContainer embbDevices, urllcDevices;
     
@@ -396,132 +4528,416 @@ int main(int argc, char** argv)
             urllcDevices.Add(ueDevices.Get(i));
         }
     }
-    double embbBudgetBps = denseScenario ? 3e8 /*300 Mb/s*/ : 2e8 /*200 Mb/s*/;
-    uint32_t nEmbb = embbUEs.GetN();
-    uint64_t perUeRateBps = 0;
-
-    if (nEmbb > 0) {
-        double fairShare = embbBudgetBps / static_cast<double>(nEmbb);
-        // Piso 5 Mb/s, techo 20 Mb/s por UE para evitar colas y pérdida
-        fairShare = std::max(5e6, std::min(fairShare, 20e6));
-        perUeRateBps = static_cast<uint64_t>(fairShare);
-    } else {
-        perUeRateBps = static_cast<uint64_t>(10e6);
-    }
+    uint64_t perUeRateBps = EmbbPerUeRateBps(denseScenario, embbUEs.GetN());
     // Configurar aplicaciones -  
     uint16_t embbPort = 7000;
     uint16_t urllcPort = 7001;
     ApplicationContainer serverApps, clientApps;
     
-    // Aplicaciones eMBB - Video streaming 
+    // Bearer eMBB -  
     for (uint32_t i = 0; i < embbUEs.GetN(); ++i) {
-        PacketSinkHelper sinkHelper("ns3::UdpSocketFactory", 
-            InetSocketAddress(Ipv4Address::GetAny(), embbPort));
-        serverApps.Add(sinkHelper.Install(embbUEs.Get(i)));
-        
-        Ipv4Address destAddr = ueIpIfaces.GetAddress(i);
-        OnOffHelper onOffHelper("ns3::UdpSocketFactory", 
-            InetSocketAddress(destAddr, embbPort));
-        
-        // Tráfico variable según escenario -  
-        onOffHelper.SetAttribute("PacketSize", UintegerValue(1400));
-        onOffHelper.SetAttribute("DataRate", DataRateValue(DataRate(perUeRateBps)));
-        onOffHelper.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
-        onOffHelper.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
-        
-        clientApps.Add(onOffHelper.Install(remoteHost));
-        
-        // Bearer eMBB -  
         NrEpsBearer bearer(NrEpsBearer::NGBR_VIDEO_TCP_DEFAULT);
         nrHelper->ActivateDedicatedEpsBearer(embbDevices.Get(i), bearer, Create<NrEpcTft>());
     }
     
-    
-    // Aplicaciones URLLC - Control crítico 
+    // Bearer URLLC -  
     for (uint32_t i = 0; i < urllcUEs.GetN(); ++i) {
-        PacketSinkHelper sinkHelper("ns3::UdpSocketFactory", 
-            InetSocketAddress(Ipv4Address::GetAny(), urllcPort));
-        serverApps.Add(sinkHelper.Install(urllcUEs.Get(i)));
-        
-        uint32_t ueIdx = i + numEmbbUEs;
-        Ipv4Address destAddr = ueIpIfaces.GetAddress(ueIdx);
-        UdpClientHelper udpClient(destAddr, urllcPort);
-        
-        // Configuración URLLC optimizada 
-        uint32_t pktSize = 100; //  
-        double interval = denseScenario ? 0.0005 : 0.001; 
-        
-        udpClient.SetAttribute("PacketSize", UintegerValue(pktSize));
-        udpClient.SetAttribute("Interval", TimeValue(Seconds(interval)));
-        udpClient.SetAttribute("MaxPackets", UintegerValue(0)); // Ilimitado
-        
-        clientApps.Add(udpClient.Install(remoteHost));
-        
-        // Bearer URLLC -  
         NrEpsBearer bearer(NrEpsBearer::NGBR_LOW_LAT_EMBB);
         nrHelper->ActivateDedicatedEpsBearer(urllcDevices.Get(i), bearer, Create<NrEpcTft>());
     }
     
-    // Conectar UEs a la celda más cercana -  
-    nrHelper->AttachToClosestGnb(ueDevices, gnbDevices);
+    // Calcular asociaciones UE-celda, distancias y vecinas con el índice espacial -  
+    uint32_t neighbourK = std::min(config.neighbourK, numCells);
+    g_ueMetrics.neighbourK = neighbourK;
+    g_ueMetrics.neighbourCells.assign(numUEs * neighbourK, 0);
+    g_ueMetrics.neighbourDistance.assign(numUEs * neighbourK, 0.0);
+    if (fromSnapshot) {
+        NS_ABORT_MSG_IF(snapshot.positions.size() != numUEs || snapshot.neighbourK != neighbourK,
+                        "Snapshot incompleto para " << numUEs << " UEs");
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            NS_ABORT_MSG_IF(snapshot.servingCell[i] >= numCells ||
+                            snapshot.trafficClass[i] != g_ueMetrics.trafficClass[i],
+                            "Snapshot inconsistente en el UE " << i);
+            g_ueMetrics.servingCell[i] = snapshot.servingCell[i];
+            g_ueMetrics.distance[i] = snapshot.distance[i];
+            g_ueMetrics.cellUeCount[snapshot.servingCell[i]]++;
+        }
+        g_ueMetrics.neighbourCells = snapshot.neighbourCells;
+        g_ueMetrics.neighbourDistance = snapshot.neighbourDistance;
+    }
+    for (uint32_t i = 0; i < numUEs && !fromSnapshot; ++i) {
+        Vector uePos = ueNodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
+        double minDistance = 0.0;
+        uint32_t closestCell = cellIndex.Nearest(uePos, minDistance);
+        
+        g_ueMetrics.servingCell[i] = closestCell;
+        g_ueMetrics.distance[i] = minDistance;
+        g_ueMetrics.cellUeCount[closestCell]++;
+        
+        // Top-K vecinas para bookkeeping de handover e interferencia
+        std::vector<CellSpatialIndex::Neighbour> neighbours = cellIndex.KNearest(uePos, neighbourK);
+        for (uint32_t k = 0; k < neighbours.size(); ++k) {
+            g_ueMetrics.neighbourCells[i * neighbourK + k] = neighbours[k].cell;
+            g_ueMetrics.neighbourDistance[i * neighbourK + k] = neighbours[k].distance;
+        }
+    }
+    
+    // Asociación por carga y rebalanceo: RSRP estimado hacia las candidatas de
+    // cada UE con el modelo de pérdidas del canal (ver LoadAwareAssociation).
+    // Con snapshot la asociación ya viene resuelta; solo se recalculan las RSRP.
+    bool loadAware = (config.association == "rsrp-cio");
+    bool rebalance = (config.rebalanceInterval > 0);
+    LoadAwareAssociation association;
+    uint32_t associationIterations = 0;
+    if (loadAware || rebalance) {
+        uint32_t candidates = std::min(numCells, std::max(neighbourK, 3 * layout.CellsPerSite()));
+        association.Setup(numCells, numUEs, candidates, config.cioMax, config.cioStep,
+                          config.loadTolerance);
+        Ptr<PropagationLossModel> pathloss = allBwps[0].get()->m_channel->GetPropagationLossModel();
+        double urllcInterval = (config.urllcInterval > 0) ? config.urllcInterval :
+                               (denseScenario ? 0.0005 : 0.001);
+        double urllcDemandBps = (100 + IPV4_UDP_OVERHEAD) * 8.0 / urllcInterval;
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            Ptr<MobilityModel> ueMobility = ueNodes.Get(i)->GetObject<MobilityModel>();
+            Vector uePos = ueMobility->GetPosition();
+            std::vector<CellSpatialIndex::Neighbour> neighbours = cellIndex.KNearest(uePos, candidates);
+            for (uint32_t k = 0; k < neighbours.size(); ++k) {
+                uint32_t cell = neighbours[k].cell;
+                Ptr<MobilityModel> gnbMobility = gnbNodes.Get(cell)->GetObject<MobilityModel>();
+                double rsrpDbm = pathloss->CalcRxPower(gnbTxPower, gnbMobility, ueMobility) +
+                                 layout.ElementGainDb(uePos, cell, neighbours[k].image);
+                association.SetCandidate(i, k, cell, rsrpDbm);
+            }
+            association.SetDemand(i, (i < numEmbbUEs) ? perUeRateBps : urllcDemandBps);
+        }
+    }
+    if (loadAware && !fromSnapshot) {
+        associationIterations = association.Solve();
+        std::fill(g_ueMetrics.cellUeCount.begin(), g_ueMetrics.cellUeCount.end(), 0);
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            uint32_t cell = association.GetServing(i);
+            Vector uePos = ueNodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
+            g_ueMetrics.servingCell[i] = cell;
+            g_ueMetrics.distance[i] = layout.Distance(uePos, cell);
+            g_ueMetrics.cellUeCount[cell]++;
+        }
+    }
+    
+    if (!config.saveSnapshot.empty()) {
+        snapshot.topologyKey = TopologyKey(config, run);
+        snapshot.neighbourK = neighbourK;
+        snapshot.servingCell = g_ueMetrics.servingCell;
+        snapshot.distance = g_ueMetrics.distance;
+        snapshot.neighbourCells = g_ueMetrics.neighbourCells;
+        snapshot.neighbourDistance = g_ueMetrics.neighbourDistance;
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            snapshot.positions.push_back(ueNodes.Get(i)->GetObject<MobilityModel>()->GetPosition());
+            snapshot.trafficClass.push_back(g_ueMetrics.trafficClass[i]);
+        }
+        std::string snapshotFile = SnapshotPath(config.saveSnapshot, config, run);
+        NS_ABORT_MSG_IF(!snapshot.Save(snapshotFile), "No se pudo escribir el snapshot " << snapshotFile);
+    }
+    
+    // Con movilidad, celda más cercana, vecinas y distancia se mantienen en un
+    // evento por tick
+    if (mobilityKind != UeMobilityDriver::STATIC) {
+        mobilityDriver.Start();
+    }
+    
+    // Conectar cada UE a la celda resuelta por el índice (equivale a
+    // AttachToClosestGnb, que además no distingue sectores co-ubicados) o por
+    // la asociación por carga -  
+    for (uint32_t i = 0; i < numUEs; ++i) {
+        nrHelper->AttachToGnb(ueDevices.Get(i), gnbDevices.Get(g_ueMetrics.servingCell[i]));
+    }
+    
+    // UEs trazados en detalle: con random:K se sortean por celda tras la asociación
+    UeTraceSelection traceSelection;
+    traceSelection.Parse(config.traceUes);
+    g_ueMetrics.SetTraced(traceSelection.Select(g_ueMetrics.servingCell, g_ueMetrics.distance,
+                                                numCells));
     
     // Configurar trazas mejoradas -  
     for (uint32_t i = 0; i < ueDevices.GetN(); ++i) {
         Ptr<NrUeNetDevice> ueDevice = ueDevices.Get(i)->GetObject<NrUeNetDevice>();
         uint64_t imsi = ueDevice->GetImsi();
         
-        // SINR tracing
-        Ptr<NrSpectrumPhy> spectrumPhy = ueDevice->GetPhy(0)->GetSpectrumPhy();
-        spectrumPhy->TraceConnectWithoutContext("RxPacketTraceUe", 
-            MakeBoundCallback(&EnhancedSinrCallback, imsi));
+        // SINR tracing (una invocación por TB: solo UEs trazados)
+        if (g_ueMetrics.traced[i]) {
+            Ptr<NrSpectrumPhy> spectrumPhy = ueDevice->GetPhy(0)->GetSpectrumPhy();
+            spectrumPhy->TraceConnectWithoutContext("RxPacketTraceUe", 
+                MakeBoundCallback(&EnhancedSinrCallback, imsi));
+        }
         
-        // Handover tracing
-        ueDevice->GetPhy(0)->TraceConnectWithoutContext("HandoverStart", 
-            MakeBoundCallback(&HandoverStartCallback, imsi));
-        ueDevice->GetPhy(0)->TraceConnectWithoutContext("HandoverSuccess", 
-            MakeBoundCallback(&HandoverSuccessCallback, imsi));
-        ueDevice->GetPhy(0)->TraceConnectWithoutContext("HandoverFailure", 
-            MakeBoundCallback(&HandoverFailureCallback, imsi));
+        // Handover tracing (las trazas de handover son de RRC, no de la PHY); en
+        // todos los UEs, porque de ellas salen los contadores de sistema
+        ueDevice->GetRrc()->TraceConnectWithoutContext("HandoverStart", 
+            MakeCallback(&HandoverStartCallback));
+        ueDevice->GetRrc()->TraceConnectWithoutContext("HandoverEndOk", 
+            MakeCallback(&HandoverSuccessCallback));
+        ueDevice->GetRrc()->TraceConnectWithoutContext("HandoverEndError", 
+            MakeCallback(&HandoverFailureCallback));
     }
     
-    // Calcular asociaciones UE-celda y distancias -  
-    for (uint32_t i = 0; i < numUEs; ++i) {
-        Vector uePos = ueNodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
-        double minDistance = std::numeric_limits<double>::max();
-        uint32_t closestCell = 0;
-        
-        for (uint32_t j = 0; j < numCells; ++j) {
-            Vector gnbPos = gnbNodes.Get(j)->GetObject<MobilityModel>()->GetPosition();
-            double distance = CalculateDistance(uePos, gnbPos);
-            
-            if (distance < minDistance) {
-                minDistance = distance;
-                closestCell = j;
+    // Inicio de la preparación en la gNB origen y registro de eventos de handover
+    std::vector<uint16_t> cellIds;
+    for (uint32_t i = 0; i < gnbDevices.GetN(); ++i) {
+        Ptr<NrGnbNetDevice> gnbDevice = gnbDevices.Get(i)->GetObject<NrGnbNetDevice>();
+        cellIds.push_back(gnbDevice->GetCellId());
+        gnbDevice->GetRrc()->TraceConnectWithoutContext("HandoverStart",
+            MakeCallback(&GnbHandoverStartCallback));
+    }
+    
+    // Planificación de bajada por celda: una traza por slot en la PHY y una por
+    // TB y por realimentación HARQ en la MAC
+    g_macCells.assign(numCells, MacCellCounters());
+    g_macBaseline = g_macCells;
+    for (uint32_t i = 0; i < gnbDevices.GetN(); ++i) {
+        nrHelper->GetGnbPhy(gnbDevices.Get(i), 0)->TraceConnectWithoutContext("SlotDataStats",
+            MakeBoundCallback(&SlotDataStatsCallback, i));
+        Ptr<NrGnbMac> gnbMac = nrHelper->GetGnbMac(gnbDevices.Get(i), 0);
+        gnbMac->TraceConnectWithoutContext("DlScheduling",
+            MakeBoundCallback(&DlSchedulingCallback, i));
+        gnbMac->TraceConnectWithoutContext("DlHarqFeedback",
+            MakeBoundCallback(&DlHarqFeedbackCallback, i));
+    }
+    
+    // X2 (la preparación del handover va por X2) y seguimiento de la celda
+    // real. Con rebalanceo, entre cada celda y las candidatas de sus UEs; con
+    // movilidad, entre cada celda y las de los sitios de su primer anillo
+    bool mobile = (mobilityKind != UeMobilityDriver::STATIC);
+    std::set<std::pair<uint32_t, uint32_t>> x2Links;
+    if (rebalance) {
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            for (uint32_t a = 0; a < association.GetCandidatesPerUe(); ++a) {
+                for (uint32_t b = a + 1; b < association.GetCandidatesPerUe(); ++b) {
+                    uint32_t ca = association.GetCandidate(i, a);
+                    uint32_t cb = association.GetCandidate(i, b);
+                    if (ca == LoadAwareAssociation::NO_CELL || cb == LoadAwareAssociation::NO_CELL) continue;
+                    x2Links.insert({std::min(ca, cb), std::max(ca, cb)});
+                }
+            }
+        }
+    }
+    if (mobile) {
+        const uint32_t x2Sites = 7; // el propio sitio y los seis del primer anillo
+        uint32_t x2Neighbours = std::min(numCells, std::max(neighbourK, x2Sites * layout.CellsPerSite()));
+        for (uint32_t c = 0; c < numCells; ++c) {
+            for (const CellSpatialIndex::Neighbour& n : cellIndex.KNearest(layout.cells[c].position, x2Neighbours)) {
+                if (n.cell != c) x2Links.insert({std::min(c, n.cell), std::max(c, n.cell)});
             }
         }
-        
-        uint64_t imsi = ueDevices.Get(i)->GetObject<NrUeNetDevice>()->GetImsi();
-        g_imsiToCell[imsi] = closestCell;
-        g_imsiDistance[imsi] = minDistance;
-        g_cellUeCount[closestCell]++;
     }
+    for (const auto& link : x2Links) {
+        epcHelper->AddX2Interface(gnbNodes.Get(link.first), gnbNodes.Get(link.second));
+    }
+    ServingCellTracker servingTracker;
+    if (rebalance || mobile) {
+        servingTracker.Setup(&layout, ueNodes, gnbDevices);
+        for (uint32_t i = 0; i < ueDevices.GetN(); ++i) {
+            ueDevices.Get(i)->GetObject<NrUeNetDevice>()->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndOk", MakeCallback(&ServingCellTracker::HandoverEnd, &servingTracker));
+        }
+    }
+    LoadRebalancer rebalancer;
+    if (rebalance) {
+        rebalancer.Setup(&association, ueDevices, gnbDevices, config.rebalanceInterval,
+                         config.rebalanceThreshold, config.rebalanceMaxMoves, config.cioMax);
+    }
+    std::string handoverEventsFile = outputDir + "/handover_events_optimized_" +
+                                     std::to_string(numCells) + "cell.nrho";
+    g_handoverLog.Open(handoverEventsFile, cellIds, numUEs, g_ueMetrics.firstImsi,
+                       config.pingPongWindow);
+    g_handoverLog.SetDetailed(g_ueMetrics.traced);
+    
+    // Con --flowAccounting=apps no se instala FlowMonitor: los contadores por
+    // UE se alimentan desde las trazas de las aplicaciones
+    bool appAccounting = (config.flowAccounting == "apps");
+    if (appAccounting) g_ueMetrics.appFlow.assign(numUEs, FlowMonitor::FlowStats());
     
     // Configurar y ejecutar simulación -  
     Ptr<UniformRandomVariable> appJitter = CreateObject<UniformRandomVariable>();
+    
+    // Instala las aplicaciones con arranque en startOffset + jitter. Se llama
+    // antes de Simulator::Run() (arranque fijo) o en tiempo de simulación al
+    // terminar el warm-up; los tiempos de inicio y fin de ns-3 son relativos al
+    // instante de instalación.
+    double trafficStartTime = appStartTime;
+    bool abrVideo = (config.embbSource == "abr");
+    std::vector<double> abrLadder;
+    if (abrVideo) AbrVideoSource::ParseLadder(config.abrLadder, abrLadder);
+    std::vector<Ptr<AbrVideoSource>> abrSources(numUEs);
+    auto installTraffic = [&](double startOffset) {
+        trafficStartTime = Simulator::Now().GetSeconds() + startOffset;
+        Simulator::Schedule(Seconds(startOffset), &MarkMacBaseline);
+        rebalancer.StartAfter(startOffset);
+        Time stopTime = Seconds(simTime) - Simulator::Now();
+        
+        // Aplicaciones eMBB - Video streaming 
+        for (uint32_t i = 0; i < embbUEs.GetN(); ++i) {
+            PacketSinkHelper sinkHelper("ns3::UdpSocketFactory", 
+                InetSocketAddress(Ipv4Address::GetAny(), embbPort));
+            sinkHelper.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
+            ApplicationContainer sink = sinkHelper.Install(embbUEs.Get(i));
+            sink.Get(0)->TraceConnectWithoutContext("RxWithSeqTsSize",
+                MakeBoundCallback(&EmbbRxCallback, i));
+            serverApps.Add(sink);
+            
+            Ipv4Address destAddr = ueIpIfaces.GetAddress(i);
+            if (abrVideo) {
+                Ptr<AbrVideoSource> source = CreateObject<AbrVideoSource>();
+                source->SetRemote(destAddr, embbPort);
+                source->SetLadder(abrLadder);
+                source->SetAttribute("SegmentDuration", TimeValue(Seconds(config.abrSegment)));
+                source->SetAttribute("Reservoir", TimeValue(Seconds(config.abrReservoir)));
+                source->SetAttribute("Cushion", TimeValue(Seconds(config.abrCushion)));
+                source->SetAttribute("MaxBuffer", TimeValue(Seconds(config.abrMaxBuffer)));
+                remoteHost->AddApplication(source);
+                sink.Get(0)->TraceConnectWithoutContext("RxWithSeqTsSize",
+                    MakeCallback(&AbrVideoSource::Receive, source));
+                if (appAccounting) {
+                    source->TraceConnectWithoutContext("Tx", MakeBoundCallback(&AppFlowTxCallback, i));
+                }
+                clientApps.Add(source);
+                abrSources[i] = source;
+                continue;
+            }
+            
+            OnOffHelper onOffHelper("ns3::UdpSocketFactory", 
+                InetSocketAddress(destAddr, embbPort));
+            // Cabecera de secuencia/tiempo para medir el retardo por paquete
+            // (forma parte del payload: el tamaño del paquete no cambia)
+            onOffHelper.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(true));
+            
+            // Tráfico variable según escenario -  
+            onOffHelper.SetAttribute("PacketSize", UintegerValue(1400));
+            onOffHelper.SetAttribute("DataRate", DataRateValue(DataRate(perUeRateBps)));
+            onOffHelper.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
+            onOffHelper.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
+            
+            ApplicationContainer client = onOffHelper.Install(remoteHost);
+            if (appAccounting) {
+                client.Get(0)->TraceConnectWithoutContext("Tx",
+                    MakeBoundCallback(&AppFlowTxCallback, i));
+            }
+            clientApps.Add(client);
+        }
+        
+        // Aplicaciones URLLC - Control crítico 
+        uint32_t pktSize = 100; //  
+        double interval = (config.urllcInterval > 0) ? config.urllcInterval :
+                          (denseScenario ? 0.0005 : 0.001);
+        
+        // Con urllcAggregate un único cliente en el remote host sirve a todos
+        // los UEs URLLC; sus destinos se añaden al repartir el jitter de arranque
+        Ptr<MultiDestinationUdpClient> urllcClient;
+        if (config.urllcAggregate && urllcUEs.GetN() > 0) {
+            urllcClient = CreateObject<MultiDestinationUdpClient>();
+            urllcClient->SetAttribute("PacketSize", UintegerValue(pktSize));
+            urllcClient->SetAttribute("Interval", TimeValue(Seconds(interval)));
+            if (appAccounting) {
+                urllcClient->TraceConnectWithoutContext("TxTo", MakeCallback(&AppFlowTxCallback));
+            }
+            remoteHost->AddApplication(urllcClient);
+        }
+        
+        for (uint32_t i = 0; i < urllcUEs.GetN(); ++i) {
+            uint32_t ueIdx = i + numEmbbUEs;
+            PacketSinkHelper sinkHelper("ns3::UdpSocketFactory", 
+                InetSocketAddress(Ipv4Address::GetAny(), urllcPort));
+            ApplicationContainer sink = sinkHelper.Install(urllcUEs.Get(i));
+            sink.Get(0)->TraceConnectWithoutContext("Rx",
+                MakeBoundCallback(&UrllcRxCallback, ueIdx));
+            serverApps.Add(sink);
+            if (urllcClient) continue;
+            
+            Ipv4Address destAddr = ueIpIfaces.GetAddress(ueIdx);
+            UdpClientHelper udpClient(destAddr, urllcPort);
+            
+            // Configuración URLLC optimizada 
+            udpClient.SetAttribute("PacketSize", UintegerValue(pktSize));
+            udpClient.SetAttribute("Interval", TimeValue(Seconds(interval)));
+            udpClient.SetAttribute("MaxPackets", UintegerValue(0)); // Ilimitado
+            
+            ApplicationContainer client = udpClient.Install(remoteHost);
+            if (appAccounting) {
+                client.Get(0)->TraceConnectWithoutContext("Tx",
+                    MakeBoundCallback(&UdpClientTxCallback, ueIdx));
+            }
+            clientApps.Add(client);
+        }
+        
+        for (uint32_t i = 0; i < serverApps.GetN(); ++i) {
+            double s = startOffset + appJitter->GetValue(0.0, 0.5);
+            serverApps.Get(i)->SetStartTime(Seconds(s));
+            serverApps.Get(i)->SetStopTime(stopTime);
+        }
+        for (uint32_t i = 0; i < clientApps.GetN(); ++i) {
+            double s = startOffset + appJitter->GetValue(0.0, 0.5);
+            clientApps.Get(i)->SetStartTime(Seconds(s));
+            clientApps.Get(i)->SetStopTime(stopTime);
+        }
+        // Mismo orden de extracciones del jitter que con un UdpClient por UE
+        if (urllcClient) {
+            for (uint32_t i = 0; i < urllcUEs.GetN(); ++i) {
+                uint32_t ueIdx = i + numEmbbUEs;
+                double s = appJitter->GetValue(0.0, 0.5);
+                urllcClient->AddDestination(ueIpIfaces.GetAddress(ueIdx), urllcPort, ueIdx,
+                                            Seconds(s));
+            }
+            urllcClient->SetStartTime(Seconds(startOffset));
+            urllcClient->SetStopTime(stopTime);
+        }
+    };
 
-    for (uint32_t i = 0; i < serverApps.GetN(); ++i) {
-        double s = appStartTime + appJitter->GetValue(0.0, 0.5);
-        serverApps.Get(i)->SetStartTime(Seconds(s));
-        serverApps.Get(i)->SetStopTime(Seconds(simTime));
+    FlowMonitorHelper flowMonitorHelper;
+    Ptr<FlowMonitor> monitor;
+    Ptr<Ipv4FlowClassifier> flowClassifier;
+    if (!appAccounting) {
+        monitor = flowMonitorHelper.InstallAll();
+        flowClassifier = DynamicCast<Ipv4FlowClassifier>(flowMonitorHelper.GetClassifier());
     }
-    for (uint32_t i = 0; i < clientApps.GetN(); ++i) {
-        double s = appStartTime + appJitter->GetValue(0.0, 0.5);
-        clientApps.Get(i)->SetStartTime(Seconds(s));
-        clientApps.Get(i)->SetStopTime(Seconds(simTime));
+    
+    // Parada por convergencia: el primer lote empieza cuando ya han arrancado
+    // todas las aplicaciones (fin del jitter de 0.5 s) y se descarta
+    ConvergenceController convergence;
+    if (config.autoStop) {
+        convergence.Setup(monitor, flowClassifier, embbPort, urllcPort,
+                          config.batchLength, config.ciTarget, config.minBatches);
+    }
+    
+    WarmupDetector warmup;
+    if (config.autoWarmup) {
+        const double warmupGuard = 0.1; // margen para completar los bearers dedicados
+        warmup.Start(numUEs, appStartTime, [&]() {
+            installTraffic(warmupGuard);
+            if (config.autoStop) convergence.StartAfter(warmupGuard + 0.5);
+        });
+        for (uint32_t i = 0; i < ueDevices.GetN(); ++i) {
+            Ptr<NrUeNetDevice> ueDevice = ueDevices.Get(i)->GetObject<NrUeNetDevice>();
+            ueDevice->GetRrc()->TraceConnectWithoutContext("ConnectionEstablished",
+                MakeCallback(&WarmupDetector::ConnectionEstablished, &warmup));
+        }
+    } else {
+        installTraffic(appStartTime);
+        if (config.autoStop) convergence.StartAfter(appStartTime + 0.5);
+    }
+    
+    KpiSampler kpiSampler;
+    std::string kpiFile = outputDir + "/kpi_timeseries_optimized_" + std::to_string(numCells) +
+                     "cell.csv";
+    if (config.kpiInterval > 0) {
+        kpiSampler.Start(monitor, flowClassifier, embbPort, urllcPort, numCells,
+                         config.kpiInterval, kpiFile);
+    }
+    
+    MacStatsSampler macSampler;
+    std::string macSeriesFile = outputDir + "/mac_timeseries_optimized_" + std::to_string(numCells) +
+                                "cell.csv";
+    if (config.macStatsInterval > 0) {
+        macSampler.Start(monitor, flowClassifier, embbPort, urllcPort, numCells,
+                         config.macStatsInterval, macSeriesFile);
     }
-
-    FlowMonitorHelper flowMonitorHelper;
-    Ptr<FlowMonitor> monitor = flowMonitorHelper.InstallAll();
     
     std::cout << "\n========== SIMULACIÓN CON OPTIMIZACIONES MÍNIMAS ==========\n";
     std::cout << "CAMBIOS APLICADOS (solo los compatibles):\n";
@@ -533,77 +4949,96 @@ int main(int argc, char** argv)
     std::cout << "===========================================================\n\n";
     
     Simulator::Stop(Seconds(simTime));
+    profiler.Begin("SimulatorRun");
+    uint64_t eventsBefore = Simulator::GetEventCount();
+    g_progress.Start(config.statusInterval);
     Simulator::Run();
+    uint64_t simulatorEvents = Simulator::GetEventCount() - eventsBefore;
+    g_progress.EndReplication();
+    profiler.Begin("PostProcessing");
+    kpiSampler.Finish();
+    macSampler.Finish();
+    g_sinrSampler.Finalize();
+    g_handoverLog.Close();
+    if (channelCache && !channelCache->Persist()) {
+        NS_LOG_WARN("No se pudo escribir la caché de canal " << channelCacheFile);
+    }
+    double effectiveSimTime = Simulator::Now().GetSeconds();
     
     // ==================== Procesamiento de resultados ======================
-    monitor->CheckForLostPackets();
-    Ptr<Ipv4FlowClassifier> classifier = 
-        DynamicCast<Ipv4FlowClassifier>(flowMonitorHelper.GetClassifier());
-    FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats();
+    if (monitor) monitor->CheckForLostPackets();
+    FlowSource flowSource;
+    flowSource.Setup(monitor, flowClassifier, embbPort, urllcPort);
     
     // Archivo de estadísticas de flujos - MEJORADO con columna adicional
     std::string flowFile = outputDir + "/flow_stats_optimized_" + std::to_string(numCells) + 
-                      "cell.csv";
-    std::ofstream flowOut(flowFile);
-    flowOut << "FlowId,TrafficType,UeImsi,ServingCell,Distance(m),DstAddr,"
-            << "AvgSinr(dB),MinSinr(dB),MaxSinr(dB),SinrStdDev(dB),"
-            << "TxPackets,RxPackets,LostPackets,PacketLossRatio(%),"
-            << "Throughput(Mbps),MeanDelay(ms),MeanJitter(ms),"
-            << "QoEScore,ReliabilityScore,Numerology\n";
-    
-    struct CellSummary {
-        double totalThroughput = 0.0;
-        uint64_t totalTx = 0, totalRx = 0, totalLost = 0;
-        double totalSinr = 0.0;
-        uint32_t sinrSamples = 0;
-        QoEMetrics qoe;
-    };
+                      "cell";
+    StatsTable flowOut;
+    flowOut.AddColumn("FlowId", StatsTable::COL_INT64);
+    flowOut.AddColumn("TrafficType", StatsTable::COL_TEXT, 0, 8);
+    flowOut.AddColumn("UeImsi", StatsTable::COL_INT64);
+    flowOut.AddColumn("ServingCell", StatsTable::COL_INT64);
+    flowOut.AddColumn("Distance(m)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("DstAddr", StatsTable::COL_TEXT, 0, 16);
+    flowOut.AddColumn("Traced", StatsTable::COL_INT64); // 0: columnas de SINR y fiabilidad sin muestras
+    flowOut.AddColumn("AvgSinr(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("MinSinr(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("MaxSinr(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("SinrStdDev(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("TxPackets", StatsTable::COL_INT64);
+    flowOut.AddColumn("RxPackets", StatsTable::COL_INT64);
+    flowOut.AddColumn("LostPackets", StatsTable::COL_INT64);
+    flowOut.AddColumn("PacketLossRatio(%)", StatsTable::COL_FLOAT64, 4);
+    flowOut.AddColumn("Throughput(Mbps)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("MeanDelay(ms)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("MeanJitter(ms)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("QoEScore", StatsTable::COL_FLOAT64, 1);
+    flowOut.AddColumn("ReliabilityScore", StatsTable::COL_FLOAT64, 1);
+    flowOut.AddColumn("Numerology", StatsTable::COL_INT64);
+    flowOut.AddColumn("DelayP50(ms)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("DelayP99(ms)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("DelayP999(ms)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("SinrP5(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("SinrP50(dB)", StatsTable::COL_FLOAT64, 2);
+    flowOut.AddColumn("Rebuffers", StatsTable::COL_INT64);
+    flowOut.AddColumn("RebufferTime(s)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("StartupDelay(s)", StatsTable::COL_FLOAT64, 3);
+    flowOut.AddColumn("BitrateSwitches", StatsTable::COL_INT64);
+    flowOut.AddColumn("MeanBitrate(Mbps)", StatsTable::COL_FLOAT64, 3);
     
-    std::map<uint32_t, CellSummary> cellSummaries;
+    std::vector<CellSummary> cellSummaries(numCells);
+    std::vector<double> ueThroughput(numUEs, 0.0);
     double totalSystemThroughput = 0.0;
     double totalUrllcDelay = 0.0;
     double totalEmbbDelay = 0.0;
     uint32_t urllcFlows = 0;
     uint32_t embbFlows = 0;
+    DDSketch urllcDelaySketch;
+    DDSketch embbDelaySketch;
     
-    for (const auto& flowStat : stats) {
-        Ipv4FlowClassifier::FiveTuple flowTuple = classifier->FindFlow(flowStat.first);
-        
+    // Primera pasada: métricas de cada flujo en arreglos contiguos
+    struct FlowRecord {
+        uint32_t flowId;
+        uint32_t ueIdx;
+        Ipv4Address dstAddr;
+        uint64_t txPackets, rxPackets, lostPackets;
+    };
+    std::vector<FlowRecord> flows;
+    FlowScoreBatch scores;
+    
+    flowSource.ForEach([&](uint32_t flowId, const UeFlowKey& ueKey,
+                           const FlowMonitor::FlowStats& fs) {
         // Identificar tipo de tráfico
-        bool isEmbb = (flowTuple.destinationPort == embbPort);
-        bool isUrllc = (flowTuple.destinationPort == urllcPort);
-        if (!isEmbb && !isUrllc) continue;
-        
-        // Encontrar IMSI del UE
-        uint64_t imsi = 0;
-        for (uint32_t i = 0; i < numUEs; ++i) {
-            if (ueIpIfaces.GetAddress(i) == flowTuple.destinationAddress) {
-                imsi = ueDevices.Get(i)->GetObject<NrUeNetDevice>()->GetImsi();
-                break;
-            }
-        }
-        
-        if (imsi == 0) continue;
+        bool isEmbb = (ueKey.trafficClass == TRAFFIC_EMBB);
+        bool isUrllc = !isEmbb;
+        uint32_t ueIdx = ueKey.ueIndex;
         
         // Obtener métricas del canal
-        ChannelMetrics& chanMetrics = g_channelMetrics[imsi];
+        const ChannelMetrics& chanMetrics = g_ueMetrics.channel[ueIdx];
         double avgSinr = (chanMetrics.samples > 0) ? 
                         chanMetrics.sumSinrDb / chanMetrics.samples : 0.0;
         
-        // Calcular desviación estándar del SINR
-        double sinrStdDev = 0.0;
-        if (g_sinrHistory[imsi].size() > 1) {
-            double mean = avgSinr;
-            double variance = 0.0;
-            for (double sinr : g_sinrHistory[imsi]) {
-                variance += (sinr - mean) * (sinr - mean);
-            }
-            variance /= g_sinrHistory[imsi].size() - 1;
-            sinrStdDev = std::sqrt(variance);
-        }
-        
         // Calcular métricas de QoS
-        const FlowMonitor::FlowStats& fs = flowStat.second;
         uint64_t lostPackets = fs.txPackets - fs.rxPackets;
         double packetLossRatio = (fs.txPackets > 0) ? 
                                 (100.0 * lostPackets / fs.txPackets) : 0.0;
@@ -633,176 +5068,254 @@ int main(int argc, char** argv)
             embbFlows++;
         }
         
-        // Calcular QoE Score (0-100)
-        double qoeScore = 100.0;
-        if (isEmbb) {
-            // Para eMBB: throughput y delay son críticos
-            if (throughput < 25.0) qoeScore *= (throughput / 25.0);
-            if (meanDelay > 20.0) qoeScore *= (20.0 / meanDelay);
-            if (packetLossRatio > 1.0) qoeScore *= (1.0 / packetLossRatio);
-        } else {
-            // Para URLLC: latencia ultra-baja es crítica
-            if (meanDelay > 5.0) qoeScore *= (5.0 / meanDelay);
-            if (packetLossRatio > 0.1) qoeScore *= (0.1 / packetLossRatio);
-            if (meanJitter > 2.0) qoeScore *= (2.0 / meanJitter);
-        }
-        qoeScore = std::max(0.0, std::min(100.0, qoeScore));
-        
-        // Calcular Reliability Score basado en consistencia del SINR
-        double reliabilityScore = 100.0;
-        if (chanMetrics.samples > 0) {
-            double sinrRange = chanMetrics.maxSinr - chanMetrics.minSinr;
-            if (sinrRange > 20.0) { // Penalizar alta variabilidad
-                reliabilityScore *= (20.0 / sinrRange);
-            }
-            if (avgSinr < 10.0) { // Penalizar SINR bajo
-                reliabilityScore *= (avgSinr / 10.0);
-            }
-        }
-        reliabilityScore = std::max(0.0, std::min(100.0, reliabilityScore));
+        flows.push_back({flowId, ueIdx, ueIpIfaces.GetAddress(ueIdx),
+                         fs.txPackets, fs.rxPackets, lostPackets});
+        scores.embb.push_back(isEmbb ? 1.0 : 0.0);
+        scores.throughput.push_back(throughput);
+        scores.delay.push_back(meanDelay);
+        scores.jitter.push_back(meanJitter);
+        scores.lossRatio.push_back(packetLossRatio);
+        scores.hasSinr.push_back((chanMetrics.samples > 0) ? 1.0 : 0.0);
+        scores.avgSinr.push_back(avgSinr);
+        scores.sinrRange.push_back(chanMetrics.MaxSinrDb() - chanMetrics.MinSinrDb());
+    });
+    
+    // QoE Score (0-100) y Reliability Score (consistencia del SINR) de todos los flujos
+    ComputeFlowScores(scores);
+    
+    // Segunda pasada: filas de salida y agregación por celda
+    for (std::size_t f = 0; f < flows.size(); ++f) {
+        const FlowRecord& flow = flows[f];
+        const ChannelMetrics& chanMetrics = g_ueMetrics.channel[flow.ueIdx];
+        double throughput = scores.throughput[f];
+        double meanDelay = scores.delay[f];
+        double meanJitter = scores.jitter[f];
         
         // Escribir datos del flujo
-        uint32_t cellId = g_imsiToCell[imsi];
-        double distance = g_imsiDistance[imsi];
-        std::string trafficType = isEmbb ? "eMBB" : "URLLC";
-        
-        flowOut << flowStat.first << "," << trafficType << "," << imsi << ","
-                << cellId << "," << std::fixed << std::setprecision(2) << distance << ","
-                << flowTuple.destinationAddress << ","
-                << std::setprecision(2) << avgSinr << ","
-                << chanMetrics.minSinr << "," << chanMetrics.maxSinr << ","
-                << sinrStdDev << ","
-                << fs.txPackets << "," << fs.rxPackets << "," << lostPackets << ","
-                << std::setprecision(4) << packetLossRatio << ","
-                << std::setprecision(3) << throughput << ","
-                << std::setprecision(3) << meanDelay << ","
-                << std::setprecision(3) << meanJitter << ","
-                << std::setprecision(1) << qoeScore << ","
-                << reliabilityScore << ",2\n"; // Numerología 2
+        uint32_t cellId = g_ueMetrics.servingCell[flow.ueIdx];
+        double distance = g_ueMetrics.distance[flow.ueIdx];
+        std::string trafficType = (scores.embb[f] > 0) ? "eMBB" : "URLLC";
+        const DDSketch& delaySketch = g_ueMetrics.delaySketch[flow.ueIdx];
+        const DDSketch& sinrSketch = g_ueMetrics.sinrSketch[flow.ueIdx];
+        
+        std::ostringstream dstAddr;
+        dstAddr << flow.dstAddr;
+        
+        flowOut.Int(flow.flowId).Text(trafficType).Int(g_ueMetrics.imsi[flow.ueIdx])
+               .Int(cellId).Real(distance)
+               .Text(dstAddr.str())
+               .Int(g_ueMetrics.traced[flow.ueIdx])
+               .Real(scores.avgSinr[f])
+               .Real(chanMetrics.MinSinrDb()).Real(chanMetrics.MaxSinrDb())
+               .Real(chanMetrics.SinrStdDev())
+               .Int(flow.txPackets).Int(flow.rxPackets).Int(flow.lostPackets)
+               .Real(scores.lossRatio[f])
+               .Real(throughput)
+               .Real(meanDelay)
+               .Real(meanJitter)
+               .Real(scores.qoe[f])
+               .Real(scores.reliability[f]).Int(2) // Numerología 2
+               .Real(delaySketch.Quantile(0.50))
+               .Real(delaySketch.Quantile(0.99))
+               .Real(delaySketch.Quantile(0.999))
+               .Real(SinrQuantileDb(sinrSketch, 0.05))
+               .Real(SinrQuantileDb(sinrSketch, 0.50));
+        
+        // Métricas del reproductor (cero salvo con --embbSource=abr)
+        AbrVideoSource::PlayerStats player;
+        if (abrSources[flow.ueIdx]) player = abrSources[flow.ueIdx]->GetStats();
+        flowOut.Int(player.rebuffers).Real(player.rebufferTime).Real(player.startupDelay)
+               .Int(player.switches).Real(player.meanBitrateMbps);
         
         // Actualizar estadísticas por celda
         CellSummary& summary = cellSummaries[cellId];
         summary.totalThroughput += throughput;
-        summary.totalTx += fs.txPackets;
-        summary.totalRx += fs.rxPackets;
-        summary.totalLost += lostPackets;
-        summary.totalSinr += avgSinr;
-        summary.sinrSamples++;
+        summary.totalTx += flow.txPackets;
+        summary.totalRx += flow.rxPackets;
+        summary.totalLost += flow.lostPackets;
+        if (scores.hasSinr[f] > 0) {
+            summary.totalSinr += scores.avgSinr[f];
+            summary.sinrSamples++;
+        }
         summary.qoe.totalDelay += meanDelay;
         summary.qoe.totalJitter += meanJitter;
-        summary.qoe.totalPackets += fs.rxPackets;
+        summary.qoe.totalPackets += flow.rxPackets;
         summary.qoe.sumThroughput += throughput;
         summary.qoe.flows++;
+        summary.delay.Merge(delaySketch);
+        summary.sinr.Merge(sinrSketch);
+        if (scores.embb[f] > 0) {
+            embbDelaySketch.Merge(delaySketch);
+        } else {
+            urllcDelaySketch.Merge(delaySketch);
+        }
         
+        ueThroughput[flow.ueIdx] += throughput;
         totalSystemThroughput += throughput;
     }
     
-    flowOut.close();
+    flowOut.Write(flowFile, outputFormat);
     
     // ==================== Estadísticas por celda ===========================
     std::string cellFile = outputDir + "/cell_stats_optimized_" + std::to_string(numCells) +
-                      "cell.csv";
-    std::ofstream cellOut(cellFile);
-    cellOut << "CellId,NumUEs,TotalThroughput(Mbps),SpectralEfficiency(bps/Hz),"
-            << "TxPackets,RxPackets,LostPackets,PacketLossRatio(%),"
-            << "AvgSINR(dB),AvgDelay(ms),AvgJitter(ms),"
-            << "CellQoEScore,CellReliability(%),LoadBalance(%)\n";
+                      "cell";
+    std::vector<MacCellCounters> macCells(numCells);
+    for (uint32_t cellId = 0; cellId < numCells; cellId++) {
+        macCells[cellId] = g_macCells[cellId].Since(g_macBaseline[cellId]);
+        cellSummaries[cellId].SetScheduling(macCells[cellId]);
+    }
+    WriteCellStats(cellFile, outputFormat, cellSummaries, g_ueMetrics.cellUeCount);
     
-    double maxCellThroughput = 0.0;
-    for (const auto& cellStat : cellSummaries) {
-        maxCellThroughput = std::max(maxCellThroughput, cellStat.second.totalThroughput);
+    // ==================== Estadísticas de planificación MAC ================
+    // Desde el arranque del tráfico: recursos, MCS (histograma completo) y HARQ
+    std::string macFile = outputDir + "/mac_stats_optimized_" + std::to_string(numCells) + "cell";
+    StatsTable macOut;
+    macOut.AddColumn("CellId", StatsTable::COL_INT64);
+    macOut.AddColumn("Slots", StatsTable::COL_INT64);
+    macOut.AddColumn("BusySlots(%)", StatsTable::COL_FLOAT64, 2);
+    macOut.AddColumn("UesPerSlot", StatsTable::COL_FLOAT64, 3);
+    macOut.AddColumn("UsedReg", StatsTable::COL_INT64);
+    macOut.AddColumn("AvailableReg", StatsTable::COL_INT64);
+    macOut.AddColumn("PrbUtilization(%)", StatsTable::COL_FLOAT64, 2);
+    macOut.AddColumn("SymbolUtilization(%)", StatsTable::COL_FLOAT64, 2);
+    macOut.AddColumn("TBs", StatsTable::COL_INT64);
+    macOut.AddColumn("TbBytes", StatsTable::COL_INT64);
+    macOut.AddColumn("AvgMcs", StatsTable::COL_FLOAT64, 2);
+    macOut.AddColumn("HarqAck", StatsTable::COL_INT64);
+    macOut.AddColumn("HarqNack", StatsTable::COL_INT64);
+    macOut.AddColumn("HarqNack(%)", StatsTable::COL_FLOAT64, 2);
+    macOut.AddColumn("BitsPerUsedRe", StatsTable::COL_FLOAT64, 3);
+    for (uint32_t m = 0; m < MacCellCounters::NUM_MCS; ++m) {
+        macOut.AddColumn("Mcs" + std::to_string(m), StatsTable::COL_INT64);
+    }
+    for (uint32_t cellId = 0; cellId < numCells; cellId++) {
+        const MacCellCounters& mac = macCells[cellId];
+        double busySlots = (mac.slots > 0) ? 100.0 * mac.busySlots / mac.slots : 0.0;
+        macOut.Int(cellId).Int(mac.slots).Real(busySlots).Real(mac.UesPerSlot())
+              .Int(mac.usedReg).Int(mac.availableReg)
+              .Real(mac.PrbUtilization()).Real(mac.SymbolUtilization())
+              .Int(mac.tbs).Int(mac.tbBytes).Real(mac.AvgMcs())
+              .Int(mac.harqAck).Int(mac.harqNack).Real(mac.HarqNackRatio())
+              .Real(mac.BitsPerUsedRe());
+        for (uint32_t m = 0; m < MacCellCounters::NUM_MCS; ++m) macOut.Int(mac.mcs[m]);
     }
+    macOut.Write(macFile, outputFormat);
+    
+    // ==================== Estadísticas de handover por celda ===============
+    // Por celda origen: intentos, resultados, ping-pong y cuantiles de la
+    // preparación y de la interrupción (desde el registro de eventos)
+    std::string handoverFile = outputDir + "/handover_stats_optimized_" + std::to_string(numCells) +
+                          "cell";
+    StatsTable handoverOut;
+    handoverOut.AddColumn("CellId", StatsTable::COL_INT64);
+    handoverOut.AddColumn("HoAttempts", StatsTable::COL_INT64);
+    handoverOut.AddColumn("HoSuccess", StatsTable::COL_INT64);
+    handoverOut.AddColumn("HoFailures", StatsTable::COL_INT64);
+    handoverOut.AddColumn("HoIncoming", StatsTable::COL_INT64);
+    handoverOut.AddColumn("PingPong", StatsTable::COL_INT64);
+    handoverOut.AddColumn("PreparationP50(ms)", StatsTable::COL_FLOAT64, 3);
+    handoverOut.AddColumn("PreparationP95(ms)", StatsTable::COL_FLOAT64, 3);
+    handoverOut.AddColumn("InterruptionP50(ms)", StatsTable::COL_FLOAT64, 3);
+    handoverOut.AddColumn("InterruptionP95(ms)", StatsTable::COL_FLOAT64, 3);
+    handoverOut.AddColumn("InterruptionP99(ms)", StatsTable::COL_FLOAT64, 3);
     
+    DDSketch handoverInterruption;
+    uint64_t pingPongCount = 0;
+    const std::vector<HandoverLog::CellStats>& handoverCells = g_handoverLog.GetCells();
     for (uint32_t cellId = 0; cellId < numCells; cellId++) {
-        const CellSummary& summary = cellSummaries[cellId];
-        
-        double packetLossRatio = (summary.totalTx > 0) ? 
-                                (100.0 * summary.totalLost / summary.totalTx) : 0.0;
-        double avgSinr = (summary.sinrSamples > 0) ? 
-                        summary.totalSinr / summary.sinrSamples : 0.0;
-        double avgDelay = (summary.qoe.flows > 0) ? 
-                         summary.qoe.totalDelay / summary.qoe.flows : 0.0;
-        double avgJitter = (summary.qoe.flows > 0) ? 
-                          summary.qoe.totalJitter / summary.qoe.flows : 0.0;
-        
-        // Eficiencia espectral (asumiendo 100 MHz de ancho de banda)
-        double spectralEfficiency = (summary.totalThroughput * 1e6) / 100e6; // bps/Hz
-        
-        // QoE Score por celda
-        double cellQoE = 100.0;
-        if (avgDelay > 10.0) cellQoE *= (10.0 / avgDelay);
-        if (packetLossRatio > 1.0) cellQoE *= (1.0 / packetLossRatio);
-        if (avgSinr < 15.0) cellQoE *= (avgSinr / 15.0);
-        cellQoE = std::max(0.0, std::min(100.0, cellQoE));
-        
-        // Reliability basada en pérdidas y SINR
-        double reliability = 100.0 - packetLossRatio * 10.0;
-        if (avgSinr < 10.0) reliability *= (avgSinr / 10.0);
-        reliability = std::max(0.0, std::min(100.0, reliability));
-        
-        // Load Balance (distribución equitativa del throughput)
-        double loadBalance = (maxCellThroughput > 0) ? 
-                            (summary.totalThroughput / maxCellThroughput * 100.0) : 0.0;
-        
-        cellOut << cellId << "," << g_cellUeCount[cellId] << ","
-                << std::fixed << std::setprecision(3) << summary.totalThroughput << ","
-                << std::setprecision(2) << spectralEfficiency << ","
-                << summary.totalTx << "," << summary.totalRx << "," << summary.totalLost << ","
-                << std::setprecision(4) << packetLossRatio << ","
-                << std::setprecision(2) << avgSinr << ","
-                << std::setprecision(3) << avgDelay << ","
-                << std::setprecision(3) << avgJitter << ","
-                << std::setprecision(1) << cellQoE << ","
-                << reliability << "," << loadBalance << "\n";
+        const HandoverLog::CellStats& ho = handoverCells[cellId];
+        handoverOut.Int(cellId).Int(ho.attempts).Int(ho.success).Int(ho.failures)
+                   .Int(ho.incoming).Int(ho.pingPong)
+                   .Real(ho.preparationMs.Quantile(0.50))
+                   .Real(ho.preparationMs.Quantile(0.95))
+                   .Real(ho.interruptionMs.Quantile(0.50))
+                   .Real(ho.interruptionMs.Quantile(0.95))
+                   .Real(ho.interruptionMs.Quantile(0.99));
+        handoverInterruption.Merge(ho.interruptionMs);
+        pingPongCount += ho.pingPong;
     }
     
-    cellOut.close();
+    handoverOut.Write(handoverFile, outputFormat);
     
     // ==================== Estadísticas del sistema =========================
     std::string systemFile = outputDir + "/system_stats_optimized_" + std::to_string(numCells) +
-                        "cell.csv";
-    std::ofstream systemOut(systemFile);
-    systemOut << "Metric,Value,Unit\n";
-    systemOut << "TotalSystemThroughput," << std::fixed << std::setprecision(3) 
-              << totalSystemThroughput << ",Mbps\n";
-    systemOut << "AvgThroughputPerCell," << (totalSystemThroughput / numCells) << ",Mbps\n";
-    systemOut << "AvgThroughputPerUE," << (totalSystemThroughput / numUEs) << ",Mbps\n";
-    
-    // Latencias promedio por tipo
-    double avgUrllcDelay = (urllcFlows > 0) ? (totalUrllcDelay / urllcFlows) : 0.0;
-    double avgEmbbDelay = (embbFlows > 0) ? (totalEmbbDelay / embbFlows) : 0.0;
-    systemOut << "AvgURLLCDelay," << std::setprecision(3) << avgUrllcDelay << ",ms\n";
-    systemOut << "AvgEmbbDelay," << avgEmbbDelay << ",ms\n";
-    
-    systemOut << "HandoverAttempts," << g_handoverAttempts << ",count\n";
-    systemOut << "HandoverSuccess," << g_handoverSuccess << ",count\n";
-    systemOut << "HandoverFailures," << g_handoverFailures << ",count\n";
+                        "cell";
+    SystemSummary system;
+    system.totalThroughput = totalSystemThroughput;
+    system.ueThroughput = ueThroughput;
+    system.avgUrllcDelay = (urllcFlows > 0) ? (totalUrllcDelay / urllcFlows) : 0.0;
+    system.avgEmbbDelay = (embbFlows > 0) ? (totalEmbbDelay / embbFlows) : 0.0;
+    system.urllcDelay = urllcDelaySketch;
+    system.embbDelay = embbDelaySketch;
+    system.handoverAttempts = g_handoverAttempts;
+    system.handoverSuccess = g_handoverSuccess;
+    system.handoverFailures = g_handoverFailures;
+    system.handoverPingPong = pingPongCount;
+    system.handoverInterruptionP50 = handoverInterruption.Quantile(0.50);
+    system.handoverInterruptionP95 = handoverInterruption.Quantile(0.95);
+    double avgUrllcDelay = system.avgUrllcDelay;
+    double avgEmbbDelay = system.avgEmbbDelay;
+    double systemSpectralEff = system.SpectralEfficiency(numCells);
+    double handoverSuccessRate = system.HandoverSuccessRate();
     
-    double handoverSuccessRate = (g_handoverAttempts > 0) ? 
-                                (100.0 * g_handoverSuccess / g_handoverAttempts) : 0.0;
-    systemOut << "HandoverSuccessRate," << std::setprecision(2) 
-              << handoverSuccessRate << ",%\n";
-    
-    // Calcular eficiencia espectral del sistema
-    double systemSpectralEff = (totalSystemThroughput * 1e6) / (100e6 * numCells);
-    systemOut << "SystemSpectralEfficiency," << std::setprecision(3) 
-              << systemSpectralEff << ",bps/Hz/cell\n";
+    StatsTable systemOut;
+    std::vector<SystemMetric> systemMetrics =
+        AddSystemStats(systemOut, system, config, simTime, layout.coverageAreaM2, propagationModel);
+    if (mobilityKind != UeMobilityDriver::STATIC) {
+        systemOut.Text("Mobility").Text(config.mobility).Text("type");
+        systemOut.Text("NearestCellChanges").Int(mobilityDriver.GetCellChanges()).Text("count");
+    }
+    if (loadAware) {
+        systemOut.Text("Association").Text(config.association).Text("type");
+        systemOut.Text("AssociationIterations").Int(associationIterations).Text("count");
+    }
+    if (rebalance) {
+        systemOut.Text("RebalanceSteps").Int(rebalancer.GetSteps()).Text("count");
+        systemOut.Text("RebalanceHandovers").Int(rebalancer.GetMoves()).Text("count");
+    }
+    if (config.autoWarmup) {
+        systemOut.Text("TrafficStartTime").Real(trafficStartTime, 3).Text("s");
+    }
+    if (config.autoStop) {
+        systemOut.Text("EffectiveSimTime").Real(effectiveSimTime, 3).Text("s");
+        systemOut.Text("Converged").Int(convergence.HasConverged() ? 1 : 0).Text("bool");
+        systemOut.Text("ConvergenceBatches").Int(convergence.GetBatches()).Text("count");
+        systemOut.Text("CIHalfWidthRatio").Real(convergence.GetHalfWidthRatio(), 4).Text("ratio");
+    }
     
-    // Densidad de usuarios
-    double totalArea = M_PI * std::pow(ISD * 1.2, 2) * numCells; // Aproximación
-    double userDensity = numUEs / (totalArea * 1e-6); // usuarios/km²
-    systemOut << "UserDensity," << std::setprecision(1) << userDensity << ",UE/km2\n";
+    systemOut.Write(systemFile, outputFormat);
     
-    systemOut << "ScenarioType," << scenarioName << ",type\n";
-    systemOut << "NumCells," << numCells << ",count\n";
-    systemOut << "NumUEs," << numUEs << ",count\n";
-    systemOut << "InterSiteDistance," << ISD << ",m\n";
-    systemOut << "SimulationTime," << simTime << ",s\n";
-    systemOut << "Numerology,2,30kHz_SCS\n";
-    systemOut << "UeTxPower," << ueTxPower << ",dBm\n";
-    systemOut << "PropagationModel," << propagationModel << ",type\n";
+    if (config.autoStop) {
+        systemMetrics.push_back({"EffectiveSimTime", effectiveSimTime, "s"});
+    }
+    if (rebalance) {
+        systemMetrics.push_back({"RebalanceHandovers", static_cast<double>(rebalancer.GetMoves()), "count"});
+    }
     
-    systemOut.close();
+    // ==================== Sketches de cuantiles ============================
+    // Cubos de cada sketch por celda y por sistema, para fusionar réplicas en la
+    // consolidación sin perder la garantía de error relativo
+    std::string sketchFile = outputDir + "/delay_sketches_optimized_" + std::to_string(numCells) +
+                        "cell.csv";
+    StatsTable sketchOut;
+    sketchOut.AddColumn("Level", StatsTable::COL_TEXT, 0, 8);
+    sketchOut.AddColumn("Id", StatsTable::COL_INT64);
+    sketchOut.AddColumn("Metric", StatsTable::COL_TEXT, 0, 16);
+    sketchOut.AddColumn("Gamma", StatsTable::COL_FLOAT64, 10);
+    sketchOut.AddColumn("Count", StatsTable::COL_INT64);
+    sketchOut.AddColumn("Bins", StatsTable::COL_TEXT);
+    auto addSketch = [&](const std::string& level, uint32_t id, const std::string& metric,
+                         const DDSketch& sketch) {
+        sketchOut.Text(level).Int(id).Text(metric).Real(sketch.GetGamma())
+                 .Int(sketch.GetCount()).Text(sketch.Encode());
+    };
+    for (uint32_t cellId = 0; cellId < numCells; cellId++) {
+        addSketch("cell", cellId, "Delay(ms)", cellSummaries[cellId].delay);
+        addSketch("cell", cellId, "SinrLinear", cellSummaries[cellId].sinr);
+    }
+    addSketch("system", 0, "URLLCDelay(ms)", urllcDelaySketch);
+    addSketch("system", 0, "EmbbDelay(ms)", embbDelaySketch);
+    sketchOut.WriteCsv(sketchFile);
     
     // ==================== Archivo de configuración =========================
     std::string configFile = outputDir + "/simulation_config_optimized_" + std::to_string(numCells) +
@@ -839,11 +5352,121 @@ int main(int argc, char** argv)
     configOut << "Frecuencia: 3.5 GHz (FR1)\n";
     configOut << "Ancho de banda: 100 MHz\n";
     configOut << "Scheduler: " << scheduler << "\n";
-    configOut << "Algoritmo HO: " << hoAlgorithm << "\n";
+    configOut << "Algoritmo HO: " << (rebalance ? "NoOp (rebalanceo)" : hoAlgorithm) << "\n";
+    configOut << "Asociación: " << config.association;
+    if (loadAware) {
+        configOut << " (CIO máx " << config.cioMax << " dB, paso " << config.cioStep
+                  << " dB, tolerancia " << config.loadTolerance;
+        if (fromSnapshot) configOut << ", desde snapshot)";
+    }
+    if (loadAware && !fromSnapshot) {
+        configOut << ", " << associationIterations << " iteraciones)\n";
+        configOut << "CIO por celda (dB):";
+        for (uint32_t c = 0; c < numCells; ++c) configOut << " " << association.GetCio(c);
+    }
+    configOut << "\n";
+    if (rebalance) {
+        configOut << "Rebalanceo: cada " << config.rebalanceInterval << " s, umbral PRB "
+                  << config.rebalanceThreshold << " %, hasta " << config.rebalanceMaxMoves
+                  << " UEs por celda (" << rebalancer.GetMoves() << " handovers)\n";
+    }
     configOut << "Tiempo simulación: " << simTime << " s\n";
     configOut << "Semilla RNG: " << rngSeed << "\n";
+    configOut << "Run RNG: " << run << "\n";
+    configOut << "Formato de salida: " << outputFormat << "\n";
+    configOut << "Muestreo SINR: " << config.sinrTracePolicy;
+    if (config.sinrTracePolicy == "nth") configOut << " (1 de cada " << config.sinrTraceN << " TBs)";
+    if (config.sinrTracePolicy == "reservoir") configOut << " (" << config.sinrReservoirSize << " por UE)";
+    configOut << "\n";
+    configOut << "UEs trazados: " << config.traceUes << " (" << g_ueMetrics.GetTracedCount() << " de "
+              << numUEs << ")\n";
+    configOut << "Intervalo KPI: " << config.kpiInterval << " s\n";
+    configOut << "Intervalo de la serie MAC: " << config.macStatsInterval << " s\n";
+    configOut << "Warm-up automático: " << (config.autoWarmup ? "sí" : "no") << "\n";
+    if (fromSnapshot) {
+        configOut << "Snapshot de asociación: " << SnapshotPath(config.loadSnapshot, config, run)
+                  << " (RRC ideal, tráfico desde " << appStartTime << " s)\n";
+    }
+    configOut << "Movilidad: " << config.mobility;
+    if (mobilityKind == UeMobilityDriver::TRACE) configOut << " (" << config.mobilityTrace << ")";
+    if (mobilityKind == UeMobilityDriver::RANDOM_WAYPOINT || mobilityKind == UeMobilityDriver::LINEAR) {
+        configOut << " (" << config.ueSpeed << " m/s)";
+    }
+    if (mobilityKind != UeMobilityDriver::STATIC) configOut << ", tick " << config.mobilityTick << " s";
+    configOut << "\n";
+    configOut << "Contabilidad de flujos: " << config.flowAccounting << "\n";
+    configOut << "Fuente eMBB: " << config.embbSource;
+    if (abrVideo) {
+        configOut << " (escalera " << config.abrLadder << " Mb/s, segmento " << config.abrSegment
+                  << " s, reserva " << config.abrReservoir << " s, colchón " << config.abrCushion
+                  << " s, buffer máximo " << config.abrMaxBuffer << " s)";
+    }
+    configOut << "\n";
+    configOut << "Cliente URLLC: ";
+    if (config.urllcAggregate) {
+        configOut << "agregado (un cliente multi-destino)\n";
+    } else {
+        configOut << "UdpClient por UE\n";
+    }
+    if (channelCache) {
+        configOut << "Caché de condición de canal: " << channelCacheFile << "\n";
+    }
+    if (!config.saveSnapshot.empty()) {
+        configOut << "Snapshot guardado: " << SnapshotPath(config.saveSnapshot, config, run) << "\n";
+    }
+    if (config.autoStop) {
+        configOut << "Parada automática: lotes de " << config.batchLength << " s, mínimo "
+                  << config.minBatches << ", IC95 relativo < " << config.ciTarget << "\n";
+    }
     configOut.close();
     
+    // ==================== Perfilado ========================================
+    profiler.End();
+    std::string perfFile = outputDir + "/perf_stats_optimized_" + std::to_string(numCells) +
+                      "cell.csv";
+    double runWallTime = profiler.Get("SimulatorRun");
+    StatsTable perfOut;
+    perfOut.AddColumn("Metric", StatsTable::COL_TEXT, 0, 32);
+    perfOut.AddColumn("Value", StatsTable::COL_FLOAT64, 3);
+    perfOut.AddColumn("Unit", StatsTable::COL_TEXT, 0, 16);
+    for (const PhaseProfiler::Phase& phase : profiler.GetPhases()) {
+        perfOut.Text("WallTime" + phase.name).Real(phase.seconds).Text("s");
+    }
+    perfOut.Text("WallTimeTotal").Real(profiler.GetTotal()).Text("s");
+    perfOut.Text("SimulatorEvents").Int(simulatorEvents).Text("count");
+    perfOut.Text("EventsPerWallSecond")
+           .Real((runWallTime > 0) ? simulatorEvents / runWallTime : 0.0, 0).Text("events/s");
+    perfOut.Text("SimSecondsPerWallSecond")
+           .Real((runWallTime > 0) ? effectiveSimTime / runWallTime : 0.0, 4).Text("ratio");
+    uint64_t sinrSamplesUsed = 0;
+    for (const ChannelMetrics& chan : g_ueMetrics.channel) sinrSamplesUsed += chan.samples;
+    perfOut.Text("TracedUes").Int(g_ueMetrics.GetTracedCount()).Text("count");
+    perfOut.Text("SinrCallbacks").Int(g_callbackCounts.sinr).Text("count");
+    perfOut.Text("SinrSamplesUsed").Int(sinrSamplesUsed).Text("count");
+    perfOut.Text("RsrpCallbacks").Int(g_callbackCounts.rsrp).Text("count");
+    perfOut.Text("RsrqCallbacks").Int(g_callbackCounts.rsrq).Text("count");
+    perfOut.Text("HandoverCallbacks").Int(g_callbackCounts.handover).Text("count");
+    perfOut.Text("MacCallbacks").Int(g_callbackCounts.mac).Text("count");
+    perfOut.Text("HandoverLogStalls").Int(g_handoverLog.GetStalls()).Text("count");
+    perfOut.Text("HandoverUnknownCells").Int(g_handoverLog.GetUnknownCells()).Text("count");
+    if (config.profileCallbacks) {
+        perfOut.Text("SinrCallbackTime").Real(g_callbackCounts.sinrNs * 1e-9, 6).Text("s");
+        perfOut.Text("RsrpCallbackTime").Real(g_callbackCounts.rsrpNs * 1e-9, 6).Text("s");
+        perfOut.Text("RsrqCallbackTime").Real(g_callbackCounts.rsrqNs * 1e-9, 6).Text("s");
+        perfOut.Text("HandoverCallbackTime").Real(g_callbackCounts.handoverNs * 1e-9, 6).Text("s");
+        perfOut.Text("MacCallbackTime").Real(g_callbackCounts.macNs * 1e-9, 6).Text("s");
+    }
+    if (mobilityKind != UeMobilityDriver::STATIC) {
+        perfOut.Text("MobilityTicks").Int(mobilityDriver.GetTicks()).Text("count");
+        perfOut.Text("MobilityIndexQueries").Int(mobilityDriver.GetIndexQueries()).Text("count");
+    }
+    if (channelCache) {
+        perfOut.Text("ChannelCacheHits").Int(channelCache->GetHits()).Text("count");
+        perfOut.Text("ChannelCacheMisses").Int(channelCache->GetMisses()).Text("count");
+    }
+    perfOut.Text("PeakRss").Real(PeakRssMb(), 1).Text("MB");
+    perfOut.WriteCsv(perfFile);
+    
     // ==================== Resumen en consola ===============================
     std::cout << "\n========== SIMULACIÓN COMPLETADA - OPTIMIZACIONES MÍNIMAS ==========\n";
     std::cout << "Escenario: " << numCells << " celdas " 
@@ -860,6 +5483,15 @@ int main(int argc, char** argv)
               << systemSpectralEff << " bps/Hz/celda\n";
     std::cout << "Tasa éxito handover: " << std::setprecision(1) 
               << handoverSuccessRate << "%\n";
+    if (config.autoWarmup) {
+        std::cout << "Inicio del tráfico: " << std::setprecision(3) << trafficStartTime << " s"
+                  << (warmup.IsReady() ? "" : " (sin warm-up)") << "\n";
+    }
+    if (config.autoStop) {
+        std::cout << "Parada: " << std::setprecision(3) << effectiveSimTime << " s de " << simTime
+                  << " s (" << (convergence.HasConverged() ? "convergencia" : "sin convergencia")
+                  << ", " << convergence.GetBatches() << " lotes)\n";
+    }
     
     std::cout << "\n=== CAMBIOS APLICADOS (compatibles) ===\n";
     std::cout << "✓ Numerología: 2 (30 kHz vs 15 kHz)\n";
@@ -869,13 +5501,958 @@ int main(int argc, char** argv)
     std::cout << "✓ Handover: umbrales optimizados\n";
     
     std::cout << "\n=== ARCHIVOS GENERADOS ===\n";
-    std::cout << "• " << flowFile << "\n";
-    std::cout << "• " << cellFile << "\n";
-    std::cout << "• " << systemFile << "\n";
+    for (const std::string& table : {flowFile, cellFile, macFile, handoverFile, systemFile}) {
+        if (outputFormat != "binary") std::cout << "• " << table << ".csv\n";
+        if (outputFormat != "csv") std::cout << "• " << table << ".nrcb\n";
+    }
+    if (config.kpiInterval > 0) std::cout << "• " << kpiFile << "\n";
+    if (config.macStatsInterval > 0) std::cout << "• " << macSeriesFile << "\n";
+    std::cout << "• " << sketchFile << "\n";
+    std::cout << "• " << handoverEventsFile << " (" << g_handoverLog.GetRecords() << " eventos)\n";
     std::cout << "• " << configFile << "\n";
+    std::cout << "• " << perfFile << " (Run: " << std::setprecision(1) << runWallTime
+              << " s de " << profiler.GetTotal() << " s)\n";
     std::cout << "====================================================================\n\n";
     
     Simulator::Destroy();
+    return systemMetrics;
+}
+
+// ==================== Modo rápido (abstracción analítica) ==================
+// --fidelity=fast: sin pila NR ni simulador de eventos. Reutiliza la
+// disposición de celdas, la distribución de UEs y la pérdida por trayecto 3GPP
+// del escenario (con su condición de canal y shadowing) y calcula el SINR de
+// bajada de cada UE con la interferencia de todas las celdas con UEs a plena
+// carga. El SINR se traduce a eficiencia espectral con la tabla de MCS 64QAM
+// (TS 38.214, tabla 5.1.3.1-1) y una curva BLER logística por MCS; el tiempo
+// de cada celda se reparte max-min justo entre las demandas de sus UEs.
+class FastLinkModel {
+public:
+    // Umbral de cada MCS al 10% de BLER: Shannon con un margen de implementación
+    static constexpr double SHANNON_GAP_DB = 2.0;
+    static constexpr double BLER_SLOPE = 1.5; // 1/dB
+    static constexpr uint32_t NUM_MCS = 29;
+    
+    static double SpectralEfficiency(uint32_t mcs)
+    {
+        static const double table[NUM_MCS] = {
+            0.2344, 0.3066, 0.3770, 0.4902, 0.6016, 0.7402, 0.8770, 1.0273, 1.1758, 1.3262,
+            1.3281, 1.4766, 1.6953, 1.9141, 2.1602, 2.4063, 2.5703, 2.5664, 2.7305, 3.0293,
+            3.3223, 3.6094, 3.9023, 4.2129, 4.5234, 4.8164, 5.1152, 5.3320, 5.5547};
+        return table[mcs];
+    }
+    
+    static double Bler(uint32_t mcs, double sinrDb)
+    {
+        double threshold = 10.0 * std::log10(std::pow(2.0, SpectralEfficiency(mcs)) - 1.0) +
+                           SHANNON_GAP_DB;
+        return 1.0 / (1.0 + std::exp(BLER_SLOPE * (sinrDb - threshold) + std::log(9.0)));
+    }
+    
+    // AMC ideal: MCS con mayor eficiencia útil SE·(1 - BLER)
+    static uint32_t SelectMcs(double sinrDb)
+    {
+        uint32_t best = 0;
+        double bestGoodput = 0.0;
+        for (uint32_t mcs = 0; mcs < NUM_MCS; ++mcs) {
+            double goodput = SpectralEfficiency(mcs) * (1.0 - Bler(mcs, sinrDb));
+            if (goodput > bestGoodput) {
+                bestGoodput = goodput;
+                best = mcs;
+            }
+        }
+        return best;
+    }
+};
+
+// Reparto max-min justo del tiempo de una celda: cada UE pide demand/rate y
+// los que piden menos que la parte igual ceden el resto. Devuelve la fracción
+// de tiempo de cada UE (suma <= 1).
+static std::vector<double>
+FastTimeShares(const std::vector<double>& demandBps, const std::vector<double>& rateBps)
+{
+    uint32_t n = demandBps.size();
+    std::vector<double> need(n), share(n, 0.0);
+    std::vector<uint32_t> order(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        need[i] = (rateBps[i] > 0) ? demandBps[i] / rateBps[i] : std::numeric_limits<double>::max();
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&need](uint32_t a, uint32_t b) { return need[a] < need[b]; });
+    double remaining = 1.0;
+    for (uint32_t k = 0; k < n; ++k) {
+        double equal = remaining / (n - k);
+        uint32_t i = order[k];
+        share[i] = std::min(need[i], equal);
+        remaining -= share[i];
+    }
+    return share;
+}
+
+static std::vector<SystemMetric>
+RunFastReplication(const SimulationConfig& config, uint64_t run, const std::string& outputDir)
+{
+    const uint32_t numCells = config.numCells;
+    const uint32_t numUEs = config.numUEs;
+    const bool denseScenario = config.denseScenario;
+    const double measureTime = config.simTime - config.appStartTime;
+    
+    // Supuestos del modelo: banda de 100 MHz con 273 PRB de 30 kHz, un símbolo
+    // de control por slot de 14 y slot de 0.25 ms (numerología 2)
+    const double usefulBandwidthHz = 273 * 12 * 30e3 * 13.0 / 14.0;
+    const double slotMs = 0.25;
+    const double noiseDbm = -174.0 + 10.0 * std::log10(100e6) + config.fastNoiseFigure;
+    const double harqRttSlots = 8.0;
+    const double coreDelayMs = 2.0;               // red troncal hasta el gNB
+    const double rlcBufferBits = 10 * 1024 * 8.0; // buffer de transmisión RLC
+    
+    std::filesystem::create_directories(outputDir);
+    PhaseProfiler profiler;
+    profiler.Begin("Topology");
+    
+    NodeContainer gnbNodes, ueNodes;
+    gnbNodes.Create(numCells);
+    ueNodes.Create(numUEs);
+    
+    ScenarioType scenario = denseScenario ? DENSE_URBAN : SPARSE_SUBURBAN;
+    CellLayout layout = (config.layout == "hex") ?
+        CreateHexGridLayout(config.hexTiers, config.ISD, config.gnbHeight, config.sectors,
+                            config.wrapAround) :
+        CreateOptimizedCellLayout(numCells, config.ISD, config.gnbHeight, scenario);
+    MobilityHelper mobility;
+    mobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    mobility.SetPositionAllocator(layout.CreatePositionAllocator());
+    mobility.Install(gnbNodes);
+    mobility.Install(ueNodes);
+    DistributeUsersOptimized(ueNodes, layout, scenario, config.ISD, config.ueHeight);
+    
+    CellSpatialIndex cellIndex;
+    cellIndex.Build(layout);
+    
+    // Misma pérdida por trayecto y condición de canal que la réplica completa
+    std::string propagationModel = denseScenario ? "UMa" : "RMa";
+    Ptr<ThreeGppPropagationLossModel> pathloss;
+    Ptr<ChannelConditionModel> condition;
+    if (denseScenario) {
+        pathloss = CreateObject<ThreeGppUmaPropagationLossModel>();
+        condition = CreateObject<ThreeGppUmaChannelConditionModel>();
+    } else {
+        pathloss = CreateObject<ThreeGppRmaPropagationLossModel>();
+        condition = CreateObject<ThreeGppRmaChannelConditionModel>();
+    }
+    pathloss->SetAttribute("Frequency", DoubleValue(3.5e9));
+    pathloss->SetChannelConditionModel(condition);
+    
+    // El modelo analítico ocupa el lugar de Simulator::Run() en el latido: no hay
+    // eventos, así que publica running al entrar y postprocessing al salir
+    profiler.Begin("Analytic");
+    g_progress.Start(config.statusInterval);
+    uint32_t numEmbbUEs = static_cast<uint32_t>(config.embbRatio * numUEs);
+    std::vector<uint32_t> servingCell(numUEs);
+    std::vector<uint32_t> cellUeCount(numCells, 0);
+    for (uint32_t i = 0; i < numUEs; ++i) {
+        Vector uePos = ueNodes.Get(i)->GetObject<MobilityModel>()->GetPosition();
+        double distance = 0.0;
+        servingCell[i] = cellIndex.Nearest(uePos, distance);
+    }
+    
+    // Asociación por carga con las mismas RSRP estimadas que la réplica completa
+    if (config.association == "rsrp-cio") {
+        uint32_t candidates = std::min(numCells, std::max(std::min(config.neighbourK, numCells),
+                                                          3 * layout.CellsPerSite()));
+        LoadAwareAssociation association;
+        association.Setup(numCells, numUEs, candidates, config.cioMax, config.cioStep,
+                          config.loadTolerance);
+        double embbDemandBps = EmbbPerUeRateBps(denseScenario, numEmbbUEs);
+        double urllcDemandBps = (100 + IPV4_UDP_OVERHEAD) * 8.0 /
+            ((config.urllcInterval > 0) ? config.urllcInterval : (denseScenario ? 0.0005 : 0.001));
+        for (uint32_t i = 0; i < numUEs; ++i) {
+            Ptr<MobilityModel> ueMobility = ueNodes.Get(i)->GetObject<MobilityModel>();
+            Vector uePos = ueMobility->GetPosition();
+            std::vector<CellSpatialIndex::Neighbour> neighbours = cellIndex.KNearest(uePos, candidates);
+            for (uint32_t k = 0; k < neighbours.size(); ++k) {
+                uint32_t cell = neighbours[k].cell;
+                Ptr<MobilityModel> gnbMobility = gnbNodes.Get(cell)->GetObject<MobilityModel>();
+                double rsrpDbm = pathloss->CalcRxPower(config.gnbTxPower, gnbMobility, ueMobility) +
+                                 layout.ElementGainDb(uePos, cell, neighbours[k].image);
+                association.SetCandidate(i, k, cell, rsrpDbm);
+            }
+            association.SetDemand(i, (i < numEmbbUEs) ? embbDemandBps : urllcDemandBps);
+        }
+        association.Solve();
+        for (uint32_t i = 0; i < numUEs; ++i) servingCell[i] = association.GetServing(i);
+    }
+    for (uint32_t i = 0; i < numUEs; ++i) cellUeCount[servingCell[i]]++;
+    
+    // SINR de bajada: la celda servidora con la ganancia de conformación, el
+    // resto de celdas con UEs como interferencia sin ella
+    std::vector<double> sinrDb(numUEs);
+    for (uint32_t i = 0; i < numUEs; ++i) {
+        Ptr<MobilityModel> ueMobility = ueNodes.Get(i)->GetObject<MobilityModel>();
+        Vector uePos = ueMobility->GetPosition();
+        double signalMw = 0.0;
+        double interferenceMw = 0.0;
+        for (uint32_t c = 0; c < numCells; ++c) {
+            if (c != servingCell[i] && cellUeCount[c] == 0) continue;
+            Ptr<MobilityModel> gnbMobility = gnbNodes.Get(c)->GetObject<MobilityModel>();
+            double rxDbm = pathloss->CalcRxPower(config.gnbTxPower, gnbMobility, ueMobility) +
+                           layout.ElementGainDb(uePos, c, layout.cells[c].position);
+            if (c == servingCell[i]) {
+                signalMw = std::pow(10.0, (rxDbm + config.fastBeamGain) / 10.0);
+            } else {
+                interferenceMw += std::pow(10.0, rxDbm / 10.0);
+            }
+        }
+        double noiseMw = std::pow(10.0, noiseDbm / 10.0);
+        sinrDb[i] = 10.0 * std::log10(signalMw / (noiseMw + interferenceMw));
+    }
+    
+    // Demanda ofrecida en capa IP (cabeceras IPv4 + UDP incluidas)
+    uint64_t perUeRateBps = EmbbPerUeRateBps(denseScenario, numEmbbUEs);
+    double urllcInterval = (config.urllcInterval > 0) ? config.urllcInterval :
+                           (denseScenario ? 0.0005 : 0.001);
+    double embbPacketBits = (1400 + IPV4_UDP_OVERHEAD) * 8.0;
+    double urllcPacketBits = (100 + IPV4_UDP_OVERHEAD) * 8.0;
+    double embbDemandBps = perUeRateBps * (1400.0 + IPV4_UDP_OVERHEAD) / 1400.0;
+    if (config.embbSource == "abr") {
+        std::vector<double> ladder;
+        AbrVideoSource::ParseLadder(config.abrLadder, ladder);
+        embbDemandBps = ladder.back() * (1400.0 + IPV4_UDP_OVERHEAD) / 1400.0;
+    }
+    double urllcDemandBps = urllcPacketBits / urllcInterval;
+    
+    // Tasa de cada UE con la celda entera y reparto del tiempo por celda. Con
+    // pf, la diversidad multiusuario sobre Rayleigh multiplica el SINR de los
+    // UEs que compiten por la celda (saturados) por el número armónico H_N.
+    std::vector<std::vector<uint32_t>> cellUes(numCells);
+    for (uint32_t i = 0; i < numUEs; ++i) cellUes[servingCell[i]].push_back(i);
+    std::vector<double> rateBps(numUEs), shares(numUEs), bler(numUEs), demandBps(numUEs);
+    std::vector<uint32_t> mcsIndex(numUEs);
+    std::vector<double> cellLoad(numCells, 0.0);
+    for (uint32_t c = 0; c < numCells; ++c) {
+        const std::vector<uint32_t>& ues = cellUes[c];
+        std::vector<double> demand(ues.size()), rate(ues.size());
+        auto computeRates = [&](double diversityGainDb) {
+            for (uint32_t k = 0; k < ues.size(); ++k) {
+                uint32_t i = ues[k];
+                double effectiveSinr = sinrDb[i] + diversityGainDb;
+                uint32_t mcs = FastLinkModel::SelectMcs(effectiveSinr);
+                mcsIndex[i] = mcs;
+                bler[i] = FastLinkModel::Bler(mcs, effectiveSinr);
+                rate[k] = usefulBandwidthHz * FastLinkModel::SpectralEfficiency(mcs) * (1.0 - bler[i]);
+                demand[k] = (i < numEmbbUEs) ? embbDemandBps : urllcDemandBps;
+            }
+        };
+        computeRates(0.0);
+        std::vector<double> share = FastTimeShares(demand, rate);
+        if (config.fastShare == "pf") {
+            uint32_t saturated = 0;
+            for (uint32_t k = 0; k < ues.size(); ++k) {
+                if (share[k] * rate[k] < demand[k] * (1.0 - 1e-9)) saturated++;
+            }
+            double harmonic = 0.0;
+            for (uint32_t n = 1; n <= saturated; ++n) harmonic += 1.0 / n;
+            if (saturated > 1) {
+                computeRates(10.0 * std::log10(harmonic));
+                share = FastTimeShares(demand, rate);
+            }
+        }
+        for (uint32_t k = 0; k < ues.size(); ++k) {
+            rateBps[ues[k]] = rate[k];
+            shares[ues[k]] = share[k];
+            demandBps[ues[k]] = demand[k];
+            cellLoad[c] += share[k];
+        }
+    }
+    
+    // Throughput entregado, pérdidas y retardo (M/D/1 por celda para los UEs
+    // servidos; los saturados llenan el buffer RLC y pierden el exceso)
+    std::vector<CellSummary> cellSummaries(numCells);
+    SystemSummary system;
+    system.ueThroughput.assign(numUEs, 0.0);
+    uint32_t urllcFlows = 0, embbFlows = 0;
+    for (uint32_t i = 0; i < numUEs; ++i) {
+        bool isEmbb = (i < numEmbbUEs);
+        uint32_t cell = servingCell[i];
+        double deliveredBps = shares[i] * rateBps[i];
+        bool saturated = (deliveredBps < demandBps[i] * (1.0 - 1e-9));
+        double packetBits = isEmbb ? embbPacketBits : urllcPacketBits;
+        double residualLoss = std::pow(bler[i], 4); // tras 3 retransmisiones HARQ
+        double loss = saturated ? 1.0 - deliveredBps / demandBps[i] : residualLoss;
+        
+        double delayMs;
+        if (saturated) {
+            delayMs = std::min(rlcBufferBits / std::max(deliveredBps, 1.0), measureTime / 2.0) * 1000.0;
+        } else {
+            double serviceMs = packetBits / rateBps[i] * 1000.0;
+            double rho = std::min(cellLoad[cell], 0.99);
+            delayMs = serviceMs * (1.0 + rho / (2.0 * (1.0 - rho))) +
+                      slotMs * (1.5 + bler[i] * harqRttSlots);
+        }
+        delayMs += coreDelayMs;
+        
+        uint64_t txPackets = static_cast<uint64_t>(demandBps[i] * measureTime / packetBits);
+        uint64_t rxPackets = static_cast<uint64_t>(txPackets * (1.0 - loss));
+        double throughputMbps = deliveredBps * (1.0 - (saturated ? 0.0 : residualLoss)) / 1e6;
+        
+        CellSummary& summary = cellSummaries[cell];
+        summary.totalThroughput += throughputMbps;
+        summary.totalTx += txPackets;
+        summary.totalRx += rxPackets;
+        summary.totalLost += txPackets - rxPackets;
+        summary.totalSinr += sinrDb[i];
+        summary.sinrSamples++;
+        summary.qoe.totalDelay += delayMs;
+        summary.qoe.totalPackets += rxPackets;
+        summary.qoe.sumThroughput += throughputMbps;
+        summary.qoe.flows++;
+        summary.delay.Add(delayMs);
+        summary.sinr.Add(std::pow(10.0, sinrDb[i] / 10.0));
+        summary.avgMcs += shares[i] * mcsIndex[i];
+        summary.harqNack += shares[i] * bler[i];
+        summary.bitsPerUsedRe += shares[i] * FastLinkModel::SpectralEfficiency(mcsIndex[i]);
+        
+        system.totalThroughput += throughputMbps;
+        system.ueThroughput[i] = throughputMbps;
+        if (isEmbb) {
+            system.avgEmbbDelay += delayMs;
+            system.embbDelay.Add(delayMs);
+            embbFlows++;
+        } else {
+            system.avgUrllcDelay += delayMs;
+            system.urllcDelay.Add(delayMs);
+            urllcFlows++;
+        }
+    }
+    if (urllcFlows > 0) system.avgUrllcDelay /= urllcFlows;
+    if (embbFlows > 0) system.avgEmbbDelay /= embbFlows;
+    
+    // Planificación equivalente: la ocupación es el tiempo repartido y el MCS,
+    // el BLER (NACK de primera transmisión) y los bits por RE se ponderan por
+    // el tiempo de cada UE
+    for (uint32_t c = 0; c < numCells; ++c) {
+        CellSummary& summary = cellSummaries[c];
+        if (cellLoad[c] <= 0) continue;
+        summary.prbUtilization = std::min(cellLoad[c], 1.0) * 100.0;
+        summary.avgMcs /= cellLoad[c];
+        summary.harqNack *= 100.0 / cellLoad[c];
+        summary.bitsPerUsedRe /= cellLoad[c];
+    }
+    
+    g_progress.EndReplication();
+    profiler.Begin("PostProcessing");
+    std::string suffix = std::to_string(numCells) + "cell";
+    std::string cellFile = outputDir + "/cell_stats_optimized_" + suffix;
+    WriteCellStats(cellFile, config.outputFormat, cellSummaries, cellUeCount);
+    
+    std::string systemFile = outputDir + "/system_stats_optimized_" + suffix;
+    StatsTable systemOut;
+    std::vector<SystemMetric> systemMetrics =
+        AddSystemStats(systemOut, system, config, config.simTime, layout.coverageAreaM2,
+                       propagationModel);
+    systemOut.Text("Fidelity").Text("fast").Text("type");
+    systemOut.Write(systemFile, config.outputFormat);
+    
+    std::string configFile = outputDir + "/simulation_config_optimized_" + suffix + ".txt";
+    std::ofstream configOut(configFile);
+    configOut << "=== MODO RÁPIDO (abstracción analítica) ===\n";
+    configOut << "Número de celdas: " << numCells << "\n";
+    configOut << "Número de UEs: " << numUEs << "\n";
+    configOut << "Proporción eMBB: " << config.embbRatio << "\n";
+    configOut << "Escenario: " << (denseScenario ? "Denso urbano" : "Disperso suburbano") << "\n";
+    configOut << "Distancia inter-sitio: " << config.ISD << " m\n";
+    configOut << "Propagación: " << propagationModel << " (3GPP, con shadowing)\n";
+    configOut << "Ganancia de conformación: " << config.fastBeamGain << " dB\n";
+    configOut << "Figura de ruido UE: " << config.fastNoiseFigure << " dB\n";
+    configOut << "Reparto: " << config.fastShare << "\n";
+    configOut << "Fuente eMBB: " << config.embbSource << "\n";
+    configOut << "Semilla RNG: " << config.rngSeed << "\n";
+    configOut << "Run RNG: " << run << "\n";
+    configOut.close();
+    
+    profiler.End();
+    std::string perfFile = outputDir + "/perf_stats_optimized_" + suffix + ".csv";
+    StatsTable perfOut;
+    perfOut.AddColumn("Metric", StatsTable::COL_TEXT, 0, 32);
+    perfOut.AddColumn("Value", StatsTable::COL_FLOAT64, 6);
+    perfOut.AddColumn("Unit", StatsTable::COL_TEXT, 0, 16);
+    for (const PhaseProfiler::Phase& phase : profiler.GetPhases()) {
+        perfOut.Text("WallTime" + phase.name).Real(phase.seconds).Text("s");
+    }
+    perfOut.Text("WallTimeTotal").Real(profiler.GetTotal()).Text("s");
+    perfOut.Text("PeakRss").Real(PeakRssMb(), 1).Text("MB");
+    perfOut.WriteCsv(perfFile);
+    
+    std::cout << "Modo rápido: " << numCells << " celdas, " << numUEs << " UEs, throughput "
+              << std::fixed << std::setprecision(2) << system.totalThroughput << " Mbps en "
+              << std::setprecision(3) << profiler.GetTotal() * 1000.0 << " ms\n";
+    
+    Simulator::Destroy();
+    return systemMetrics;
+}
+
+// ==================== Mapa de cobertura (radio map) ========================
+// --radioMap=<base>: evalúa RSRP de mejor servidor y SINR de bajada sobre una
+// rejilla regular que cubre el layout, sin crear la pila NR. Usa el mismo
+// modelo 3GPP de pérdida por trayecto que la réplica (UMa/RMa) sin shadowing;
+// la condición LOS/NLOS se promedia en potencia con la probabilidad LOS de
+// TR 38.901 (tabla 7.4.2-1), de modo que el mapa es determinista. El SINR
+// supone todas las celdas a plena carga y la ganancia de conformación del
+// modo rápido (fastBeamGain) en el enlace servidor.
+//
+// Formato NRRM v1 (little-endian): cabecera de 48 B (char magic[4] = "NRRM",
+// uint32 version = 1, uint32 nx, uint32 ny, uint32 numCells, uint32 reservado,
+// float64 xMin, float64 yMin, float64 resolución en m) seguida de tres planos
+// de nx*ny valores por filas (y creciente, x creciente dentro de la fila):
+// float32 RSRP (dBm por RE), float32 SINR (dB), uint16 celda servidora.
+class RadioMapGenerator {
+public:
+    struct Raster {
+        uint32_t nx = 0, ny = 0;
+        double xMin = 0.0, yMin = 0.0, resolution = 0.0;
+        std::vector<float> rsrpDbm;
+        std::vector<float> sinrDb;
+        std::vector<uint16_t> server;
+    };
+    
+    // Un modelo por hilo: los modelos de ns-3, sus Ptr y sus variables
+    // aleatorias no son seguros entre hilos, así que cada trabajador tiene los
+    // suyos, creados en el hilo principal
+    void Setup(const CellLayout& layout, bool denseScenario, uint32_t threads)
+    {
+        m_layout = &layout;
+        m_dense = denseScenario;
+        m_workers.clear();
+        for (uint32_t t = 0; t < threads; ++t) {
+            Worker worker;
+            for (uint32_t los = 0; los < 2; ++los) {
+                Ptr<ThreeGppPropagationLossModel> pathloss;
+                if (denseScenario) {
+                    pathloss = CreateObject<ThreeGppUmaPropagationLossModel>();
+                } else {
+                    pathloss = CreateObject<ThreeGppRmaPropagationLossModel>();
+                }
+                pathloss->SetAttribute("Frequency", DoubleValue(3.5e9));
+                pathloss->SetAttribute("ShadowingEnabled", BooleanValue(false));
+                if (los) {
+                    pathloss->SetChannelConditionModel(CreateObject<AlwaysLosChannelConditionModel>());
+                } else {
+                    pathloss->SetChannelConditionModel(CreateObject<NeverLosChannelConditionModel>());
+                }
+                worker.pathloss[los] = pathloss;
+            }
+            worker.ue = CreateObject<ConstantPositionMobilityModel>();
+            worker.gnb = CreateObject<ConstantPositionMobilityModel>();
+            m_workers.push_back(worker);
+        }
+    }
+    
+    // Rejilla con paso resolution sobre la caja de las celdas más margin
+    Raster Generate(double resolution, double margin, double ueHeight, double txPowerDbm,
+                    double beamGainDb, double noiseFigureDb)
+    {
+        Raster raster;
+        double xMin = std::numeric_limits<double>::max(), yMin = xMin;
+        double xMax = std::numeric_limits<double>::lowest(), yMax = xMax;
+        for (const CellSite& cell : m_layout->cells) {
+            xMin = std::min(xMin, cell.position.x);
+            yMin = std::min(yMin, cell.position.y);
+            xMax = std::max(xMax, cell.position.x);
+            yMax = std::max(yMax, cell.position.y);
+        }
+        raster.xMin = xMin - margin;
+        raster.yMin = yMin - margin;
+        raster.resolution = resolution;
+        raster.nx = static_cast<uint32_t>(std::ceil((xMax - xMin + 2 * margin) / resolution)) + 1;
+        raster.ny = static_cast<uint32_t>(std::ceil((yMax - yMin + 2 * margin) / resolution)) + 1;
+        std::size_t points = static_cast<std::size_t>(raster.nx) * raster.ny;
+        raster.rsrpDbm.resize(points);
+        raster.sinrDb.resize(points);
+        raster.server.resize(points);
+        
+        // RSRP por RE: la potencia total repartida en 273 PRB x 12 subportadoras
+        double rsrpOffsetDb = -10.0 * std::log10(273.0 * 12.0);
+        double noiseMw = std::pow(10.0, (-174.0 + 10.0 * std::log10(100e6) + noiseFigureDb) / 10.0);
+        
+        // Reparto dinámico por filas: cada hilo toma la siguiente fila libre
+        std::atomic<uint32_t> nextRow{0};
+        auto work = [&](Worker& worker) {
+            std::vector<double> rxMw(m_layout->GetN());
+            for (uint32_t row = nextRow.fetch_add(1); row < raster.ny; row = nextRow.fetch_add(1)) {
+                for (uint32_t col = 0; col < raster.nx; ++col) {
+                    Vector pos(raster.xMin + col * resolution, raster.yMin + row * resolution, ueHeight);
+                    worker.ue->SetPosition(pos);
+                    uint32_t best = 0;
+                    double totalMw = 0.0;
+                    for (uint32_t c = 0; c < rxMw.size(); ++c) {
+                        rxMw[c] = std::pow(10.0, RxPowerDbm(worker, pos, c, txPowerDbm) / 10.0);
+                        totalMw += rxMw[c];
+                        if (rxMw[c] > rxMw[best]) best = c;
+                    }
+                    std::size_t idx = static_cast<std::size_t>(row) * raster.nx + col;
+                    raster.rsrpDbm[idx] = 10.0 * std::log10(rxMw[best]) + rsrpOffsetDb;
+                    raster.sinrDb[idx] = 10.0 * std::log10(rxMw[best] * std::pow(10.0, beamGainDb / 10.0) /
+                                                           (noiseMw + totalMw - rxMw[best]));
+                    raster.server[idx] = best;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (uint32_t t = 1; t < m_workers.size(); ++t) threads.emplace_back(work, std::ref(m_workers[t]));
+        work(m_workers[0]);
+        for (std::thread& thread : threads) thread.join();
+        return raster;
+    }
+    
+    static bool Write(const std::string& file, const Raster& raster, uint32_t numCells)
+    {
+        std::ofstream out(file, std::ios::binary);
+        const uint32_t header[6] = {0x4D52524E /* "NRRM" */, 1, raster.nx, raster.ny, numCells, 0};
+        const double geometry[3] = {raster.xMin, raster.yMin, raster.resolution};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(geometry), sizeof(geometry));
+        out.write(reinterpret_cast<const char*>(raster.rsrpDbm.data()), raster.rsrpDbm.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(raster.sinrDb.data()), raster.sinrDb.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(raster.server.data()), raster.server.size() * sizeof(uint16_t));
+        return static_cast<bool>(out);
+    }
+    
+private:
+    struct Worker {
+        Ptr<ThreeGppPropagationLossModel> pathloss[2]; // [0] NLOS, [1] LOS
+        Ptr<MobilityModel> ue;
+        Ptr<MobilityModel> gnb;
+    };
+    
+    // Probabilidad LOS de TR 38.901 tabla 7.4.2-1 (UMa y RMa)
+    double LosProbability(double d2D, double ueHeight) const
+    {
+        if (!m_dense) return (d2D <= 10.0) ? 1.0 : std::exp(-(d2D - 10.0) / 1000.0);
+        if (d2D <= 18.0) return 1.0;
+        double c = (ueHeight <= 13.0) ? 0.0 : std::pow((ueHeight - 13.0) / 10.0, 1.5);
+        return (18.0 / d2D + std::exp(-d2D / 63.0) * (1.0 - 18.0 / d2D)) *
+               (1.0 + c * 5.0 / 4.0 * std::pow(d2D / 100.0, 3) * std::exp(-d2D / 150.0));
+    }
+    
+    // Potencia recibida media (LOS/NLOS ponderados) de la celda, con la imagen
+    // de wrap-around más cercana y el patrón de elemento del sector
+    double RxPowerDbm(Worker& worker, const Vector& pos, uint32_t cell, double txPowerDbm) const
+    {
+        Vector image;
+        m_layout->Distance(pos, cell, &image);
+        worker.gnb->SetPosition(image);
+        double d2D = std::hypot(pos.x - image.x, pos.y - image.y);
+        double pLos = LosProbability(d2D, pos.z);
+        double losMw = std::pow(10.0, worker.pathloss[1]->CalcRxPower(txPowerDbm, worker.gnb, worker.ue) / 10.0);
+        double nlosMw = std::pow(10.0, worker.pathloss[0]->CalcRxPower(txPowerDbm, worker.gnb, worker.ue) / 10.0);
+        return 10.0 * std::log10(pLos * losMw + (1.0 - pLos) * nlosMw) +
+               m_layout->ElementGainDb(pos, cell, image);
+    }
+    
+    const CellLayout* m_layout = nullptr;
+    bool m_dense = false;
+    std::vector<Worker> m_workers;
+};
+
+// Percentil q (0-1) por selección parcial; reordena values
+static double
+RasterPercentile(std::vector<float>& values, double q)
+{
+    if (values.empty()) return 0.0;
+    std::size_t k = static_cast<std::size_t>(q * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+static void
+RunRadioMap(const SimulationConfig& config)
+{
+    auto start = std::chrono::steady_clock::now();
+    ScenarioType scenario = config.denseScenario ? DENSE_URBAN : SPARSE_SUBURBAN;
+    CellLayout layout = (config.layout == "hex") ?
+        CreateHexGridLayout(config.hexTiers, config.ISD, config.gnbHeight, config.sectors,
+                            config.wrapAround) :
+        CreateOptimizedCellLayout(config.numCells, config.ISD, config.gnbHeight, scenario);
+    
+    uint32_t threads = config.radioMapThreads;
+    if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+    
+    // Mismo margen que la distribución de UEs de DistributeUsersOptimized
+    double margin = config.denseScenario ? config.ISD * 0.4 : config.ISD * 0.8;
+    RadioMapGenerator generator;
+    generator.Setup(layout, config.denseScenario, threads);
+    RadioMapGenerator::Raster raster =
+        generator.Generate(config.radioMapResolution, margin, config.ueHeight, config.gnbTxPower,
+                           config.fastBeamGain, config.fastNoiseFigure);
+    
+    std::string rasterFile = config.radioMap + ".nrrm";
+    std::filesystem::path parent = std::filesystem::path(rasterFile).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent);
+    NS_ABORT_MSG_IF(!RadioMapGenerator::Write(rasterFile, raster, layout.GetN()),
+                    "No se pudo escribir el mapa de cobertura " << rasterFile);
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    // Cobertura: SINR por encima del umbral de 10% de BLER del MCS 0
+    double mcs0Threshold = 10.0 * std::log10(std::pow(2.0, FastLinkModel::SpectralEfficiency(0)) - 1.0) +
+                           FastLinkModel::SHANNON_GAP_DB;
+    std::size_t covered = std::count_if(raster.sinrDb.begin(), raster.sinrDb.end(),
+                                        [mcs0Threshold](float sinr) { return sinr >= mcs0Threshold; });
+    std::vector<float> rsrp = raster.rsrpDbm;
+    std::vector<float> sinr = raster.sinrDb;
+    
+    std::string summaryFile = config.radioMap + "_summary.csv";
+    StatsTable summary;
+    summary.AddColumn("Metric", StatsTable::COL_TEXT, 0, 32);
+    summary.AddColumn("Value", StatsTable::COL_FLOAT64, 6);
+    summary.AddColumn("Unit", StatsTable::COL_TEXT, 0, 16);
+    summary.Text("NumCells").Real(layout.GetN(), 0).Text("cells");
+    summary.Text("ISD").Real(config.ISD, 1).Text("m");
+    summary.Text("GnbTxPower").Real(config.gnbTxPower, 1).Text("dBm");
+    summary.Text("PropagationModel").Text(config.denseScenario ? "UMa" : "RMa").Text("type");
+    summary.Text("Resolution").Real(raster.resolution, 2).Text("m");
+    summary.Text("GridPoints").Real(static_cast<double>(raster.rsrpDbm.size()), 0).Text("points");
+    summary.Text("RsrpP5").Real(RasterPercentile(rsrp, 0.05), 2).Text("dBm");
+    summary.Text("RsrpP50").Real(RasterPercentile(rsrp, 0.50), 2).Text("dBm");
+    summary.Text("RsrpP95").Real(RasterPercentile(rsrp, 0.95), 2).Text("dBm");
+    summary.Text("SinrP5").Real(RasterPercentile(sinr, 0.05), 2).Text("dB");
+    summary.Text("SinrP50").Real(RasterPercentile(sinr, 0.50), 2).Text("dB");
+    summary.Text("SinrP95").Real(RasterPercentile(sinr, 0.95), 2).Text("dB");
+    summary.Text("CoverageRatio").Real(100.0 * covered / raster.sinrDb.size(), 2).Text("%");
+    summary.Text("Threads").Real(threads, 0).Text("threads");
+    summary.Text("WallTime").Real(wallTime).Text("s");
+    summary.WriteCsv(summaryFile);
+    
+    std::cout << "Mapa de cobertura: " << raster.nx << "x" << raster.ny << " puntos, " << threads
+              << " hilos, " << std::fixed << std::setprecision(2) << wallTime << " s -> "
+              << rasterFile << "\n";
+    Simulator::Destroy();
+}
+
+// Resumen entre réplicas: media, desviación e intervalo de confianza del 95%
+static void
+WriteReplicationSummary(const std::string& file, const std::vector<uint64_t>& runIds,
+                        const std::vector<std::vector<SystemMetric>>& runs)
+{
+    std::ofstream out(file);
+    out << "Metric,Runs,Mean,StdDev,CI95HalfWidth,Min,Max,Unit\n";
+    
+    for (std::size_t m = 0; !runs.empty() && m < runs[0].size(); ++m) {
+        uint32_t n = runs.size();
+        double mean = 0.0, m2 = 0.0;
+        double minValue = std::numeric_limits<double>::max();
+        double maxValue = std::numeric_limits<double>::lowest();
+        for (uint32_t r = 0; r < n; ++r) {
+            double value = runs[r][m].value;
+            double delta = value - mean;
+            mean += delta / (r + 1);
+            m2 += delta * (value - mean);
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+        double stdDev = (n > 1) ? std::sqrt(m2 / (n - 1)) : 0.0;
+        double ciHalfWidth = (n > 1) ? StudentT975(n - 1) * stdDev / std::sqrt(n) : 0.0;
+        
+        out << runs[0][m].name << "," << n << ","
+            << std::fixed << std::setprecision(4) << mean << "," << stdDev << ","
+            << ciHalfWidth << "," << minValue << "," << maxValue << ","
+            << runs[0][m].unit << "\n";
+    }
+    
+    out << "RunIds,";
+    for (std::size_t r = 0; r < runIds.size(); ++r) {
+        out << (r > 0 ? " " : "") << runIds[r];
+    }
+    out << ",,,,,,list\n";
+}
+
+#ifdef NS3_MPI
+// Reúne en el rank 0 las métricas de las réplicas ejecutadas por cada rank.
+// Cada réplica viaja como [runId, valor_0, ..., valor_M-1]; todas tienen las
+// mismas M métricas en el mismo orden.
+static void
+GatherReplicationsAtRoot(std::vector<uint64_t>& runIds,
+                         std::vector<std::vector<SystemMetric>>& runMetrics,
+                         uint32_t rank, uint32_t numRanks)
+{
+    int numMetrics = runMetrics.empty() ? 0 : static_cast<int>(runMetrics[0].size());
+    MPI_Allreduce(MPI_IN_PLACE, &numMetrics, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    
+    std::vector<double> local;
+    for (std::size_t r = 0; r < runIds.size(); ++r) {
+        local.push_back(static_cast<double>(runIds[r]));
+        for (const auto& metric : runMetrics[r]) {
+            local.push_back(metric.value);
+        }
+    }
+    
+    int localCount = static_cast<int>(local.size());
+    std::vector<int> counts(numRanks, 0), displs(numRanks, 0);
+    MPI_Gather(&localCount, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    
+    std::vector<double> all;
+    if (rank == 0) {
+        for (uint32_t i = 1; i < numRanks; ++i) {
+            displs[i] = displs[i - 1] + counts[i - 1];
+        }
+        all.resize(displs[numRanks - 1] + counts[numRanks - 1]);
+    }
+    MPI_Gatherv(local.data(), localCount, MPI_DOUBLE, all.data(), counts.data(), displs.data(),
+                MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    
+    if (rank != 0 || numMetrics == 0) return;
+    
+    // Nombres y unidades: el rank 0 siempre ejecuta la primera réplica
+    const std::vector<SystemMetric> names = runMetrics[0];
+    std::vector<std::pair<uint64_t, std::vector<SystemMetric>>> merged;
+    for (std::size_t pos = 0; pos + numMetrics + 1 <= all.size(); pos += numMetrics + 1) {
+        std::vector<SystemMetric> metrics = names;
+        for (int m = 0; m < numMetrics; ++m) {
+            metrics[m].value = all[pos + 1 + m];
+        }
+        merged.emplace_back(static_cast<uint64_t>(all[pos]), metrics);
+    }
+    std::sort(merged.begin(), merged.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    
+    runIds.clear();
+    runMetrics.clear();
+    for (auto& entry : merged) {
+        runIds.push_back(entry.first);
+        runMetrics.push_back(std::move(entry.second));
+    }
+}
+#endif
+
+// ==================== Función principal ====================================
+int main(int argc, char** argv)
+{
+    SimulationConfig config;
+    
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("numCells", "Número de celdas (1,3,5,7,9)", config.numCells);
+    cmd.AddValue("numUEs", "Número total de UEs", config.numUEs);
+    cmd.AddValue("embbRatio", "Proporción de UEs eMBB", config.embbRatio);
+    cmd.AddValue("ISD", "Distancia inter-sitio (m)", config.ISD);
+    cmd.AddValue("layout", "Layout de celdas (legacy|hex)", config.layout);
+    cmd.AddValue("hexTiers", "Anillos de la malla hexagonal (0=1, 1=7, 2=19, 3=37 sitios)", config.hexTiers);
+    cmd.AddValue("sectors", "Sectores por sitio en la malla hexagonal (1|3)", config.sectors);
+    cmd.AddValue("wrapAround", "Distancias con wrap-around en la malla hexagonal", config.wrapAround);
+    cmd.AddValue("neighbourK", "Celdas vecinas registradas por UE", config.neighbourK);
+    cmd.AddValue("simTime", "Tiempo de simulación (s)", config.simTime);
+    cmd.AddValue("appStartTime", "Arranque de las aplicaciones; límite del warm-up con autoWarmup (s)", config.appStartTime);
+    cmd.AddValue("rngSeed", "Semilla aleatoria", config.rngSeed);
+    cmd.AddValue("runs", "Número de réplicas independientes en este proceso", config.runs);
+    cmd.AddValue("runStart", "RngRun de la primera réplica", config.runStart);
+    cmd.AddValue("mpi", "Repartir las réplicas entre procesos MPI", config.mpi);
+    cmd.AddValue("outputDir", "Directorio de salida", config.outputDir);
+    cmd.AddValue("kpiInterval", "Periodo de la serie temporal de KPIs (s, 0 = desactivada)", config.kpiInterval);
+    cmd.AddValue("macStatsInterval", "Periodo de la serie temporal de planificación MAC (s, 0 = desactivada)", config.macStatsInterval);
+    cmd.AddValue("autoWarmup", "Arrancar el tráfico al completarse la conexión RRC de todos los UEs", config.autoWarmup);
+    cmd.AddValue("autoStop", "Parar al converger las medias por lotes", config.autoStop);
+    cmd.AddValue("batchLength", "Duración de cada lote para la parada automática (s)", config.batchLength);
+    cmd.AddValue("minBatches", "Lotes mínimos antes de evaluar la convergencia", config.minBatches);
+    cmd.AddValue("ciTarget", "Semiancho relativo del IC95 para la parada automática", config.ciTarget);
+    cmd.AddValue("urllcInterval", "Intervalo entre paquetes URLLC (s, 0 = según escenario)", config.urllcInterval);
+    cmd.AddValue("statusFile", "Archivo de estado con el latido de progreso (vacío = desactivado)", config.statusFile);
+    cmd.AddValue("statusInterval", "Periodo del latido de progreso en tiempo de simulación (s)", config.statusInterval);
+    cmd.AddValue("profileCallbacks", "Medir el tiempo de pared dentro de las trazas", config.profileCallbacks);
+    cmd.AddValue("traceUes", "UEs trazados en detalle (all|none|list:a,b,...|random:K por celda)", config.traceUes);
+    cmd.AddValue("sinrTracePolicy", "Muestreo del SINR por TB (full|nth|slot|reservoir)", config.sinrTracePolicy);
+    cmd.AddValue("sinrTraceN", "Con sinrTracePolicy=nth, un TB de cada N", config.sinrTraceN);
+    cmd.AddValue("sinrReservoirSize", "Con sinrTracePolicy=reservoir, muestras por UE", config.sinrReservoirSize);
+    cmd.AddValue("saveSnapshot", "Guardar el estado tras el attach en este archivo", config.saveSnapshot);
+    cmd.AddValue("loadSnapshot", "Partir del estado tras el attach guardado en este archivo", config.loadSnapshot);
+    cmd.AddValue("snapshotStartTime", "Arranque de las aplicaciones al cargar un snapshot (s)", config.snapshotStartTime);
+    cmd.AddValue("pingPongWindow", "Ventana de detección de ping-pong en handover (s)", config.pingPongWindow);
+    cmd.AddValue("channelCacheDir", "Directorio de la caché de condición de canal (vacío = desactivada)", config.channelCacheDir);
+    cmd.AddValue("mobility", "Movilidad de UEs (static|rwp|linear|trace)", config.mobility);
+    cmd.AddValue("ueSpeed", "Velocidad de los UEs con rwp/linear (m/s)", config.ueSpeed);
+    cmd.AddValue("mobilityTick", "Periodo de actualización de la movilidad (s)", config.mobilityTick);
+    cmd.AddValue("mobilityTrace", "Traza de movilidad: líneas \"tiempo ueIndex x y\"", config.mobilityTrace);
+    cmd.AddValue("association", "Asociación inicial de UEs (closest|rsrp-cio)", config.association);
+    cmd.AddValue("cioMax", "CIO máximo de la asociación por carga y salto de RSRP del rebalanceo (dB)", config.cioMax);
+    cmd.AddValue("cioStep", "Paso de ajuste del CIO por iteración (dB)", config.cioStep);
+    cmd.AddValue("loadTolerance", "Desviación relativa de carga admitida sobre la media", config.loadTolerance);
+    cmd.AddValue("rebalanceInterval", "Periodo del rebalanceo por handover (s, 0 = desactivado)", config.rebalanceInterval);
+    cmd.AddValue("rebalanceThreshold", "Utilización de PRB a partir de la cual una celda cede UEs (%)", config.rebalanceThreshold);
+    cmd.AddValue("rebalanceMaxMoves", "Handovers de rebalanceo por celda y periodo", config.rebalanceMaxMoves);
+    cmd.AddValue("urllcAggregate", "Un único cliente URLLC multi-destino en el remote host", config.urllcAggregate);
+    cmd.AddValue("embbSource", "Fuente eMBB (onoff|abr)", config.embbSource);
+    cmd.AddValue("abrLadder", "Escalera de tasas ABR en Mb/s, separadas por comas", config.abrLadder);
+    cmd.AddValue("abrSegment", "Duración de cada segmento de vídeo ABR (s)", config.abrSegment);
+    cmd.AddValue("abrReservoir", "Reserva de buffer del ABR BBA (s)", config.abrReservoir);
+    cmd.AddValue("abrCushion", "Colchón de buffer del ABR BBA (s)", config.abrCushion);
+    cmd.AddValue("abrMaxBuffer", "Buffer a partir del cual la fuente ABR deja de enviar (s)", config.abrMaxBuffer);
+    cmd.AddValue("fidelity", "Fidelidad de la réplica (full|fast)", config.fidelity);
+    cmd.AddValue("fastBeamGain", "Ganancia de conformación del enlace servidor en modo rápido (dB)", config.fastBeamGain);
+    cmd.AddValue("fastNoiseFigure", "Figura de ruido del UE en modo rápido (dB)", config.fastNoiseFigure);
+    cmd.AddValue("fastShare", "Reparto de la celda en modo rápido (pf|tdma)", config.fastShare);
+    cmd.AddValue("radioMap", "Generar el mapa de cobertura con esta base de archivos y salir", config.radioMap);
+    cmd.AddValue("radioMapResolution", "Paso de la rejilla del mapa de cobertura (m)", config.radioMapResolution);
+    cmd.AddValue("radioMapThreads", "Hilos del mapa de cobertura (0 = todos los núcleos)", config.radioMapThreads);
+    cmd.AddValue("flowAccounting", "Contabilidad de flujos (flowmonitor|apps)", config.flowAccounting);
+    cmd.AddValue("outputFormat", "Formato de las tablas de resultados (csv|binary|both)", config.outputFormat);
+    cmd.AddValue("scheduler", "Scheduler (TdmaQos|OfdmaQos)", config.scheduler);
+    cmd.AddValue("hoAlgorithm", "Algoritmo de handover", config.hoAlgorithm);
+    cmd.AddValue("denseScenario", "Escenario denso (true) o disperso (false)", config.denseScenario);
+    cmd.Parse(argc, argv);
+    
+    NS_ABORT_MSG_IF(config.runs == 0, "--runs debe ser al menos 1");
+    NS_ABORT_MSG_IF(config.appStartTime <= 0 || config.appStartTime >= config.simTime,
+                    "--appStartTime debe ser positivo y menor que --simTime");
+    NS_ABORT_MSG_IF(config.layout != "legacy" && config.layout != "hex",
+                    "Layout desconocido: " << config.layout);
+    NS_ABORT_MSG_IF(config.kpiInterval < 0, "--kpiInterval no puede ser negativo");
+    NS_ABORT_MSG_IF(config.macStatsInterval < 0, "--macStatsInterval no puede ser negativo");
+    NS_ABORT_MSG_IF(config.urllcInterval < 0, "--urllcInterval no puede ser negativo");
+    NS_ABORT_MSG_IF(config.statusInterval <= 0, "--statusInterval debe ser positivo");
+    SinrSampler::Policy sinrPolicy;
+    NS_ABORT_MSG_IF(!SinrSampler::ParsePolicy(config.sinrTracePolicy, sinrPolicy),
+                    "Política de muestreo del SINR desconocida: " << config.sinrTracePolicy);
+    NS_ABORT_MSG_IF(!UeTraceSelection().Parse(config.traceUes),
+                    "Selección de UEs trazados no válida: " << config.traceUes);
+    NS_ABORT_MSG_IF(config.autoStop && (config.batchLength <= 0 || config.ciTarget <= 0),
+                    "--batchLength y --ciTarget deben ser positivos");
+    NS_ABORT_MSG_IF(config.outputFormat != "csv" && config.outputFormat != "binary" &&
+                    config.outputFormat != "both",
+                    "Formato de salida desconocido: " << config.outputFormat);
+    NS_ABORT_MSG_IF(!config.saveSnapshot.empty() && !config.loadSnapshot.empty(),
+                    "--saveSnapshot y --loadSnapshot son excluyentes");
+    NS_ABORT_MSG_IF(config.snapshotStartTime <= 0, "--snapshotStartTime debe ser positivo");
+    NS_ABORT_MSG_IF(config.pingPongWindow <= 0, "--pingPongWindow debe ser positivo");
+    UeMobilityDriver::Kind mobilityKind;
+    NS_ABORT_MSG_IF(!UeMobilityDriver::ParseKind(config.mobility, mobilityKind),
+                    "Movilidad desconocida: " << config.mobility);
+    NS_ABORT_MSG_IF(config.mobilityTick <= 0, "--mobilityTick debe ser positivo");
+    NS_ABORT_MSG_IF((mobilityKind == UeMobilityDriver::RANDOM_WAYPOINT ||
+                     mobilityKind == UeMobilityDriver::LINEAR) && config.ueSpeed <= 0,
+                    "--ueSpeed debe ser positivo con --mobility=" << config.mobility);
+    NS_ABORT_MSG_IF(mobilityKind == UeMobilityDriver::TRACE && config.mobilityTrace.empty(),
+                    "--mobility=trace requiere --mobilityTrace");
+    // La caché de condición de canal supone nodos estáticos
+    NS_ABORT_MSG_IF(mobilityKind != UeMobilityDriver::STATIC && !config.channelCacheDir.empty(),
+                    "--channelCacheDir requiere --mobility=static");
+    NS_ABORT_MSG_IF(config.association != "closest" && config.association != "rsrp-cio",
+                    "Asociación desconocida: " << config.association);
+    NS_ABORT_MSG_IF(config.cioMax < 0 || config.cioStep <= 0 || config.loadTolerance < 0,
+                    "--cioMax y --loadTolerance no pueden ser negativos y --cioStep debe ser positivo");
+    NS_ABORT_MSG_IF(config.rebalanceInterval < 0, "--rebalanceInterval no puede ser negativo");
+    NS_ABORT_MSG_IF(config.rebalanceInterval > 0 &&
+                    (config.rebalanceThreshold <= 0 || config.rebalanceThreshold > 100 ||
+                     config.rebalanceMaxMoves == 0),
+                    "--rebalanceThreshold debe estar en (0, 100] y --rebalanceMaxMoves ser al menos 1");
+    // Las RSRP de las candidatas se estiman una sola vez con las posiciones
+    // iniciales, que la movilidad deja obsoletas
+    NS_ABORT_MSG_IF(mobilityKind != UeMobilityDriver::STATIC &&
+                    (config.association != "closest" || config.rebalanceInterval > 0),
+                    "--association=rsrp-cio y --rebalanceInterval requieren --mobility=static");
+    NS_ABORT_MSG_IF(config.flowAccounting != "flowmonitor" && config.flowAccounting != "apps",
+                    "Contabilidad de flujos desconocida: " << config.flowAccounting);
+    NS_ABORT_MSG_IF(config.embbSource != "onoff" && config.embbSource != "abr",
+                    "Fuente eMBB desconocida: " << config.embbSource);
+    std::vector<double> abrLadder;
+    NS_ABORT_MSG_IF(config.embbSource == "abr" && !AbrVideoSource::ParseLadder(config.abrLadder, abrLadder),
+                    "--abrLadder debe ser una lista creciente de tasas positivas: " << config.abrLadder);
+    NS_ABORT_MSG_IF(config.abrSegment <= 0 || config.abrCushion <= 0 ||
+                    config.abrReservoir < 0 || config.abrMaxBuffer <= config.abrSegment,
+                    "Parámetros ABR no válidos (segmento y colchón positivos, buffer máximo mayor que un segmento)");
+    NS_ABORT_MSG_IF(config.fidelity != "full" && config.fidelity != "fast",
+                    "Fidelidad desconocida: " << config.fidelity);
+    NS_ABORT_MSG_IF(config.fastShare != "pf" && config.fastShare != "tdma",
+                    "Reparto del modo rápido desconocido: " << config.fastShare);
+    // El modo rápido no modela handover, movilidad ni attach: solo la foto estática
+    NS_ABORT_MSG_IF(config.fidelity == "fast" &&
+                    (mobilityKind != UeMobilityDriver::STATIC || !config.loadSnapshot.empty() ||
+                     !config.saveSnapshot.empty() || config.autoStop || config.rebalanceInterval > 0),
+                    "--fidelity=fast requiere --mobility=static y no admite snapshots, autoStop ni rebalanceo");
+    NS_ABORT_MSG_IF(config.radioMapResolution <= 0, "--radioMapResolution debe ser positivo");
+    // El canal 3GPP de la pila completa usa las posiciones físicas: asociar por
+    // la imagen más cercana uniría UEs de borde a gNB del otro extremo de la malla
+    NS_ABORT_MSG_IF(config.wrapAround && config.fidelity == "full" && config.radioMap.empty(),
+                    "--wrapAround solo se admite con --fidelity=fast o --radioMap");
+    
+    // En la malla hexagonal el número de celdas lo fija la geometría
+    if (config.layout == "hex") {
+        config.numCells = (3 * config.hexTiers * (config.hexTiers + 1) + 1) * config.sectors;
+    }
+    
+    // El mapa de cobertura no ejecuta réplicas: evalúa la rejilla y termina
+    if (!config.radioMap.empty()) {
+        RunRadioMap(config);
+        return 0;
+    }
+    
+    // Con MPI cada rank ejecuta las réplicas r con r % numRanks == rank. Cada
+    // réplica es una simulación secuencial completa: el canal espectral NR es
+    // compartido por todas las celdas y no admite partición entre ranks.
+    uint32_t rank = 0;
+    uint32_t numRanks = 1;
+    if (config.mpi) {
+#ifdef NS3_MPI
+        MpiInterface::Enable(&argc, &argv);
+        rank = MpiInterface::GetSystemId();
+        numRanks = MpiInterface::GetSize();
+        // Enable() selecciona DistributedSimulatorImpl, cuyo Run() sincroniza
+        // los ranks con colectivas MPI. Las réplicas son independientes y, con
+        // runs % numRanks != 0, cada rank ejecuta un número distinto de Run():
+        // esas colectivas se cruzarían con las de GatherReplicationsAtRoot.
+        // MPI solo se usa para repartir y reunir, con el simulador secuencial.
+        GlobalValue::Bind("SimulatorImplementationType", StringValue("ns3::DefaultSimulatorImpl"));
+#else
+        NS_FATAL_ERROR("--mpi requiere compilar ns-3 con --enable-mpi");
+#endif
+    }
+    
+    // Configurar directorios de salida -  
+    std::filesystem::create_directories(config.outputDir);
+    
+    // Inicialización: misma semilla, un RngRun distinto por réplica
+    SeedManager::SetSeed(config.rngSeed);
+    
+    // Con varios ranks cada uno publica su propio latido
+    if (!config.statusFile.empty()) {
+        std::string statusFile = (numRanks > 1) ?
+                                 config.statusFile + ".rank" + std::to_string(rank) : config.statusFile;
+        uint32_t ownRuns = config.runs / numRanks + ((rank < config.runs % numRanks) ? 1 : 0);
+        g_progress.Open(statusFile, ownRuns, config.simTime);
+    }
+    
+    std::vector<uint64_t> runIds;
+    std::vector<std::vector<SystemMetric>> runMetrics;
+    for (uint32_t r = 0; r < config.runs; ++r) {
+        if (r % numRanks != rank) continue;
+        uint64_t run = config.runStart + r;
+        g_progress.BeginReplication(runIds.size() + 1, run);
+        SeedManager::SetRun(run);
+        RngSeedManager::ResetNextStreamIndex();
+        
+        // Con varias réplicas, cada una escribe sus CSV en run<R>/
+        std::string runDir = (config.runs > 1) ?
+                             config.outputDir + "/run" + std::to_string(run) : config.outputDir;
+        runIds.push_back(run);
+        runMetrics.push_back((config.fidelity == "fast") ? RunFastReplication(config, run, runDir) :
+                                                           RunReplication(config, run, runDir));
+    }
+    
+#ifdef NS3_MPI
+    if (config.mpi) {
+        GatherReplicationsAtRoot(runIds, runMetrics, rank, numRanks);
+    }
+#endif
+    
+    if (config.runs > 1 && rank == 0) {
+        std::string summaryFile = config.outputDir + "/system_stats_summary_optimized_" +
+                                  std::to_string(config.numCells) + "cell.csv";
+        WriteReplicationSummary(summaryFile, runIds, runMetrics);
+        std::cout << "Resumen de " << config.runs << " réplicas: " << summaryFile << "\n";
+    }
+    g_progress.Close();
+    
+#ifdef NS3_MPI
+    if (config.mpi) {
+        MpiInterface::Disable();
+    }
+#endif
     return 0;
 }
 
@@ -0,0 +1,757 @@
+// ============================================================================
+//   Consolidación de resultados de nr_multi_cell_optimized
+// ============================================================================
+//
+// Recorre un directorio de resultados (p. ej. simulation_results/ de
+// run_simulation_batch.sh), ingiere en paralelo las tablas flow/cell/system y
+// los sketches de latencia de cada réplica (CSV o NRCB, mapeados en memoria) y
+// agrega entre réplicas por clave (numCells, escenario): media, desviación,
+// IC del 95%, mínimo, P5/P50/P95 y máximo de cada métrica.
+//
+// Es incremental: el manifiesto <base>/.consolidate_manifest guarda, por
+// réplica ya ingerida, su sello (mtime y tamaño de system_stats y de
+// delay_sketches) y sus métricas ya reducidas. Solo se leen las réplicas
+// nuevas o modificadas; las que han desaparecido del disco se descartan.
+//
+// Uso: nr_results_consolidate <directorio_base> [--threads=N] [--rebuild]
+//
+// Salidas en <directorio_base>:
+//   consolidated_system_stats.csv  métricas de system_stats por clave
+//   consolidated_cell_stats.csv    media y P5/P50/P95 entre celdas de cada réplica
+//   consolidated_flow_stats.csv    ídem entre flujos, separado por TrafficType
+//   consolidated_delay_quantiles.csv  cuantiles de los sketches de sistema fusionados
+//   consolidated_runs.csv          métricas por réplica en formato largo
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// ==================== Archivo mapeado en memoria ===========================
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+    
+    bool Open(const std::string& file)
+    {
+        Close();
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) return false;
+        madvise(base, st.st_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(base);
+        m_size = st.st_size;
+        return true;
+    }
+    
+    void Close()
+    {
+        if (m_data != nullptr) munmap(const_cast<char*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+    
+    const char* Data() const { return m_data; }
+    std::size_t Size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// ==================== Lectura de tablas (CSV / NRCB) =======================
+// Una columna leída: valor numérico por fila (NaN si la celda es texto) y el
+// texto de las celdas no numéricas. En NRCB la columna compañera "<name>Text"
+// se funde con su columna numérica.
+struct Column {
+    std::string name;
+    std::vector<double> values;
+    std::vector<std::string> texts;
+};
+
+struct Table {
+    std::vector<Column> columns;
+    std::size_t rows = 0;
+    
+    const Column* Find(const std::string& name) const
+    {
+        for (const Column& column : columns) {
+            if (column.name == name) return &column;
+        }
+        return nullptr;
+    }
+};
+
+static bool
+ParseNumber(const char* begin, const char* end, double& value)
+{
+    if (begin == end) return false;
+    char buffer[64];
+    std::size_t length = std::min<std::size_t>(end - begin, sizeof(buffer) - 1);
+    std::memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+    char* parsed = nullptr;
+    value = std::strtod(buffer, &parsed);
+    return parsed == buffer + length;
+}
+
+static bool
+LoadCsv(const std::string& file, Table& table)
+{
+    MappedFile mapped;
+    if (!mapped.Open(file)) return false;
+    const char* p = mapped.Data();
+    const char* end = p + mapped.Size();
+    
+    bool header = true;
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) lineEnd = end;
+        const char* contentEnd = (lineEnd > p && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+        if (contentEnd > p) {
+            std::size_t c = 0;
+            const char* field = p;
+            while (true) {
+                const char* comma = static_cast<const char*>(std::memchr(field, ',', contentEnd - field));
+                const char* fieldEnd = (comma != nullptr) ? comma : contentEnd;
+                if (header) {
+                    table.columns.push_back({std::string(field, fieldEnd), {}, {}});
+                } else if (c < table.columns.size()) {
+                    Column& column = table.columns[c];
+                    double value;
+                    if (ParseNumber(field, fieldEnd, value)) {
+                        column.values.push_back(value);
+                        column.texts.emplace_back();
+                    } else {
+                        column.values.push_back(std::numeric_limits<double>::quiet_NaN());
+                        column.texts.emplace_back(field, fieldEnd);
+                    }
+                }
+                ++c;
+                if (comma == nullptr) break;
+                field = comma + 1;
+            }
+            if (!header) {
+                // Filas cortas: se completan para mantener las columnas alineadas
+                for (; c < table.columns.size(); ++c) {
+                    table.columns[c].values.push_back(std::numeric_limits<double>::quiet_NaN());
+                    table.columns[c].texts.emplace_back();
+                }
+                table.rows++;
+            }
+            header = false;
+        }
+        p = lineEnd + 1;
+    }
+    return !table.columns.empty();
+}
+
+// Formato NRCB v1: ver StatsTable en nr_multi_cell_optimized.cc
+static bool
+LoadNrcb(const std::string& file, Table& table)
+{
+    MappedFile mapped;
+    if (!mapped.Open(file) || mapped.Size() < 24) return false;
+    const char* base = mapped.Data();
+    uint32_t version, numColumns;
+    uint64_t numRows;
+    std::memcpy(&version, base + 4, 4);
+    std::memcpy(&numRows, base + 8, 8);
+    std::memcpy(&numColumns, base + 16, 4);
+    if (std::memcmp(base, "NRCB", 4) != 0 || version != 1 ||
+        24 + 64ULL * numColumns > mapped.Size()) {
+        return false;
+    }
+    
+    table.rows = numRows;
+    for (uint32_t c = 0; c < numColumns; ++c) {
+        const char* desc = base + 24 + 64 * c;
+        std::string name(desc, strnlen(desc, 48));
+        uint32_t type, width;
+        uint64_t offset;
+        std::memcpy(&type, desc + 48, 4);
+        std::memcpy(&width, desc + 52, 4);
+        std::memcpy(&offset, desc + 56, 8);
+        if (offset + numRows * width > mapped.Size()) return false;
+        const char* data = base + offset;
+        
+        // Compañera de texto de la columna numérica anterior
+        if (type == 2 && !table.columns.empty() && name == table.columns.back().name + "Text") {
+            Column& owner = table.columns.back();
+            for (uint64_t r = 0; r < numRows; ++r) {
+                if (std::isnan(owner.values[r])) owner.texts[r].assign(data + r * width, strnlen(data + r * width, width));
+            }
+            continue;
+        }
+        
+        Column column;
+        column.name = name;
+        column.values.resize(numRows, std::numeric_limits<double>::quiet_NaN());
+        column.texts.resize(numRows);
+        for (uint64_t r = 0; r < numRows; ++r) {
+            const char* cell = data + r * width;
+            if (type == 0) {
+                int64_t value;
+                std::memcpy(&value, cell, 8);
+                column.values[r] = static_cast<double>(value);
+            } else if (type == 1) {
+                std::memcpy(&column.values[r], cell, 8);
+            } else {
+                column.texts[r].assign(cell, strnlen(cell, width));
+            }
+        }
+        table.columns.push_back(std::move(column));
+    }
+    return true;
+}
+
+// basePath sin extensión; el binario tiene preferencia si existen ambos
+static bool
+LoadTable(const std::string& basePath, Table& table)
+{
+    if (fs::exists(basePath + ".nrcb") && LoadNrcb(basePath + ".nrcb", table)) return true;
+    table = Table();
+    return LoadCsv(basePath + ".csv", table);
+}
+
+// ==================== Estadística ==========================================
+// Cuantil 0.975 de la t de Student (IC bilateral del 95%)
+static double
+StudentT975(uint32_t dof)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                   2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                   2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                   2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof == 0) return 0.0;
+    return (dof <= 30) ? table[dof - 1] : 1.960;
+}
+
+// Percentil p (0-100) con interpolación lineal; values debe estar ordenado
+static double
+SortedPercentile(const std::vector<double>& values, double p)
+{
+    if (values.empty()) return 0.0;
+    double rank = p / 100.0 * (values.size() - 1);
+    std::size_t lower = static_cast<std::size_t>(rank);
+    if (lower + 1 >= values.size()) return values[lower];
+    return values[lower] + (rank - lower) * (values[lower + 1] - values[lower]);
+}
+
+// Sketch DDSketch reconstruido desde su codificación "zero;clave:cuenta ...";
+// solo fusión y cuantiles, con la misma estimación de cubo que el simulador
+class MergedSketch {
+public:
+    bool Merge(double gamma, const std::string& encoded)
+    {
+        if (m_gamma > 0 && std::fabs(gamma - m_gamma) > 1e-12 * m_gamma) return false;
+        m_gamma = gamma;
+        std::istringstream in(encoded);
+        uint64_t zero = 0;
+        char separator = 0;
+        if (!(in >> zero >> separator) || separator != ';') return false;
+        m_zeroCount += zero;
+        m_count += zero;
+        std::string bin;
+        while (in >> bin) {
+            std::size_t colon = bin.find(':');
+            if (colon == std::string::npos) return false;
+            uint64_t count = std::strtoull(bin.c_str() + colon + 1, nullptr, 10);
+            m_bins[std::atoi(bin.substr(0, colon).c_str())] += count;
+            m_count += count;
+        }
+        return true;
+    }
+    
+    uint64_t GetCount() const { return m_count; }
+    
+    double Quantile(double q) const
+    {
+        if (m_count == 0) return 0.0;
+        double rank = q * (m_count - 1);
+        if (rank < m_zeroCount) return 0.0;
+        uint64_t cumulative = m_zeroCount;
+        for (const auto& [key, count] : m_bins) {
+            cumulative += count;
+            if (cumulative > rank) return 2.0 * std::pow(m_gamma, key) / (1.0 + m_gamma);
+        }
+        return 2.0 * std::pow(m_gamma, m_bins.rbegin()->first) / (1.0 + m_gamma);
+    }
+
+private:
+    double m_gamma = 0.0;
+    std::map<int32_t, uint64_t> m_bins;
+    uint64_t m_zeroCount = 0;
+    uint64_t m_count = 0;
+};
+
+// ==================== Réplicas ==============================================
+// Cada réplica se reduce a una lista de métricas escalares por tabla y a sus
+// sketches de sistema; es lo que se guarda en el manifiesto
+struct RunMetric {
+    std::string table; // system | cell | flow
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+struct RunSketch {
+    std::string name;
+    double gamma;
+    std::string encoded;
+};
+
+struct RunRecord {
+    std::string path;  // directorio relativo al base
+    std::string stamp; // mtime_ns:tamaño de system_stats y de delay_sketches
+    uint32_t numCells = 0;
+    std::string scenario;
+    std::vector<RunMetric> metrics;
+    std::vector<RunSketch> sketches;
+    bool ok = false;
+};
+
+// Réplica encontrada en disco: directorio y sufijo "<N>cell" de sus tablas
+struct RunLocation {
+    fs::path dir;
+    uint32_t numCells;
+    std::string systemFile;
+};
+
+// Columnas identificadoras que no tiene sentido promediar
+static bool
+IsIdColumn(const std::string& name)
+{
+    static const char* ids[] = {"FlowId", "CellId", "UeImsi", "ServingCell", "Numerology", "Traced"};
+    for (const char* id : ids) {
+        if (name == id) return true;
+    }
+    return false;
+}
+
+// Columnas de flow_stats que solo tienen valor en los UEs trazados (--traceUes):
+// el resto escribe 0 en el SINR y 100 en la fiabilidad
+static bool
+IsSinrColumn(const std::string& name)
+{
+    return name.find("Sinr") != std::string::npos || name == "ReliabilityScore";
+}
+
+// Media y P5/P50/P95 de cada columna numérica sobre las filas seleccionadas;
+// con sinrRows, las columnas de SINR solo usan esas filas
+static void
+ReduceColumns(const Table& table, const std::vector<std::size_t>& rows, const std::string& tableName,
+              const std::string& prefix, std::vector<RunMetric>& metrics,
+              const std::vector<std::size_t>* sinrRows = nullptr)
+{
+    std::vector<double> values;
+    for (const Column& column : table.columns) {
+        if (IsIdColumn(column.name)) continue;
+        values.clear();
+        const std::vector<std::size_t>& selected =
+            (sinrRows != nullptr && IsSinrColumn(column.name)) ? *sinrRows : rows;
+        for (std::size_t r : selected) {
+            if (!std::isnan(column.values[r])) values.push_back(column.values[r]);
+        }
+        if (values.empty()) continue;
+        double sum = 0.0;
+        for (double v : values) sum += v;
+        std::sort(values.begin(), values.end());
+        std::string name = prefix + column.name;
+        metrics.push_back({tableName, name + ".Mean", sum / values.size(), ""});
+        metrics.push_back({tableName, name + ".P5", SortedPercentile(values, 5.0), ""});
+        metrics.push_back({tableName, name + ".P50", SortedPercentile(values, 50.0), ""});
+        metrics.push_back({tableName, name + ".P95", SortedPercentile(values, 95.0), ""});
+    }
+}
+
+static std::string
+FileStamp(const std::string& file)
+{
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0) return "";
+    return std::to_string(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec) +
+           ":" + std::to_string(st.st_size);
+}
+
+// Sello de la réplica: la simulación escribe delay_sketches después de
+// system_stats, así que el sello cubre ambos archivos
+static std::string
+RunStamp(const RunLocation& location)
+{
+    fs::path sketchFile = location.dir / ("delay_sketches_optimized_" +
+                                          std::to_string(location.numCells) + "cell.csv");
+    return FileStamp(location.systemFile) + "," + FileStamp(sketchFile.string());
+}
+
+static RunRecord
+IngestRun(const RunLocation& location, const fs::path& baseDir)
+{
+    RunRecord record;
+    record.path = fs::relative(location.dir, baseDir).generic_string();
+    record.stamp = RunStamp(location);
+    record.numCells = location.numCells;
+    std::string suffix = "_optimized_" + std::to_string(location.numCells) + "cell";
+    std::string prefix = (location.dir / "").string();
+    
+    // system_stats: Metric,Value,Unit; el escenario sale de la fila ScenarioType
+    Table system;
+    if (!LoadTable(prefix + "system_stats" + suffix, system)) return record;
+    const Column* metric = system.Find("Metric");
+    const Column* value = system.Find("Value");
+    const Column* unit = system.Find("Unit");
+    if (metric == nullptr || value == nullptr) return record;
+    for (std::size_t r = 0; r < system.rows; ++r) {
+        const std::string& name = metric->texts[r];
+        if (name == "ScenarioType") record.scenario = value->texts[r];
+        if (std::isnan(value->values[r])) continue;
+        record.metrics.push_back({"system", name, value->values[r], unit ? unit->texts[r] : ""});
+    }
+    if (record.scenario.empty()) record.scenario = "unknown";
+    
+    Table cell;
+    if (LoadTable(prefix + "cell_stats" + suffix, cell)) {
+        std::vector<std::size_t> rows(cell.rows);
+        for (std::size_t r = 0; r < cell.rows; ++r) rows[r] = r;
+        ReduceColumns(cell, rows, "cell", "", record.metrics);
+    }
+    
+    // flow_stats: eMBB y URLLC por separado (sus escalas no son comparables)
+    Table flow;
+    if (LoadTable(prefix + "flow_stats" + suffix, flow)) {
+        const Column* type = flow.Find("TrafficType");
+        const Column* traced = flow.Find("Traced");
+        std::map<std::string, std::vector<std::size_t>> groups, tracedGroups;
+        for (std::size_t r = 0; r < flow.rows; ++r) {
+            std::string group = type ? type->texts[r] : "all";
+            groups[group].push_back(r);
+            if (traced == nullptr || traced->values[r] != 0) tracedGroups[group].push_back(r);
+        }
+        for (const auto& [name, rows] : groups) {
+            ReduceColumns(flow, rows, "flow", name + ".", record.metrics, &tracedGroups[name]);
+        }
+    }
+    
+    Table sketches;
+    if (LoadCsv(prefix + "delay_sketches" + suffix + ".csv", sketches)) {
+        const Column* level = sketches.Find("Level");
+        const Column* name = sketches.Find("Metric");
+        const Column* gamma = sketches.Find("Gamma");
+        const Column* bins = sketches.Find("Bins");
+        for (std::size_t r = 0; level && name && gamma && bins && r < sketches.rows; ++r) {
+            if (level->texts[r] != "system") continue;
+            record.sketches.push_back({name->texts[r], gamma->values[r], bins->texts[r]});
+        }
+    }
+    record.ok = true;
+    return record;
+}
+
+// Réplicas del árbol: cada directorio con system_stats_optimized_<N>cell.*
+// (el resumen entre réplicas system_stats_summary_* no cuenta)
+static std::vector<RunLocation>
+ScanRuns(const fs::path& baseDir)
+{
+    std::map<std::string, RunLocation> found;
+    const std::string stem = "system_stats_optimized_";
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(baseDir, ec); it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        if (ec || !it->is_regular_file()) continue;
+        std::string name = it->path().filename().string();
+        std::string ext = it->path().extension().string();
+        if (name.compare(0, stem.size(), stem) != 0 || (ext != ".csv" && ext != ".nrcb")) continue;
+        std::string cells = name.substr(stem.size(), name.size() - stem.size() - ext.size());
+        if (cells.size() < 5 || cells.compare(cells.size() - 4, 4, "cell") != 0) continue;
+        uint32_t numCells = std::strtoul(cells.c_str(), nullptr, 10);
+        if (numCells == 0) continue;
+        
+        std::string dir = it->path().parent_path().string();
+        auto existing = found.find(dir);
+        if (existing == found.end() || ext == ".nrcb") {
+            found[dir] = {it->path().parent_path(), numCells, it->path().string()};
+        }
+    }
+    std::vector<RunLocation> runs;
+    for (auto& [dir, location] : found) runs.push_back(location);
+    return runs;
+}
+
+// ==================== Manifiesto ===========================================
+// Texto separado por tabuladores:
+//   NRCM 1
+//   run <ruta> <sello> <numCells> <escenario>
+//   m <tabla> <métrica> <valor> <unidad>
+//   k <métrica> <gamma> <codificación del sketch>
+//   end
+static std::map<std::string, RunRecord>
+LoadManifest(const std::string& file)
+{
+    std::map<std::string, RunRecord> records;
+    std::ifstream in(file);
+    std::string line;
+    if (!std::getline(in, line) || line != "NRCM 1") return records;
+    
+    RunRecord current;
+    auto split = [](const std::string& text) {
+        std::vector<std::string> fields;
+        std::size_t start = 0;
+        while (true) {
+            std::size_t tab = text.find('\t', start);
+            fields.push_back(text.substr(start, tab - start));
+            if (tab == std::string::npos) break;
+            start = tab + 1;
+        }
+        return fields;
+    };
+    while (std::getline(in, line)) {
+        std::vector<std::string> f = split(line);
+        if (f[0] == "run" && f.size() == 5) {
+            current = RunRecord();
+            current.path = f[1];
+            current.stamp = f[2];
+            current.numCells = std::strtoul(f[3].c_str(), nullptr, 10);
+            current.scenario = f[4];
+        } else if (f[0] == "m" && f.size() == 5) {
+            current.metrics.push_back({f[1], f[2], std::strtod(f[3].c_str(), nullptr), f[4]});
+        } else if (f[0] == "k" && f.size() == 4) {
+            current.sketches.push_back({f[1], std::strtod(f[2].c_str(), nullptr), f[3]});
+        } else if (f[0] == "end" && !current.path.empty()) {
+            current.ok = true;
+            records[current.path] = std::move(current);
+            current = RunRecord();
+        }
+    }
+    return records;
+}
+
+static bool
+SaveManifest(const std::string& file, const std::vector<const RunRecord*>& records)
+{
+    std::string tmpFile = file + ".tmp" + std::to_string(getpid());
+    std::ofstream out(tmpFile);
+    out << "NRCM 1\n" << std::setprecision(17);
+    for (const RunRecord* record : records) {
+        out << "run\t" << record->path << "\t" << record->stamp << "\t" << record->numCells << "\t"
+            << record->scenario << "\n";
+        for (const RunMetric& m : record->metrics) {
+            out << "m\t" << m.table << "\t" << m.name << "\t" << m.value << "\t" << m.unit << "\n";
+        }
+        for (const RunSketch& k : record->sketches) {
+            out << "k\t" << k.name << "\t" << k.gamma << "\t" << k.encoded << "\n";
+        }
+        out << "end\n";
+    }
+    out.close();
+    if (!out) return false;
+    return std::rename(tmpFile.c_str(), file.c_str()) == 0;
+}
+
+// ==================== Agregación por clave ==================================
+using GroupKey = std::pair<uint32_t, std::string>; // (numCells, escenario)
+
+struct MetricSeries {
+    std::string unit;
+    std::vector<double> values;
+};
+
+// Métricas de una tabla por clave, en el orden en que aparecen por primera vez
+struct TableAggregate {
+    std::map<GroupKey, std::vector<std::string>> order;
+    std::map<GroupKey, std::map<std::string, MetricSeries>> series;
+    
+    void Add(const GroupKey& key, const RunMetric& metric)
+    {
+        auto& bySeries = series[key];
+        auto it = bySeries.find(metric.name);
+        if (it == bySeries.end()) {
+            order[key].push_back(metric.name);
+            it = bySeries.emplace(metric.name, MetricSeries{metric.unit, {}}).first;
+        }
+        it->second.values.push_back(metric.value);
+    }
+    
+    void Write(const std::string& file) const
+    {
+        std::ofstream out(file);
+        out << "NumCells,Scenario,Metric,Runs,Mean,StdDev,CI95HalfWidth,Min,P5,P50,P95,Max,Unit\n";
+        for (const auto& [key, names] : order) {
+            for (const std::string& name : names) {
+                const MetricSeries& s = series.at(key).at(name);
+                std::vector<double> sorted = s.values;
+                std::sort(sorted.begin(), sorted.end());
+                uint32_t n = sorted.size();
+                double mean = 0.0, m2 = 0.0;
+                for (uint32_t r = 0; r < n; ++r) {
+                    double delta = sorted[r] - mean;
+                    mean += delta / (r + 1);
+                    m2 += delta * (sorted[r] - mean);
+                }
+                double stdDev = (n > 1) ? std::sqrt(m2 / (n - 1)) : 0.0;
+                double ciHalfWidth = (n > 1) ? StudentT975(n - 1) * stdDev / std::sqrt(n) : 0.0;
+                out << key.first << "," << key.second << "," << name << "," << n << ","
+                    << std::fixed << std::setprecision(4) << mean << "," << stdDev << ","
+                    << ciHalfWidth << "," << sorted.front() << "," << SortedPercentile(sorted, 5.0) << ","
+                    << SortedPercentile(sorted, 50.0) << "," << SortedPercentile(sorted, 95.0) << ","
+                    << sorted.back() << "," << s.unit << "\n";
+            }
+        }
+    }
+};
+
+static void
+WriteConsolidation(const fs::path& baseDir, const std::vector<const RunRecord*>& records)
+{
+    std::map<std::string, TableAggregate> tables;
+    std::map<GroupKey, std::map<std::string, MergedSketch>> sketches;
+    std::map<GroupKey, std::map<std::string, uint32_t>> sketchRuns;
+    
+    std::ofstream runsOut(baseDir / "consolidated_runs.csv");
+    runsOut << "NumCells,Scenario,Run,Table,Metric,Value,Unit\n" << std::setprecision(10);
+    for (const RunRecord* record : records) {
+        GroupKey key(record->numCells, record->scenario);
+        for (const RunMetric& metric : record->metrics) {
+            tables[metric.table].Add(key, metric);
+            runsOut << key.first << "," << key.second << "," << record->path << "," << metric.table << ","
+                    << metric.name << "," << metric.value << "," << metric.unit << "\n";
+        }
+        for (const RunSketch& sketch : record->sketches) {
+            if (sketches[key][sketch.name].Merge(sketch.gamma, sketch.encoded)) {
+                sketchRuns[key][sketch.name]++;
+            } else {
+                std::cerr << "Aviso: sketch " << sketch.name << " de " << record->path
+                          << " incompatible, se omite\n";
+            }
+        }
+    }
+    runsOut.close();
+    
+    for (const char* table : {"system", "cell", "flow"}) {
+        tables[table].Write((baseDir / ("consolidated_" + std::string(table) + "_stats.csv")).string());
+    }
+    
+    // Cuantiles sobre todos los paquetes de todas las réplicas de la clave
+    std::ofstream quantilesOut(baseDir / "consolidated_delay_quantiles.csv");
+    quantilesOut << "NumCells,Scenario,Metric,Runs,Count,P50,P90,P99,P999\n";
+    for (const auto& [key, byMetric] : sketches) {
+        for (const auto& [name, sketch] : byMetric) {
+            quantilesOut << key.first << "," << key.second << "," << name << ","
+                         << sketchRuns[key][name] << "," << sketch.GetCount() << ","
+                         << std::fixed << std::setprecision(4) << sketch.Quantile(0.50) << ","
+                         << sketch.Quantile(0.90) << "," << sketch.Quantile(0.99) << ","
+                         << sketch.Quantile(0.999) << "\n";
+        }
+    }
+}
+
+// ==================== Programa principal ===================================
+int
+main(int argc, char** argv)
+{
+    std::string baseArg;
+    uint32_t threads = 0;
+    bool rebuild = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--threads=", 0) == 0) {
+            threads = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg == "--rebuild") {
+            rebuild = true;
+        } else if (baseArg.empty() && arg.rfind("--", 0) != 0) {
+            baseArg = arg;
+        } else {
+            baseArg.clear();
+            break;
+        }
+    }
+    if (baseArg.empty() || !fs::is_directory(baseArg)) {
+        std::cerr << "Uso: " << argv[0] << " <directorio_base> [--threads=N] [--rebuild]\n";
+        return 1;
+    }
+    if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+    
+    auto start = std::chrono::steady_clock::now();
+    fs::path baseDir(baseArg);
+    std::string manifestFile = (baseDir / ".consolidate_manifest").string();
+    std::map<std::string, RunRecord> previous;
+    if (!rebuild) previous = LoadManifest(manifestFile);
+    
+    // Réplicas nuevas o con system_stats o delay_sketches modificados desde la última ingesta
+    std::vector<RunLocation> locations = ScanRuns(baseDir);
+    std::vector<RunRecord> records(locations.size());
+    std::vector<std::size_t> pending;
+    for (std::size_t i = 0; i < locations.size(); ++i) {
+        std::string path = fs::relative(locations[i].dir, baseDir).generic_string();
+        auto it = previous.find(path);
+        if (it != previous.end() && it->second.stamp == RunStamp(locations[i])) {
+            records[i] = std::move(it->second);
+        } else {
+            pending.push_back(i);
+        }
+    }
+    
+    std::atomic<std::size_t> next{0};
+    auto work = [&]() {
+        for (std::size_t k = next.fetch_add(1); k < pending.size(); k = next.fetch_add(1)) {
+            records[pending[k]] = IngestRun(locations[pending[k]], baseDir);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t t = 1; t < std::min<std::size_t>(threads, pending.size()); ++t) workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers) worker.join();
+    
+    std::vector<const RunRecord*> ingested;
+    uint32_t failed = 0;
+    for (const RunRecord& record : records) {
+        if (record.ok) {
+            ingested.push_back(&record);
+        } else {
+            failed++;
+            std::cerr << "Aviso: réplica ilegible, se omite: " << record.path << "\n";
+        }
+    }
+    if (!SaveManifest(manifestFile, ingested)) {
+        std::cerr << "No se pudo escribir el manifiesto " << manifestFile << "\n";
+        return 1;
+    }
+    WriteConsolidation(baseDir, ingested);
+    
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Réplicas consolidadas: " << ingested.size() << " (" << pending.size() - failed
+              << " nuevas, " << ingested.size() - (pending.size() - failed) << " del manifiesto";
+    if (failed > 0) std::cout << ", " << failed << " omitidas";
+    std::cout << ") en " << std::fixed << std::setprecision(2) << wallTime << " s\n";
+    std::cout << "Resultados: " << (baseDir / "consolidated_system_stats.csv").string() << "\n";
+    return (ingested.empty()) ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+#!/bin/bash
+
+# ============================================================================
+# Suite de Benchmarks de Escalado 5G - Coste del simulador
+# Barridos: numUEs, numCells (malla hexagonal) e intervalo URLLC, con semilla fija.
+# Uso: ./run_benchmark_suite.sh [--binary RUTA] [--baseline ARCHIVO] [--update-baseline]
+#                               [--tolerance PCT] [--mem-tolerance PCT] [--quick]
+# ============================================================================
+
+# Configuración base
+SCRIPT_NAME="nr_multi_cell_optimized"
+BENCH_OUTPUT_DIR="./benchmark_results"
+BASELINE_FILE="./benchmark_baseline.csv"
+SIMULATION_TIME=3   # Con --autoWarmup el tráfico arranca al conectarse los UEs
+APP_START_LIMIT=1.5 # Límite del warm-up: el tráfico arranca aunque no se detecte la conexión
+RNG_SEED=1
+RNG_RUN=1
+
+# Barridos (cada caso varía un solo parámetro respecto al punto base)
+UE_SWEEP=(30 100 300 1000 2000)          # con HEX_TIERS_BASE
+TIER_SWEEP=(0 1 2 3)                     # 1, 7, 19, 37 celdas con UES_BASE
+URLLC_SWEEP=(0.002 0.001 0.0005)         # intervalo URLLC (s) con el punto base
+UES_BASE=300
+HEX_TIERS_BASE=1
+
+# Opciones (ver parse_args)
+SIM_BINARY=""
+UPDATE_BASELINE=false
+TOLERANCE=15        # % de empeoramiento admitido en tiempo y eventos/s
+MEM_TOLERANCE=10    # % de empeoramiento admitido en memoria
+
+# Colores para output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+CYAN='\033[0;36m'
+NC='\033[0m' # No Color
+
+# ==================== FUNCIONES DE LOGGING ====================
+log() {
+    echo -e "${BLUE}[$(date '+%H:%M:%S')]${NC} $1"
+}
+
+error() {
+    echo -e "${RED}[ERROR $(date '+%H:%M:%S')]${NC} $1" >&2
+}
+
+success() {
+    echo -e "${GREEN}[SUCCESS $(date '+%H:%M:%S')]${NC} $1"
+}
+
+warning() {
+    echo -e "${YELLOW}[WARNING $(date '+%H:%M:%S')]${NC} $1"
+}
+
+info() {
+    echo -e "${CYAN}[INFO $(date '+%H:%M:%S')]${NC} $1"
+}
+
+# ==================== OPCIONES DE LÍNEA DE COMANDOS ====================
+usage() {
+    echo "Uso: $0 [opciones]"
+    echo "      --binary RUTA        Binario precompilado (por defecto se compila una vez con ./ns3)"
+    echo "      --baseline ARCHIVO   Referencia con la que comparar (por defecto $BASELINE_FILE)"
+    echo "      --update-baseline    Guardar los resultados de esta ejecución como referencia"
+    echo "      --tolerance PCT      Empeoramiento admitido en tiempo y eventos/s (por defecto $TOLERANCE%)"
+    echo "      --mem-tolerance PCT  Empeoramiento admitido en memoria (por defecto $MEM_TOLERANCE%)"
+    echo "      --quick              Barrido reducido (comprobación rápida)"
+    echo "  -h, --help               Mostrar esta ayuda"
+}
+
+parse_args() {
+    while [ $# -gt 0 ]; do
+        case "$1" in
+            --binary)          SIM_BINARY="$2"; shift 2 ;;
+            --binary=*)        SIM_BINARY="${1#*=}"; shift ;;
+            --baseline)        BASELINE_FILE="$2"; shift 2 ;;
+            --baseline=*)      BASELINE_FILE="${1#*=}"; shift ;;
+            --update-baseline) UPDATE_BASELINE=true; shift ;;
+            --tolerance)       TOLERANCE="$2"; shift 2 ;;
+            --tolerance=*)     TOLERANCE="${1#*=}"; shift ;;
+            --mem-tolerance)   MEM_TOLERANCE="$2"; shift 2 ;;
+            --mem-tolerance=*) MEM_TOLERANCE="${1#*=}"; shift ;;
+            --quick)
+                UE_SWEEP=(30 100 300)
+                TIER_SWEEP=(0 1)
+                URLLC_SWEEP=(0.001)
+                UES_BASE=100
+                shift ;;
+            -h|--help)         usage; exit 0 ;;
+            *)                 error "Opción desconocida: $1"; usage; exit 1 ;;
+        esac
+    done
+}
+
+# Compila una sola vez y localiza el binario para ejecutarlo sin ./ns3 run
+locate_simulation_binary() {
+    if [ -n "$SIM_BINARY" ]; then
+        if [ ! -x "$SIM_BINARY" ]; then
+            error "Binario no ejecutable: $SIM_BINARY"
+            return 1
+        fi
+        return 0
+    fi
+    
+    log "Compilando ${SCRIPT_NAME} (una sola vez)..."
+    if ! ./ns3 build "$SCRIPT_NAME" > /dev/null 2>&1; then
+        error "Falló la compilación de scratch/${SCRIPT_NAME}.cc"
+        return 1
+    fi
+    
+    SIM_BINARY=$(ls -t build/scratch/ns3*-"${SCRIPT_NAME}"-* 2>/dev/null | head -1)
+    if [ -z "$SIM_BINARY" ] || [ ! -x "$SIM_BINARY" ]; then
+        error "No se encontró el binario compilado en build/scratch/"
+        return 1
+    fi
+    
+    export LD_LIBRARY_PATH="$(pwd)/build/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+    success "Binario: $SIM_BINARY"
+    return 0
+}
+
+# ==================== EJECUCIÓN DE UN CASO ====================
+# Valor de una métrica de perf_stats (Metric,Value,Unit)
+perf_value() {
+    awk -F, -v m="$2" '$1 == m { print $2; found = 1 } END { if (!found) print 0 }' "$1"
+}
+
+# Ejecuta un caso y añade su fila a RESULTS_FILE
+# Argumentos: nombre carga num_ues hex_tiers urllc_interval
+run_case() {
+    local name=$1
+    local load=$2
+    local num_ues=$3
+    local tiers=$4
+    local interval=$5
+    local output_dir="$BENCH_OUTPUT_DIR/$name"
+    
+    rm -rf "$output_dir"
+    mkdir -p "$output_dir"
+    
+    local cmd=("$SIM_BINARY"
+        --layout=hex
+        --hexTiers=$tiers
+        --numUEs=$num_ues
+        --urllcInterval=$interval
+        --simTime=$SIMULATION_TIME
+        --appStartTime=$APP_START_LIMIT
+        --denseScenario=true
+        --autoWarmup=true
+        --profileCallbacks=true
+        --rngSeed=$RNG_SEED
+        --runStart=$RNG_RUN
+        --outputDir=$output_dir)
+    
+    log "Caso $name: ${num_ues} UEs, hexTiers=${tiers}, intervalo URLLC ${interval} s"
+    if ! "${cmd[@]}" > "$output_dir/simulation.log" 2>&1; then
+        error "   ✗ $name falló (ver $output_dir/simulation.log)"
+        return 1
+    fi
+    
+    local perf_file=$(ls "$output_dir"/perf_stats_optimized_*cell.csv 2>/dev/null | head -1)
+    if [ -z "$perf_file" ]; then
+        error "   ✗ $name no generó perf_stats"
+        return 1
+    fi
+    
+    local num_cells=$(basename "$perf_file" | sed 's/^perf_stats_optimized_\([0-9]*\)cell\.csv$/\1/')
+    local callback_time=$(awk -F, '$1 ~ /CallbackTime$/ { s += $2 } END { printf "%.6f", s }' "$perf_file")
+    
+    echo "$name,$load,$num_ues,$num_cells,$interval,$(perf_value "$perf_file" WallTimeTotal),$(perf_value "$perf_file" WallTimeSimulatorRun),$(perf_value "$perf_file" EventsPerWallSecond),$callback_time,$(perf_value "$perf_file" PeakRss)" >> "$RESULTS_FILE"
+    success "   ✓ $name: $(perf_value "$perf_file" WallTimeSimulatorRun) s en Simulator::Run()"
+    return 0
+}
+
+# ==================== ESCALADO ====================
+# Escalado relativo al primer caso de cada barrido: 1.0 = lineal con la carga,
+# >1 = peor que lineal
+add_scaling_column() {
+    awk -F, 'BEGIN { OFS = "," }
+             NR == 1 { print $0, "Scaling"; next }
+             {
+                 group = $1; sub(/_.*/, "", group)
+                 if (!(group in baseLoad)) { baseLoad[group] = $2; baseRun[group] = $7 }
+                 scaling = (baseRun[group] > 0 && $2 > 0) ? ($7 / baseRun[group]) / ($2 / baseLoad[group]) : 0
+                 print $0, sprintf("%.3f", scaling)
+             }' "$RESULTS_FILE" > "$RESULTS_FILE.tmp" && mv "$RESULTS_FILE.tmp" "$RESULTS_FILE"
+}
+
+# ==================== COMPARACIÓN CON LA REFERENCIA ====================
+# Devuelve 2 si algún caso empeora más que la tolerancia
+compare_with_baseline() {
+    if [ ! -f "$BASELINE_FILE" ]; then
+        warning "No hay referencia en $BASELINE_FILE (usa --update-baseline para crearla)"
+        return 0
+    fi
+    
+    log "Comparando con $BASELINE_FILE (tolerancia ${TOLERANCE}%, memoria ${MEM_TOLERANCE}%)"
+    awk -F, -v tol="$TOLERANCE" -v memtol="$MEM_TOLERANCE" '
+        FNR == 1 { next }
+        NR == FNR { run[$1] = $7; eps[$1] = $8; rss[$1] = $10; next }
+        {
+            if (!($1 in run)) { printf "   ? %-14s sin referencia\n", $1; next }
+            mark = "✓"; note = ""
+            dRun = (run[$1] > 0) ? 100 * ($7 - run[$1]) / run[$1] : 0
+            dEps = (eps[$1] > 0) ? 100 * ($8 - eps[$1]) / eps[$1] : 0
+            dRss = (rss[$1] > 0) ? 100 * ($10 - rss[$1]) / rss[$1] : 0
+            if (dRun > tol || -dEps > tol || dRss > memtol) { mark = "✗"; note = "  REGRESIÓN"; bad++ }
+            printf "   %s %-14s Run %+6.1f%%  eventos/s %+6.1f%%  RSS %+6.1f%%%s\n", mark, $1, dRun, dEps, dRss, note
+        }
+        END { exit (bad > 0) ? 2 : 0 }' "$BASELINE_FILE" "$RESULTS_FILE"
+}
+
+# ==================== FUNCIÓN PRINCIPAL ====================
+main() {
+    parse_args "$@"
+    locate_simulation_binary || exit 1
+    
+    mkdir -p "$BENCH_OUTPUT_DIR"
+    RESULTS_FILE="$BENCH_OUTPUT_DIR/benchmark_results.csv"
+    echo "Case,Load,NumUEs,NumCells,UrllcInterval(s),WallTimeTotal(s),WallTimeRun(s),EventsPerWallSecond,CallbackTime(s),PeakRss(MB)" > "$RESULTS_FILE"
+    
+    # Secuencial a propósito: ejecutar casos en paralelo falsearía los tiempos
+    local failed=0
+    for ues in "${UE_SWEEP[@]}"; do
+        run_case "ues_${ues}" "$ues" "$ues" "$HEX_TIERS_BASE" 0 || failed=$((failed + 1))
+    done
+    for tiers in "${TIER_SWEEP[@]}"; do
+        local cells=$((3 * tiers * (tiers + 1) + 1))
+        run_case "cells_${cells}" "$cells" "$UES_BASE" "$tiers" 0 || failed=$((failed + 1))
+    done
+    for interval in "${URLLC_SWEEP[@]}"; do
+        local rate=$(awk -v i="$interval" 'BEGIN { printf "%.0f", 1 / i }')
+        run_case "urllc_${interval}" "$rate" "$UES_BASE" "$HEX_TIERS_BASE" "$interval" || failed=$((failed + 1))
+    done
+    
+    add_scaling_column
+    info "Resultados: $RESULTS_FILE"
+    column -t -s, "$RESULTS_FILE" 2>/dev/null || cat "$RESULTS_FILE"
+    echo ""
+    
+    local status=0
+    if [ "$UPDATE_BASELINE" = true ]; then
+        cp "$RESULTS_FILE" "$BASELINE_FILE"
+        success "Referencia actualizada: $BASELINE_FILE"
+    else
+        compare_with_baseline
+        status=$?
+    fi
+    
+    if [ $failed -gt 0 ]; then
+        error "$failed casos fallaron"
+        exit 1
+    fi
+    if [ $status -ne 0 ]; then
+        error "Regresiones de rendimiento respecto a la referencia"
+        exit $status
+    fi
+    success "Benchmark completado"
+}
+
+main "$@"
@@ -1,12 +1,15 @@
 #!/bin/bash
 
 # ============================================================================
-# Script de Simulación Secuencial 5G - Ejecución Ordenada
-# Una simulación a la vez: 1sparse → 1dense → 3sparse → 3dense → etc.
+# Script de Simulación por Lotes 5G - Ejecución Ordenada
+# Orden: 1sparse → 1dense → 3sparse → 3dense → etc.
+# Uso: ./run_simulation_batch.sh [--jobs N|auto] [--yes] [--no-resume] [--binary RUTA]
+#                                [--stall-timeout S] [--timeout S]
 # ============================================================================
 
 # Configuración base
 SCRIPT_NAME="nr_multi_cell_optimized"
+CONSOLIDATE_NAME="nr_results_consolidate"  # Consolidación de resultados (C++)
 BASE_OUTPUT_DIR="./simulation_results"
 SIMULATION_TIME=15
 NUM_UES=30
@@ -19,11 +22,28 @@ HO_ALGORITHM="A2A4"
 CELL_NUMBERS=(1 3 5 7 9)
 SCENARIOS=("false" "true")  # false=sparse, true=dense
 SCENARIO_NAMES=("sparse" "dense")
-SEEDS=(1)  # Múltiples semillas para robustez estadística
+SEEDS=(1)  # Valores de RngRun (subflujos independientes) para robustez estadística
+RNG_SEED=1 # Semilla global común a todas las réplicas
 
-# Tiempo estimado por simulación (en segundos)
+# Tiempo estimado por simulación (en segundos) - solo hasta tener mediciones
 ESTIMATED_TIME_PER_SIM=180
 
+# Opciones de ejecución (ver parse_args)
+JOBS=1              # Simulaciones simultáneas
+ASSUME_YES=false    # Sin confirmación interactiva
+RESUME=true         # Saltar simulaciones con resultados ya verificados
+SIM_BINARY=""       # Binario precompilado de la simulación
+CONSOLIDATE_BINARY="" # Binario de consolidación (junto al de la simulación)
+OUTPUT_FORMAT=csv   # Formato de las tablas: csv, binary (.nrcb) o both
+AUTO_STOP=false     # Warm-up por RRC y parada por convergencia (simTime como límite)
+STALL_TIMEOUT=600   # s sin latido del archivo de estado antes de abortar una simulación
+RUN_TIMEOUT=0       # s máximos de pared por simulación (0 = sin límite)
+
+# Supervisión a partir del latido de la simulación (--statusFile)
+STATUS_FILE_NAME="status.txt"
+POLL_INTERVAL=5           # s entre lecturas del archivo de estado
+STATUS_REPORT_INTERVAL=60 # s entre líneas de progreso de cada simulación
+
 # Colores para output
 RED='\033[0;31m'
 GREEN='\033[0;32m'
@@ -33,6 +53,10 @@ CYAN='\033[0;36m'
 MAGENTA='\033[0;35m'
 NC='\033[0m' # No Color
 
+# Simulaciones en segundo plano: PID -> directorio de salida y coste previsto (s)
+declare -A RUNNING_DIRS=()
+declare -A RUNNING_COSTS=()
+
 # ==================== FUNCIONES DE LOGGING ====================
 log() {
     echo -e "${BLUE}[$(date '+%H:%M:%S')]${NC} $1"
@@ -58,20 +82,74 @@ progress() {
     echo -e "${MAGENTA}[PROGRESS $(date '+%H:%M:%S')]${NC} $1"
 }
 
+# ==================== OPCIONES DE LÍNEA DE COMANDOS ====================
+usage() {
+    echo "Uso: $0 [opciones]"
+    echo "  -j, --jobs N|auto   Simulaciones en paralelo (auto = núcleos disponibles)"
+    echo "  -y, --yes           No pedir confirmación"
+    echo "      --no-resume     Repetir también las simulaciones ya verificadas"
+    echo "      --binary RUTA   Binario precompilado (por defecto se compila una vez con ./ns3)"
+    echo "      --output-format F  Formato de las tablas: csv|binary|both"
+    echo "      --auto-stop     Warm-up automático y parada al converger las métricas"
+    echo "      --stall-timeout S  Abortar una simulación sin latido durante S segundos (0 = nunca)"
+    echo "      --timeout S     Tiempo de pared máximo por simulación (0 = sin límite)"
+    echo "  -h, --help          Mostrar esta ayuda"
+}
+
+parse_args() {
+    while [ $# -gt 0 ]; do
+        case "$1" in
+            -j|--jobs)   JOBS="$2"; shift 2 ;;
+            --jobs=*)    JOBS="${1#*=}"; shift ;;
+            -y|--yes)    ASSUME_YES=true; shift ;;
+            --no-resume) RESUME=false; shift ;;
+            --binary)    SIM_BINARY="$2"; shift 2 ;;
+            --binary=*)  SIM_BINARY="${1#*=}"; shift ;;
+            --output-format)   OUTPUT_FORMAT="$2"; shift 2 ;;
+            --output-format=*) OUTPUT_FORMAT="${1#*=}"; shift ;;
+            --auto-stop) AUTO_STOP=true; shift ;;
+            --stall-timeout)   STALL_TIMEOUT="$2"; shift 2 ;;
+            --stall-timeout=*) STALL_TIMEOUT="${1#*=}"; shift ;;
+            --timeout)   RUN_TIMEOUT="$2"; shift 2 ;;
+            --timeout=*) RUN_TIMEOUT="${1#*=}"; shift ;;
+            -h|--help)   usage; exit 0 ;;
+            *)           error "Opción desconocida: $1"; usage; exit 1 ;;
+        esac
+    done
+    
+    if [ "$JOBS" == "auto" ]; then
+        JOBS=$(nproc 2>/dev/null || echo 1)
+    fi
+    if ! [[ "$JOBS" =~ ^[0-9]+$ ]] || [ "$JOBS" -lt 1 ]; then
+        error "Valor inválido para --jobs: $JOBS"
+        exit 1
+    fi
+    if ! [[ "$STALL_TIMEOUT" =~ ^[0-9]+$ ]] || ! [[ "$RUN_TIMEOUT" =~ ^[0-9]+$ ]]; then
+        error "--stall-timeout y --timeout deben ser un número de segundos"
+        exit 1
+    fi
+    case "$OUTPUT_FORMAT" in
+        csv|binary|both) ;;
+        *) error "Valor inválido para --output-format: $OUTPUT_FORMAT"; exit 1 ;;
+    esac
+}
+
 # ==================== FUNCIONES DE VALIDACIÓN ====================
 check_requirements() {
     log "Verificando requisitos del sistema..."
     
-    # Verificar ns3
-    if ! command -v ./ns3 &> /dev/null; then
-        error "ns3 no encontrado. Asegúrate de estar en el directorio raíz de ns-3."
-        return 1
-    fi
-    
-    # Verificar script de simulación
-    if [ ! -f "scratch/${SCRIPT_NAME}.cc" ]; then
-        error "Script de simulación no encontrado: scratch/${SCRIPT_NAME}.cc"
-        return 1
+    if [ -z "$SIM_BINARY" ]; then
+        # Verificar ns3
+        if ! command -v ./ns3 &> /dev/null; then
+            error "ns3 no encontrado. Asegúrate de estar en el directorio raíz de ns-3."
+            return 1
+        fi
+        
+        # Verificar script de simulación
+        if [ ! -f "scratch/${SCRIPT_NAME}.cc" ]; then
+            error "Script de simulación no encontrado: scratch/${SCRIPT_NAME}.cc"
+            return 1
+        fi
     fi
     
     # Verificar espacio en disco (al menos 1GB)
@@ -84,14 +162,211 @@ check_requirements() {
     return 0
 }
 
+# Compila una sola vez y localiza el binario para ejecutarlo sin ./ns3 run
+locate_simulation_binary() {
+    if [ -n "$SIM_BINARY" ]; then
+        if [ ! -x "$SIM_BINARY" ]; then
+            error "Binario no ejecutable: $SIM_BINARY"
+            return 1
+        fi
+        return 0
+    fi
+    
+    log "Compilando ${SCRIPT_NAME} (una sola vez)..."
+    if ! ./ns3 build "$SCRIPT_NAME" > /dev/null 2>&1; then
+        error "Falló la compilación de scratch/${SCRIPT_NAME}.cc"
+        return 1
+    fi
+    
+    SIM_BINARY=$(ls -t build/scratch/ns3*-"${SCRIPT_NAME}"-* 2>/dev/null | head -1)
+    if [ -z "$SIM_BINARY" ] || [ ! -x "$SIM_BINARY" ]; then
+        error "No se encontró el binario compilado en build/scratch/"
+        return 1
+    fi
+    
+    export LD_LIBRARY_PATH="$(pwd)/build/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+    success "Binario: $SIM_BINARY"
+    return 0
+}
+
+# La consolidación se compila aparte; si falta, solo se avisa al final
+locate_consolidate_binary() {
+    if [ -n "$CONSOLIDATE_BINARY" ]; then
+        return 0
+    fi
+    
+    # Con --binary se busca el binario hermano del mismo build
+    local candidate="${SIM_BINARY/$SCRIPT_NAME/$CONSOLIDATE_NAME}"
+    if [ "$candidate" != "$SIM_BINARY" ] && [ -x "$candidate" ]; then
+        CONSOLIDATE_BINARY="$candidate"
+        return 0
+    fi
+    
+    if [ -f "scratch/${CONSOLIDATE_NAME}.cc" ] && command -v ./ns3 &> /dev/null; then
+        log "Compilando ${CONSOLIDATE_NAME}..."
+        if ./ns3 build "$CONSOLIDATE_NAME" > /dev/null 2>&1; then
+            CONSOLIDATE_BINARY=$(ls -t build/scratch/ns3*-"${CONSOLIDATE_NAME}"-* 2>/dev/null | head -1)
+        fi
+    fi
+    [ -n "$CONSOLIDATE_BINARY" ] && [ -x "$CONSOLIDATE_BINARY" ]
+}
+
+# Duración media medida (archivos .duration), o la estimación fija si aún no hay datos
+measured_time_per_sim() {
+    find "$BASE_OUTPUT_DIR" -name ".duration" -exec cat {} + 2>/dev/null | \
+        awk -v def="$ESTIMATED_TIME_PER_SIM" '{ s += $1; n++ } END { if (n > 0) printf "%d", s / n; else print def }'
+}
+
+format_duration() {
+    local seconds=$1
+    echo "$((seconds / 3600))h $(((seconds % 3600) / 60))m"
+}
+
+# Tiempo restante para N simulaciones repartidas entre JOBS procesos
+remaining_time_for() {
+    local remaining=$1
+    local per_sim=$(measured_time_per_sim)
+    local waves=$(((remaining + JOBS - 1) / JOBS))
+    format_duration $((waves * per_sim))
+}
+
 estimate_total_time() {
     local total_sims=$((${#CELL_NUMBERS[@]} * ${#SCENARIOS[@]} * ${#SEEDS[@]}))
-    local estimated_seconds=$((total_sims * ESTIMATED_TIME_PER_SIM))
-    local hours=$((estimated_seconds / 3600))
-    local minutes=$(((estimated_seconds % 3600) / 60))
+    local per_sim=$(measured_time_per_sim)
     
-    info "Tiempo estimado total: ${hours}h ${minutes}m para $total_sims simulaciones"
-    info "Tiempo promedio por simulación: $((ESTIMATED_TIME_PER_SIM / 60)) minutos"
+    info "Tiempo estimado total: $(remaining_time_for $total_sims) para $total_sims simulaciones ($JOBS en paralelo)"
+    info "Tiempo promedio por simulación: $((per_sim / 60)) minutos"
+}
+
+# UEs de un escenario (el denso lleva un 50% más)
+ues_for() {
+    if [ "$1" == "true" ]; then echo $((NUM_UES * 3 / 2)); else echo $NUM_UES; fi
+}
+
+# Coste previsto (s) de una simulación: la media de las duraciones medidas para
+# la misma configuración (otras semillas o ejecuciones anteriores); si no hay,
+# la media global escalada por la carga celdas × UEs frente a la carga media
+# del plan
+predicted_cost() {
+    local cells=$1
+    local dense=$2
+    local scenario_name=$3
+    local mean_load=$4
+    
+    local measured=$(cat "${BASE_OUTPUT_DIR}/${cells}cell_${scenario_name}_seed"*/.duration 2>/dev/null | \
+        awk '{ s += $1; n++ } END { if (n > 0) printf "%d", s / n }')
+    if [ -n "$measured" ]; then
+        echo "$measured"
+        return
+    fi
+    local load=$((cells * $(ues_for "$dense")))
+    echo $(( $(measured_time_per_sim) * load / (mean_load > 0 ? mean_load : 1) ))
+}
+
+# Coste previsto total de las simulaciones en cola ("celdas denso escenario ...");
+# se recalcula tras cada simulación para aprovechar las duraciones recién medidas
+queued_cost_of() {
+    local mean_load=$1
+    shift
+    local total=0
+    local spec
+    for spec in "$@"; do
+        local fields=($spec)
+        total=$((total + $(predicted_cost "${fields[0]}" "${fields[1]}" "${fields[2]}" $mean_load)))
+    done
+    echo $total
+}
+
+# Campo clave=valor del archivo de estado de una simulación (vacío si no existe)
+status_field() {
+    awk -F= -v key="$2" '$1 == key { print $2; exit }' "$1" 2>/dev/null
+}
+
+# Segundos desde el último latido; vacío si la simulación aún no ha escrito ninguno
+status_age() {
+    local updated=$(status_field "$1" updated)
+    [ -n "$updated" ] && echo $(( $(date +%s) - updated ))
+}
+
+# Tiempo restante (s): la ETA publicada por las simulaciones en curso (o su
+# coste previsto hasta que la publican) más el coste previsto de la cola,
+# repartido entre JOBS procesos; nunca menos que la simulación en curso más larga
+remaining_work_eta() {
+    local queued_cost=$1
+    local total=$queued_cost
+    local longest=0
+    local pid
+    for pid in "${!RUNNING_DIRS[@]}"; do
+        local eta=$(status_field "${RUNNING_DIRS[$pid]}/$STATUS_FILE_NAME" etaSeconds)
+        if [ -z "$eta" ] || [ "$eta" -lt 0 ]; then
+            eta=${RUNNING_COSTS[$pid]}
+        fi
+        total=$((total + eta))
+        [ "$eta" -gt "$longest" ] && longest=$eta
+    done
+    local eta=$(((total + JOBS - 1) / JOBS))
+    echo $((eta > longest ? eta : longest))
+}
+
+# Deja de contar en la ETA las simulaciones en segundo plano ya terminadas
+forget_finished_jobs() {
+    local pid
+    for pid in "${!RUNNING_DIRS[@]}"; do
+        if ! kill -0 "$pid" 2>/dev/null; then
+            unset "RUNNING_DIRS[$pid]" "RUNNING_COSTS[$pid]"
+        fi
+    done
+}
+
+# Vigila una simulación lanzada en segundo plano a partir de su latido: la
+# aborta si deja de actualizarlo durante STALL_TIMEOUT s o si supera
+# RUN_TIMEOUT s, y devuelve su código de salida. El latido solo avanza dentro
+# de Simulator::Run(), así que el atasco se comprueba únicamente en el estado
+# running; la preparación y el postproceso quedan acotados por RUN_TIMEOUT
+supervise_simulation() {
+    local sim_pid=$1
+    local status_file=$2
+    local log_file=$3
+    local start_time=$(date +%s)
+    local last_report=$start_time
+    local reason=""
+    
+    while kill -0 "$sim_pid" 2>/dev/null; do
+        sleep "$POLL_INTERVAL"
+        kill -0 "$sim_pid" 2>/dev/null || break
+        
+        local now=$(date +%s)
+        local state=$(status_field "$status_file" state)
+        local age=$(status_age "$status_file")
+        [ -z "$age" ] && age=0
+        
+        if [ "$STALL_TIMEOUT" -gt 0 ] && [ "$state" = "running" ] && [ "$age" -gt "$STALL_TIMEOUT" ]; then
+            reason="sin latido durante ${age}s (estado: $state)"
+        elif [ "$RUN_TIMEOUT" -gt 0 ] && [ $((now - start_time)) -gt "$RUN_TIMEOUT" ]; then
+            reason="superado el límite de ${RUN_TIMEOUT}s"
+        fi
+        if [ -n "$reason" ]; then
+            error "Simulación abortada: $reason"
+            echo "--- ABORTADA: $reason $(date) ---" >> "$log_file"
+            kill -TERM "$sim_pid" 2>/dev/null
+            sleep "$POLL_INTERVAL"
+            kill -KILL "$sim_pid" 2>/dev/null
+            break
+        fi
+        
+        if [ $((now - last_report)) -ge "$STATUS_REPORT_INTERVAL" ] && [ -s "$status_file" ]; then
+            local eta=$(status_field "$status_file" etaSeconds)
+            [ -n "$eta" ] && [ "$eta" -ge 0 ] && eta=$(format_duration "$eta") || eta="?"
+            local sim_time="$(status_field "$status_file" simTime)/$(status_field "$status_file" simEnd)s"
+            info "   t=$sim_time ($(status_field "$status_file" state)) - velocidad $(status_field "$status_file" recentSpeed)x - $(status_field "$status_file" rssMb) MB - restante $eta"
+            last_report=$now
+        fi
+    done
+    
+    wait "$sim_pid"
+    local rc=$?
+    [ -n "$reason" ] && return 124
+    return $rc
 }
 
 # ==================== FUNCIÓN PRINCIPAL DE SIMULACIÓN ====================
@@ -111,10 +386,7 @@ run_single_simulation() {
     echo "╚════════════════════════════════════════════════════════════════════════════════╝"
     
     # Calcular número de UEs según escenario
-    local ues_for_scenario=$NUM_UES
-    if [ "$dense_flag" == "true" ]; then
-        ues_for_scenario=$((NUM_UES * 3 / 2))  # 50% más UEs en escenario denso
-    fi
+    local ues_for_scenario=$(ues_for "$dense_flag")
     
     # Directorio de salida específico
     local output_dir="${BASE_OUTPUT_DIR}/${num_cells}cell_${scenario_name}_seed${seed}"
@@ -122,6 +394,8 @@ run_single_simulation() {
     
     # Archivo de log para esta simulación
     local log_file="${output_dir}/simulation.log"
+    local status_file="${output_dir}/${STATUS_FILE_NAME}"
+    rm -f "$status_file"
     
     log "Configuración detallada:"
     echo "   • Número de celdas: $num_cells"
@@ -131,47 +405,51 @@ run_single_simulation() {
     echo "   • Directorio salida: $output_dir"
     echo ""
     
-    # Comando de simulación
-    local cmd="./ns3 run \"scratch/$SCRIPT_NAME.cc \
-        --numCells=$num_cells \
-        --numUEs=$ues_for_scenario \
-        --embbRatio=$EMBB_RATIO \
-        --ISD=$ISD \
-        --simTime=$SIMULATION_TIME \
-        --outputDir=$output_dir \
-        --scheduler=$SCHEDULER \
-        --hoAlgorithm=$HO_ALGORITHM \
-        --denseScenario=$dense_flag \
-        --rngSeed=$seed\""
+    # Comando de simulación (binario precompilado, sin pasar por ./ns3 run)
+    local cmd=("$SIM_BINARY"
+        --numCells=$num_cells
+        --numUEs=$ues_for_scenario
+        --embbRatio=$EMBB_RATIO
+        --ISD=$ISD
+        --simTime=$SIMULATION_TIME
+        --outputDir=$output_dir
+        --scheduler=$SCHEDULER
+        --hoAlgorithm=$HO_ALGORITHM
+        --denseScenario=$dense_flag
+        --rngSeed=$RNG_SEED
+        --runStart=$seed
+        --outputFormat=$OUTPUT_FORMAT
+        --autoWarmup=$AUTO_STOP
+        --autoStop=$AUTO_STOP
+        --statusFile=$status_file)
     
     log "Ejecutando simulación..."
-    echo "Comando: $cmd" | tee "$log_file"
+    echo "Comando: ${cmd[*]}" | tee "$log_file"
     echo ""
     
     # Mostrar progreso estimado
     local remaining_sims=$((total_sims - sim_number + 1))
-    local remaining_time=$((remaining_sims * ESTIMATED_TIME_PER_SIM))
-    local remaining_hours=$((remaining_time / 3600))
-    local remaining_minutes=$(((remaining_time % 3600) / 60))
-    info "Tiempo restante estimado: ${remaining_hours}h ${remaining_minutes}m"
+    info "Tiempo restante estimado: $(remaining_time_for $remaining_sims)"
     
     # Ejecutar simulación
     local start_time=$(date +%s)
     echo "--- INICIO DE SIMULACIÓN $(date) ---" >> "$log_file"
     
-    if eval $cmd >> "$log_file" 2>&1; then
+    "${cmd[@]}" >> "$log_file" 2>&1 &
+    if supervise_simulation $! "$status_file" "$log_file"; then
         local end_time=$(date +%s)
         local duration=$((end_time - start_time))
         local duration_min=$((duration / 60))
         local duration_sec=$((duration % 60))
         
         echo "--- FIN DE SIMULACIÓN $(date) ---" >> "$log_file"
+        echo "$duration" > "$output_dir/.duration"
         success "✅ Simulación completada en ${duration_min}m ${duration_sec}s"
         
         # Verificar archivos de salida
         verify_output_files "$output_dir" "$num_cells"
         
-        return 0
+        return $?
     else
         local end_time=$(date +%s)
         local duration=$((end_time - start_time))
@@ -184,16 +462,22 @@ run_single_simulation() {
 }
 
 # ==================== VERIFICACIÓN DE ARCHIVOS DE SALIDA ====================
+# Extensión de las tablas que se verifican (con "both" basta el CSV)
+table_ext() {
+    if [ "$OUTPUT_FORMAT" == "binary" ]; then echo "nrcb"; else echo "csv"; fi
+}
+
 verify_output_files() {
     local output_dir=$1
     local num_cells=$2
+    local ext=$(table_ext)
     
     log "Verificando archivos de salida..."
     
     local expected_files=(
-        "$output_dir/flow_stats_optimized_${num_cells}cell.csv"
-        "$output_dir/cell_stats_optimized_${num_cells}cell.csv"
-        "$output_dir/system_stats_optimized_${num_cells}cell.csv"
+        "$output_dir/flow_stats_optimized_${num_cells}cell.$ext"
+        "$output_dir/cell_stats_optimized_${num_cells}cell.$ext"
+        "$output_dir/system_stats_optimized_${num_cells}cell.$ext"
         "$output_dir/simulation_config_optimized_${num_cells}cell.txt"
     )
     
@@ -216,11 +500,30 @@ verify_output_files() {
     fi
 }
 
+# Resultados completos de una ejecución anterior (para reanudar sin repetirla)
+output_already_verified() {
+    local output_dir=$1
+    local num_cells=$2
+    local ext=$(table_ext)
+    local system_file="$output_dir/system_stats_optimized_${num_cells}cell.$ext"
+    
+    [ -s "$output_dir/flow_stats_optimized_${num_cells}cell.$ext" ] || return 1
+    [ -s "$output_dir/cell_stats_optimized_${num_cells}cell.$ext" ] || return 1
+    [ -s "$output_dir/simulation_config_optimized_${num_cells}cell.txt" ] || return 1
+    [ -s "$system_file" ] || return 1
+    if [ "$ext" == "nrcb" ]; then
+        [ "$(head -c 4 "$system_file")" == "NRCB" ]
+    else
+        grep -q "^TotalSystemThroughput," "$system_file"
+    fi
+}
+
 # ==================== FUNCIÓN DE RESUMEN DE PROGRESO ====================
 show_progress_summary() {
     local completed=$1
     local total=$2
     local failed=$3
+    local queued_cost=${4:-0}
     
     echo ""
     echo "╔════════════════════════════════════════════════════════════════════════════════╗"
@@ -233,10 +536,7 @@ show_progress_summary() {
     
     if [ $completed -lt $total ]; then
         local remaining=$((total - completed))
-        local remaining_time=$((remaining * ESTIMATED_TIME_PER_SIM))
-        local remaining_hours=$((remaining_time / 3600))
-        local remaining_minutes=$(((remaining_time % 3600) / 60))
-        echo "   ⏱️  Tiempo restante estimado: ${remaining_hours}h ${remaining_minutes}m"
+        echo "   ⏱️  Tiempo restante estimado: $(format_duration $(remaining_work_eta $queued_cost)) para $remaining simulaciones (media medida: $(measured_time_per_sim)s/sim)"
     fi
     echo ""
 }
@@ -255,7 +555,7 @@ generate_quick_report() {
         echo "============================================"
         echo "Simulaciones completadas: $completed_sims"
         echo "Simulaciones fallidas: $failed_sims"
-        echo "Tasa de éxito: $(( (completed_sims - failed_sims) * 100 / completed_sims ))%"
+        echo "Tasa de éxito: $(( (completed_sims - failed_sims) * 100 / (completed_sims > 0 ? completed_sims : 1) ))%"
         echo ""
         echo "DIRECTORIOS GENERADOS:"
         find "$BASE_OUTPUT_DIR" -maxdepth 1 -type d -name "*cell_*" | sort
@@ -272,16 +572,22 @@ generate_quick_report() {
 main() {
     echo ""
     echo "╔════════════════════════════════════════════════════════════════════════════════╗"
-    echo "║                    SIMULADOR SECUENCIAL 5G NR - OPTIMIZADO                   ║"
-    echo "║                         Ejecución Ordenada Una a Una                         ║"
+    echo "║                     SIMULADOR POR LOTES 5G NR - OPTIMIZADO                   ║"
+    echo "║                  Ejecución ordenada, secuencial o en paralelo                ║"
     echo "╚════════════════════════════════════════════════════════════════════════════════╝"
     echo ""
     
+    parse_args "$@"
+    
     # Verificar requisitos
     if ! check_requirements; then
         exit 1
     fi
     
+    if ! locate_simulation_binary; then
+        exit 1
+    fi
+    
     # Crear directorio base
     mkdir -p "$BASE_OUTPUT_DIR"
     
@@ -289,12 +595,15 @@ main() {
     local total_sims=$((${#CELL_NUMBERS[@]} * ${#SCENARIOS[@]} * ${#SEEDS[@]}))
     
     # Mostrar plan de ejecución
-    echo "📋 PLAN DE EJECUCIÓN SECUENCIAL:"
+    echo "📋 PLAN DE EJECUCIÓN:"
     echo "   • Total de simulaciones: $total_sims"
+    echo "   • Simulaciones en paralelo: $JOBS"
+    echo "   • Reanudar (saltar verificadas): $RESUME"
     echo "   • Configuraciones de celdas: ${CELL_NUMBERS[*]}"
     echo "   • Escenarios por configuración: ${SCENARIO_NAMES[*]}"
     echo "   • Semillas por escenario: ${SEEDS[*]}"
     echo "   • Tiempo de simulación: ${SIMULATION_TIME}s cada una"
+    echo "   • Abortar sin latido tras: ${STALL_TIMEOUT}s (0 = nunca); límite por simulación: ${RUN_TIMEOUT}s (0 = ninguno)"
     echo ""
     echo "🔄 ORDEN DE EJECUCIÓN:"
     
@@ -308,67 +617,158 @@ main() {
             done
         done
     done
+    if [ "$JOBS" -gt 1 ]; then
+        echo "   (en paralelo se lanzan antes las de mayor coste previsto)"
+    fi
     echo ""
     
     estimate_total_time
     
-    # Confirmar ejecución
-    echo ""
-    read -p "¿Continuar con la ejecución secuencial? (y/N): " -n 1 -r
-    echo ""
-    if [[ ! $REPLY =~ ^[Yy]$ ]]; then
-        log "Ejecución cancelada por el usuario"
-        exit 0
+    # Confirmar ejecución (solo en terminal interactiva)
+    if [ "$ASSUME_YES" != true ] && [ -t 0 ]; then
+        echo ""
+        read -p "¿Continuar con la ejecución? (y/N): " -n 1 -r
+        echo ""
+        if [[ ! $REPLY =~ ^[Yy]$ ]]; then
+            log "Ejecución cancelada por el usuario"
+            exit 0
+        fi
     fi
     
     # Registrar inicio
     local overall_start_time=$(date +%s)
     local start_date=$(date)
     
-    log "🚀 Iniciando ejecución secuencial a las $start_date"
+    log "🚀 Iniciando ejecución ($JOBS en paralelo) a las $start_date"
     
     # Variables de seguimiento
     local successful_sims=0
     local failed_sims=0
+    local skipped_sims=0
+    local completed=0
+    local running=0
     local sim_number=1
     
-    # ==================== BUCLE PRINCIPAL SECUENCIAL ====================
+    # ==================== COLA DE TRABAJOS ====================
+    # Simulaciones pendientes en el orden del plan, con su coste previsto
+    local job_specs=()
+    local job_costs=()
+    local plan_load=0
     for cells in "${CELL_NUMBERS[@]}"; do
         for scenario_idx in "${!SCENARIOS[@]}"; do
             local dense="${SCENARIOS[$scenario_idx]}"
             local scenario_name="${SCENARIO_NAMES[$scenario_idx]}"
             
             for seed in "${SEEDS[@]}"; do
+                local output_dir="${BASE_OUTPUT_DIR}/${cells}cell_${scenario_name}_seed${seed}"
+                plan_load=$((plan_load + cells * $(ues_for "$dense")))
                 
-                # Ejecutar simulación individual
-                if run_single_simulation "$cells" "$dense" "$scenario_name" "$seed" "$sim_number" "$total_sims"; then
+                # Reanudar: no repetir simulaciones con resultados verificados
+                if [ "$RESUME" == true ] && output_already_verified "$output_dir" "$cells"; then
+                    info "Simulación $sim_number ($cells celdas - $scenario_name - semilla $seed) ya verificada, se omite"
+                    skipped_sims=$((skipped_sims + 1))
                     successful_sims=$((successful_sims + 1))
-                    success "Simulación $sim_number completada exitosamente"
+                    completed=$((completed + 1))
                 else
-                    failed_sims=$((failed_sims + 1))
-                    error "Simulación $sim_number falló"
-                fi
-                
-                # Mostrar resumen de progreso
-                show_progress_summary $sim_number $total_sims $failed_sims
-                
-                # Generar reporte intermedio cada 5 simulaciones
-                if [ $((sim_number % 5)) -eq 0 ] || [ $sim_number -eq $total_sims ]; then
-                    generate_quick_report $sim_number $failed_sims
+                    job_specs+=("$cells $dense $scenario_name $seed $sim_number")
                 fi
-                
                 sim_number=$((sim_number + 1))
-                
-                # Pausa entre simulaciones (excepto la última)
-                if [ $sim_number -le $total_sims ]; then
-                    log "Pausa de 5 segundos antes de la siguiente simulación..."
-                    sleep 5
-                fi
-                
             done
         done
     done
     
+    local mean_load=$((plan_load / total_sims))
+    local job
+    for job in "${!job_specs[@]}"; do
+        local spec=(${job_specs[$job]})
+        job_costs[$job]=$(predicted_cost "${spec[0]}" "${spec[1]}" "${spec[2]}" $mean_load)
+    done
+    
+    # En paralelo se lanzan primero las de mayor coste previsto (LPT): así una
+    # simulación larga no queda sola al final con el resto de núcleos parados
+    local job_order=("${!job_specs[@]}")
+    if [ "$JOBS" -gt 1 ] && [ ${#job_specs[@]} -gt 1 ]; then
+        job_order=($(for job in "${!job_specs[@]}"; do echo "${job_costs[$job]} $job"; done | \
+                     sort -k1,1nr -k2,2n | awk '{ print $2 }'))
+        info "Cola ordenada por coste previsto (mayor primero)"
+    fi
+    local ordered_specs=()
+    for job in "${job_order[@]}"; do
+        ordered_specs+=("${job_specs[$job]}")
+    done
+    local position=0
+    
+    # ==================== BUCLE PRINCIPAL ====================
+    for job in "${job_order[@]}"; do
+        local cells dense scenario_name seed sim_number
+        read -r cells dense scenario_name seed sim_number <<< "${job_specs[$job]}"
+        local output_dir="${BASE_OUTPUT_DIR}/${cells}cell_${scenario_name}_seed${seed}"
+        position=$((position + 1))
+        
+        if [ "$JOBS" -eq 1 ]; then
+            # Ejecutar simulación individual
+            if run_single_simulation "$cells" "$dense" "$scenario_name" "$seed" "$sim_number" "$total_sims"; then
+                successful_sims=$((successful_sims + 1))
+                success "Simulación $sim_number completada exitosamente"
+            else
+                failed_sims=$((failed_sims + 1))
+                error "Simulación $sim_number falló"
+            fi
+            completed=$((completed + 1))
+            
+            # Mostrar resumen de progreso
+            show_progress_summary $completed $total_sims $failed_sims \
+                $(queued_cost_of $mean_load "${ordered_specs[@]:$position}")
+            
+            # Generar reporte intermedio cada 5 simulaciones
+            if [ $((completed % 5)) -eq 0 ] || [ $completed -eq $total_sims ]; then
+                generate_quick_report $completed $failed_sims
+            fi
+        else
+            # Esperar a que quede un hueco libre
+            while [ $running -ge "$JOBS" ]; do
+                wait -n
+                if [ $? -eq 0 ]; then
+                    successful_sims=$((successful_sims + 1))
+                else
+                    failed_sims=$((failed_sims + 1))
+                fi
+                running=$((running - 1))
+                completed=$((completed + 1))
+                forget_finished_jobs
+                show_progress_summary $completed $total_sims $failed_sims \
+                    $(queued_cost_of $mean_load "${ordered_specs[@]:$((position - 1))}")
+                if [ $((completed % 5)) -eq 0 ]; then
+                    generate_quick_report $completed $failed_sims
+                fi
+            done
+            
+            # Cada trabajo escribe su salida en su propio directorio
+            mkdir -p "$output_dir"
+            progress "Lanzando simulación $sim_number/$total_sims: $cells celdas - $scenario_name - semilla $seed (coste previsto $(format_duration ${job_costs[$job]}))"
+            run_single_simulation "$cells" "$dense" "$scenario_name" "$seed" "$sim_number" "$total_sims" \
+                > "$output_dir/runner.log" 2>&1 &
+            RUNNING_DIRS[$!]="$output_dir"
+            RUNNING_COSTS[$!]=${job_costs[$job]}
+            running=$((running + 1))
+        fi
+    done
+    
+    # Recoger los trabajos en curso
+    while [ $running -gt 0 ]; do
+        wait -n
+        if [ $? -eq 0 ]; then
+            successful_sims=$((successful_sims + 1))
+        else
+            failed_sims=$((failed_sims + 1))
+        fi
+        running=$((running - 1))
+        completed=$((completed + 1))
+        forget_finished_jobs
+        show_progress_summary $completed $total_sims $failed_sims
+    done
+    generate_quick_report $completed $failed_sims
+    
     # ==================== RESUMEN FINAL ====================
     local overall_end_time=$(date +%s)
     local total_time=$((overall_end_time - overall_start_time))
@@ -388,6 +788,7 @@ main() {
     echo "   • Total ejecutadas: $total_sims"
     echo "   • Exitosas: $successful_sims"
     echo "   • Fallidas: $failed_sims"
+    echo "   • Omitidas (ya verificadas): $skipped_sims"
     echo "   • Tasa de éxito: $(( successful_sims * 100 / total_sims ))%"
     echo "   • Tiempo total: ${hours}h ${minutes}m ${seconds}s"
     echo "   • Promedio por simulación: $((total_time / total_sims))s"
@@ -411,16 +812,28 @@ main() {
     echo "   • Logs de simulación: $(find "$BASE_OUTPUT_DIR" -name "simulation.log" | wc -l)"
     echo ""
     
+    # Reparto medio del tiempo de pared por fase (perf_stats de cada simulación)
+    local perf_files=$(find "$BASE_OUTPUT_DIR" -name "perf_stats_optimized_*cell.csv")
+    if [ -n "$perf_files" ]; then
+        echo "⏱️  TIEMPO MEDIO POR FASE:"
+        awk -F, '$1 ~ /^WallTime/ { sum[$1] += $2; n[$1]++ }
+                 END { for (k in sum) printf "   • %-26s %8.1f s\n", substr(k, 9), sum[k] / n[k] }' \
+            $perf_files | sort
+        echo ""
+    fi
+    
     echo "🔬 PRÓXIMOS PASOS PARA ANÁLISIS:"
     echo "   1. Todos los resultados están listos para análisis"
     echo "   2. Cada directorio contiene:"
     echo "      • flow_stats_optimized_*cell.csv (métricas por flujo)"
-    echo "      • cell_stats_optimized_*cell.csv (métricas por celda)" 
+    echo "      • cell_stats_optimized_*cell.csv (métricas por celda)"
+    echo "      • mac_stats_optimized_*cell.csv (planificación: PRB, MCS y HARQ por celda)" 
     echo "      • system_stats_optimized_*cell.csv (métricas del sistema)"
     echo "      • simulation_config_optimized_*cell.txt (configuración)"
+    echo "      • perf_stats_optimized_*cell.csv (perfil de tiempos y memoria)"
     echo ""
-    echo "   3. Para análisis consolidado, puedes crear scripts que procesen"
-    echo "      todos los archivos CSV generados"
+    echo "   3. Agregados entre semillas por (celdas, escenario) en consolidated_*.csv"
+    echo "      (${CONSOLIDATE_NAME}; cada ejecución solo ingiere réplicas nuevas)"
     echo ""
     
     if [ $failed_sims -eq 0 ]; then
@@ -435,72 +848,20 @@ main() {
     echo ""
     echo "╚═══════════════════════════════════════════════════════════════════════════════╝"
     
-    # Crear script simple de consolidación
-    cat > "$BASE_OUTPUT_DIR/consolidate_results.py" << 'EOF'
-#!/usr/bin/env python3
-"""
-Script básico para consolidar resultados de simulaciones 5G
-"""
-import pandas as pd
-import os
-import glob
-
-def consolidate_system_stats(base_dir):
-    """Consolidar todas las estadísticas del sistema"""
-    
-    pattern = os.path.join(base_dir, "*/system_stats_optimized_*cell.csv")
-    files = glob.glob(pattern)
-    
-    all_data = []
-    
-    for file in files:
-        # Extraer info del path
-        dir_name = os.path.basename(os.path.dirname(file))
-        parts = dir_name.split('_')
-        
-        if len(parts) >= 3:
-            cells = parts[0].replace('cell', '')
-            scenario = parts[1]
-            seed = parts[2].replace('seed', '')
-            
-            # Leer archivo
-            try:
-                df = pd.read_csv(file)
-                df['NumCells'] = cells
-                df['Scenario'] = scenario  
-                df['Seed'] = seed
-                df['SourceFile'] = file
-                all_data.append(df)
-            except Exception as e:
-                print(f"Error leyendo {file}: {e}")
-    
-    if all_data:
-        consolidated = pd.concat(all_data, ignore_index=True)
-        output_file = os.path.join(base_dir, "consolidated_system_stats.csv")
-        consolidated.to_csv(output_file, index=False)
-        print(f"✓ Datos consolidados guardados en: {output_file}")
-        print(f"  Total de archivos procesados: {len(files)}")
-        print(f"  Total de registros: {len(consolidated)}")
-        return output_file
-    else:
-        print("✗ No se encontraron archivos para consolidar")
-        return None
-
-if __name__ == "__main__":
-    import sys
-    if len(sys.argv) != 2:
-        print("Uso: python3 consolidate_results.py <directorio_base>")
-        sys.exit(1)
-    
-    base_dir = sys.argv[1]
-    consolidate_system_stats(base_dir)
-EOF
-    
-    chmod +x "$BASE_OUTPUT_DIR/consolidate_results.py"
-    
-    echo ""
-    success "Script de consolidación creado: $BASE_OUTPUT_DIR/consolidate_results.py"
-    echo "Para consolidar resultados: python3 $BASE_OUTPUT_DIR/consolidate_results.py $BASE_OUTPUT_DIR"
+    # Consolidación incremental: solo se leen las réplicas nuevas o modificadas,
+    # con todos los núcleos (las simulaciones ya han terminado)
+    if locate_consolidate_binary; then
+        log "Consolidando resultados con ${CONSOLIDATE_NAME}..."
+        local consolidate_threads
+        consolidate_threads=$(nproc 2>/dev/null || echo 1)
+        if "$CONSOLIDATE_BINARY" "$BASE_OUTPUT_DIR" --threads=$consolidate_threads; then
+            success "Resultados consolidados en $BASE_OUTPUT_DIR/consolidated_*.csv"
+        else
+            warning "La consolidación falló; se puede repetir con: $CONSOLIDATE_BINARY $BASE_OUTPUT_DIR"
+        fi
+    else
+        warning "No se encontró ${CONSOLIDATE_NAME}; copia ${CONSOLIDATE_NAME}.cc a scratch/ para consolidar"
+    fi
     echo ""
 }
 